@@ -1,8 +1,20 @@
 #pragma once
 
 #include "utility.h"
+#include "lock_guard.h"
+#include "seqlock.h"
+#include "shared_mutex.h"
 
+#include <atomic>
+#include <bit>
 #include <compare>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 namespace kbl
 {
@@ -23,22 +35,126 @@ struct avl_default_comparer
 	}
 };
 
+/// Comparer that compares keys with any type they are three-way comparable with.
+/// Lookups of an avl_tree using it accept such types without constructing a key.
+struct avl_transparent_comparer
+{
+	using is_transparent = void;
+
+	template<typename T, typename U>
+	auto operator()(const T& a, const U& b)
+	{
+		return a <=> b;
+	}
+};
+
+/// A lock whose readers may proceed without taking it and validate what they have read afterwards,
+/// like lock::seqlock. With such a lock, lookups of avl_tree never write shared memory,
+/// but elements must stay readable memory after removal, because a lookup may still be passing by.
+/// Taking it exclusively must order the writes before it before the writes made while holding it,
+/// as the release fence of lock::seqlock::lock() does, so that lookups see the keys of the elements linked.
+template<typename TMutex>
+concept AVLOptimisticLock=
+requires(const TMutex& m)
+{
+	{ m.read_retry(m.read_begin()) } -> std::convertible_to<bool>;
+};
+
+/// A comparer declaring is_transparent, which must then compare keys with other types in both orders
+template<typename TCmp>
+concept AVLTransparentComparer=
+requires
+{
+	typename TCmp::is_transparent;
+};
+
+template<typename T>
+using avl_default_deleter = default_deleter<T>;
+
+// placeholder for disabled fields of avl_tree_link
+struct avl_link_empty_field
+{
+};
+
+// optimistic lookups of avl_tree read the child, parent and height words of the links (and the root of the tree)
+// while a writer may be changing them. writers store them with avl_store_link(), a relaxed atomic store that
+// compiles to a plain one but keeps the race defined, and the lookups load them with avl_load_link()
+template<typename T>
+inline void avl_store_link(T& word, std::type_identity_t<T> value)
+{
+	std::atomic_ref<T>{ word }.store(value, std::memory_order_relaxed);
+}
+
 template<typename T>
-struct avl_default_deleter
+inline T avl_load_link(const T& word, std::memory_order order)
+{
+	return std::atomic_ref<T>{ const_cast<T&>(word) }.load(order);
+}
+
+// in-order neighbours kept by threaded links, nullptr at the ends
+template<typename TLink>
+struct avl_link_threads
+{
+	TLink* prev{ nullptr }, * next{ nullptr };
+};
+
+/// Augmentation policy that keeps nothing.
+/// An augmentation policy keeps a summary of each subtree in the links. It provides summary_type and
+/// summarize(owner, left, right), which computes the summary of a subtree from its root element and
+/// the summaries of its children (nullptr for an empty child).
+struct avl_no_augment
 {
-	void operator()(T* ptr)
+	using summary_type = avl_link_empty_field;
+
+	template<typename T>
+	static summary_type summarize(const T&, const summary_type*, const summary_type*)
 	{
-		delete ptr;
+		return {};
 	}
 };
 
-template<typename TOwner, auto TOwner::*Key>
+/// Balancing policy of AVL trees: the heights of sibling subtrees differ by at most one.
+/// Removal may rotate at every level up to the root.
+struct avl_height_balance
+{
+	static constexpr bool weak = false;
+};
+
+/// Balancing policy of weak AVL (WAVL) trees. The height kept by the links becomes a rank,
+/// which exceeds that of each child by one or two, with leaves at the lowest rank.
+/// Insertion and the bulk operations work as with AVL trees, which are valid WAVL trees,
+/// but removal mostly demotes nodes: it does at most two rotations, and O(1) rank changes amortized.
+/// The tree is at most twice as high as an AVL tree of the same elements, and no higher than one without removals.
+struct avl_weak_balance
+{
+	static constexpr bool weak = true;
+};
+
+template<typename TOwner, auto TOwner::*Key, bool EnableSubtreeSize = false, typename TAugment = avl_no_augment,
+		bool EnableThreading = false, typename TBalance = avl_height_balance>
 struct avl_tree_link
 {
+	using augment_type = TAugment;
+	using balance_type = TBalance;
+
+	static constexpr bool subtree_size_enabled = EnableSubtreeSize;
+	static constexpr bool augmented = !std::is_same_v<TAugment, avl_no_augment>;
+	static constexpr bool threading_enabled = EnableThreading;
+	static constexpr bool compact = false;
+
 	TOwner* owner{ nullptr };
 
 	size_t height{ 1 };
 
+	// number of nodes in the subtree, for the order statistics of avl_tree
+	[[no_unique_address]] std::conditional_t<EnableSubtreeSize, size_t, avl_link_empty_field> size{};
+
+	// summary of the subtree kept by TAugment
+	[[no_unique_address]] typename TAugment::summary_type summary{};
+
+	// in-order predecessor and successor, for iteration without climbing the tree
+	[[no_unique_address]] std::conditional_t<EnableThreading, avl_link_threads<avl_tree_link>, avl_link_empty_field> threads{};
+
 	bool sentinel{ false };
 
 	avl_tree_link* left{ nullptr }, * right{ nullptr };
@@ -52,23 +168,23 @@ struct avl_tree_link
 	void set_left(avl_tree_link* l)
 	{
 		if (left && left->parent == this)
-			left->parent = nullptr;
+			avl_store_link(left->parent, nullptr);
 
-		left = l;
+		avl_store_link(left, l);
 
 		if (left)
-			left->parent = this;
+			avl_store_link(left->parent, this);
 	}
 
 	void set_right(avl_tree_link* r)
 	{
 		if (right && right->parent == this)
-			right->parent = nullptr;
+			avl_store_link(right->parent, nullptr);
 
-		right = r;
+		avl_store_link(right, r);
 
 		if (right)
-			right->parent = this;
+			avl_store_link(right->parent, this);
 	}
 
 	[[nodiscard]] avl_tree_link()
@@ -106,6 +222,131 @@ struct avl_tree_link
 	}
 };
 
+/// \brief A smaller drop-in replacement of avl_tree_link: 24 bytes instead of 48 on 64-bit targets.
+/// The owner is found from the offset of the link in TOwner, and the height and the sentinel flag
+/// are packed into the parent pointer. This relies on pointers being canonical in 57 bits,
+/// that is, bits 57-63 are copies of bit 56, which holds for x86-64 and AArch64 without tagging.
+template<typename TOwner, auto TOwner::*Key, bool EnableSubtreeSize = false, typename TAugment = avl_no_augment,
+		bool EnableThreading = false, typename TBalance = avl_height_balance>
+struct avl_tree_compact_link
+{
+	using augment_type = TAugment;
+	using balance_type = TBalance;
+
+	static constexpr bool subtree_size_enabled = EnableSubtreeSize;
+	static constexpr bool augmented = !std::is_same_v<TAugment, avl_no_augment>;
+	static constexpr bool threading_enabled = EnableThreading;
+	static constexpr bool compact = true;
+
+	static_assert(sizeof(uintptr_t) == 8, "avl_tree_compact_link packs the parent pointer as a 64-bit word");
+
+	avl_tree_compact_link* left{ nullptr }, * right{ nullptr };
+
+	// number of nodes in the subtree, for the order statistics of avl_tree
+	[[no_unique_address]] std::conditional_t<EnableSubtreeSize, size_t, avl_link_empty_field> size{};
+
+	// summary of the subtree kept by TAugment
+	[[no_unique_address]] typename TAugment::summary_type summary{};
+
+	// in-order predecessor and successor, for iteration without climbing the tree
+	[[no_unique_address]] std::conditional_t<EnableThreading, avl_link_threads<avl_tree_compact_link>, avl_link_empty_field> threads{};
+
+	[[nodiscard]] avl_tree_compact_link()
+	{
+		set_height(1);
+	}
+
+	// the owner isn't stored, the parameter only keeps the constructor compatible with avl_tree_link
+	[[nodiscard]] explicit avl_tree_compact_link(TOwner*)
+			: avl_tree_compact_link()
+	{
+	}
+
+	[[nodiscard]] explicit avl_tree_compact_link(bool is_sentinel)
+			: avl_tree_compact_link()
+	{
+		bits_ |= is_sentinel ? SENTINEL_BIT : 0;
+	}
+
+	avl_tree_compact_link* parent() const
+	{
+		return parent_in(bits_);
+	}
+
+	// parent() for optimistic lookups, see avl_load_link()
+	avl_tree_compact_link* parent(std::memory_order order) const
+	{
+		return parent_in(avl_load_link(bits_, order));
+	}
+
+	void set_parent(avl_tree_compact_link* p)
+	{
+		avl_store_link(bits_, (bits_ & ~POINTER_MASK) | (reinterpret_cast<uintptr_t>(p) & POINTER_MASK));
+	}
+
+	[[nodiscard]] size_t height() const
+	{
+		return bits_ >> HEIGHT_SHIFT;
+	}
+
+	// height() for optimistic lookups, see avl_load_link()
+	[[nodiscard]] size_t height(std::memory_order order) const
+	{
+		return avl_load_link(bits_, order) >> HEIGHT_SHIFT;
+	}
+
+	void set_height(size_t h)
+	{
+		avl_store_link(bits_, (bits_ & ~HEIGHT_MASK) | (static_cast<uintptr_t>(h) << HEIGHT_SHIFT));
+	}
+
+	[[nodiscard]] bool sentinel() const
+	{
+		return bits_ & SENTINEL_BIT;
+	}
+
+	void set_left(avl_tree_compact_link* l)
+	{
+		if (left && left->parent() == this)
+			left->set_parent(nullptr);
+
+		avl_store_link(left, l);
+
+		if (left)
+			left->set_parent(this);
+	}
+
+	void set_right(avl_tree_compact_link* r)
+	{
+		if (right && right->parent() == this)
+			right->set_parent(nullptr);
+
+		avl_store_link(right, r);
+
+		if (right)
+			right->set_parent(this);
+	}
+
+	// bit 0: sentinel, bits 1-56: parent (or the root, for sentinels), bits 57-63: height.
+	// public like the other fields, which keeps the owners standard-layout; use the accessors above.
+	uintptr_t bits_{ 0 };
+
+private:
+	// 7 bits hold heights up to 127, far above what 2^57 bytes of nodes can reach
+	static constexpr uintptr_t HEIGHT_BITS = 7;
+	static constexpr uintptr_t HEIGHT_SHIFT = 64 - HEIGHT_BITS;
+	static constexpr uintptr_t HEIGHT_MASK = ~uintptr_t{ 0 } << HEIGHT_SHIFT;
+	static constexpr uintptr_t SENTINEL_BIT = 1;
+	static constexpr uintptr_t POINTER_MASK = ~HEIGHT_MASK & ~SENTINEL_BIT;
+
+	static avl_tree_compact_link* parent_in(uintptr_t bits)
+	{
+		// restore the upper bits from bit 56
+		auto extended = static_cast<intptr_t>(bits << HEIGHT_BITS) >> HEIGHT_BITS;
+		return reinterpret_cast<avl_tree_compact_link*>(extended & ~static_cast<intptr_t>(SENTINEL_BIT));
+	}
+};
+
 template<typename T,
 		typename TContainer,
 		bool EnableLock = false>
@@ -130,6 +371,7 @@ public:
 
 	using dummy_type = int;
 
+	friend TContainer;
 
 public:
 	avl_tree_iterator() = default;
@@ -143,12 +385,14 @@ public:
 	avl_tree_iterator(avl_tree_iterator&& another) noexcept
 	{
 		h_ = another.h_;
+		cont_ = another.cont_;
 		another.h_ = nullptr;
 	}
 
 	avl_tree_iterator(const avl_tree_iterator& another)
 	{
 		h_ = another.h_;
+		cont_ = another.cont_;
 	}
 
 	avl_tree_iterator& operator=(const avl_tree_iterator& another)
@@ -156,6 +400,7 @@ public:
 		if (this == &another)return *this;
 
 		h_ = another.h_;
+		cont_ = another.cont_;
 		return *this;
 	}
 
@@ -167,7 +412,7 @@ public:
 
 	T* operator->()
 	{
-		return h_->owner;
+		return container_type::owner_of(h_);
 	}
 
 	bool operator==(avl_tree_iterator const& other) const
@@ -180,7 +425,8 @@ public:
 		return !(*this == other);
 	}
 
-	avl_tree_iterator& operator++()
+	// iterating needs the tree kept from modification by the caller, see avl_tree
+	avl_tree_iterator& operator++() TA_NO_THREAD_SAFETY_ANALYSIS
 	{
 		h_ = cont_->next_of(h_);
 		return *this;
@@ -193,7 +439,7 @@ public:
 		return rc;
 	}
 
-	avl_tree_iterator& operator--()
+	avl_tree_iterator& operator--() TA_NO_THREAD_SAFETY_ANALYSIS
 	{
 		h_ = cont_->prev_of(h_);
 
@@ -213,20 +459,29 @@ private:
 };
 
 
+/// \brief Intrusive AVL tree.
+/// With EnableLock, operations on the tree take an internal reader-writer lock of type TMutex, see no_lock.
+/// Operations on two trees lock them in address order.
 template<typename T, AVLTreeKey TKey,
 		TKey T::*Key,
-		avl_tree_link<T, Key> T::*Link,
+		auto T::*Link,
 		bool EnableLock = false,
 		bool CallDeleteOnRemoval = false,
 		typename TCmp= avl_default_comparer<TKey>,
-		typename TDeleter=avl_default_deleter<T>>
+		typename TDeleter=avl_default_deleter<T>,
+		typename TMutex = lock::shared_mutex>
 class avl_tree
 {
 public:
 	using value_type = T;
 	using size_type = size_t;
 	using ssize_type = int64_t;
-	using link_type = avl_tree_link<T, Key>;
+	using mutex_type = std::conditional_t<EnableLock, TMutex, no_lock>;
+	using lock_guard_type = std::conditional_t<EnableLock, lock::lock_guard<TMutex>, no_lock_guard<no_lock>>;
+	using shared_lock_guard_type = std::conditional_t<EnableLock,
+			lock::shared_lock_guard<TMutex>,
+			no_lock_guard<no_lock>>;
+	using link_type = std::remove_cvref_t<decltype(std::declval<T&>().*Link)>;
 	using iterator_type = avl_tree_iterator<T, avl_tree, EnableLock>;
 	using riterator_type = kbl::reversed_iterator<iterator_type>;
 	using const_iterator_type = const iterator_type;
@@ -235,16 +490,28 @@ public:
 	friend
 	class avl_tree_iterator;
 
+	/// lookups don't take the lock but validate their result, see AVLOptimisticLock
+	static constexpr bool optimistic_reads = EnableLock && AVLOptimisticLock<TMutex>;
+
+	static_assert(!optimistic_reads || !CallDeleteOnRemoval,
+			"optimistic readers may still be visiting removed elements, so they can't be deleted on removal");
+
+	static_assert(!link_type::compact || std::is_standard_layout_v<T>,
+			"avl_tree_compact_link finds its owner by its offset, which only standard-layout owners define");
+
 public:
 	avl_tree()
 	{
 	}
 
-	void insert(T* val)
+	/// Insert an element. Does nothing if an element with the same key exists.
+	/// \param val
+	void insert(T* val) TA_EXCL(lock_)
 	{
-		root_ = insert(&(val->*Link), root_);
-		update_sentinels();
+		lock_guard_type g{ lock_ };
 
+		insert_node(&(val->*Link));
+		update_sentinels();
 	}
 
 	void insert(T& val)
@@ -252,436 +519,2311 @@ public:
 		insert(&val);
 	}
 
-	void remove(T* val)
+	/// Insert an element right before hint, like std::set::emplace_hint. If hint is wrong, it is ignored.
+	/// With a correct hint no search is done, and the amortized cost is O(1) plus finding the predecessor of hint,
+	/// or O(log n) if subtree sizes or an augmentation are kept.
+	/// \param hint the element after val, end() if val goes last
+	/// \param val
+	/// \return iterator to val, or to the element with the same key if there is one
+	iterator_type insert(iterator_type hint, T& val) TA_EXCL(lock_)
 	{
-		root_ = remove(&(val->*Link), root_);
-		update_sentinels();
+		lock_guard_type g{ lock_ };
 
-		if constexpr (CallDeleteOnRemoval)
+		auto newnode = link_of(val);
+
+		link_type* next = is_sentinel(hint.h_) ? nullptr : hint.h_;
+		link_type* prev = next ? (next == first_ ? nullptr : prev_of(next)) : last_;
+
+		if (prev)
 		{
-			deleter_(val);
+			auto cmp_val = cmp_(key_of(prev), key_of(newnode));
+			if (cmp_val == 0)
+				return iterator_of(prev);
+			else if (cmp_val > 0)
+				return insert_without_hint(newnode);
 		}
-	}
 
-	void remove(T& val)
-	{
-		remove(&val);
-	}
-
-	void clear()
-	{
-		for (link_type* victim = max_node(root_); victim; victim = max_node(root_))
+		if (next)
 		{
-			remove(victim->owner);
+			auto cmp_val = cmp_(key_of(newnode), key_of(next));
+			if (cmp_val == 0)
+				return iterator_of(next);
+			else if (cmp_val > 0)
+				return insert_without_hint(newnode);
 		}
-	}
 
-	T* find_ptr(TKey key)
-	{
+		// either next has no left child, or prev, the greatest node of that child, has no right child
+		if (next && next->left == nullptr)
+			attach_node(newnode, next, &next->left);
+		else if (prev)
+			attach_node(newnode, prev, &prev->right);
+		else
+			attach_node(newnode, nullptr, &root_);
 
+		update_sentinels();
+		return iterator_of(newnode);
 	}
 
-	T& find(TKey)
+	iterator_type insert(iterator_type hint, T* val)
 	{
-		
+		return insert(hint, *val);
 	}
 
-	avl_tree& join(avl_tree& another)
+	/// Append an element whose key is greater than that of back(), in amortized O(1)
+	/// (O(log n) if subtree sizes or an augmentation are kept). Falls back to insert() for other keys.
+	/// \param val
+	/// \return iterator to val, or to the element with the same key if there is one
+	iterator_type push_back_max(T& val)
 	{
-
+		return insert(end(), val);
 	}
 
-	avl_tree& unite(avl_tree& another)
+	iterator_type push_back_max(T* val)
 	{
-
+		return insert(end(), *val);
 	}
 
-	avl_tree& split(link_type pos)
+	/// Remove the element with the same key as val, which needn't be val itself. Does nothing if there isn't one.
+	/// \param val
+	void remove(T* val) TA_EXCL(lock_)
 	{
+		lock_guard_type g{ lock_ };
 
+		// looked up even if val is linked, since the link alone can't tell this tree from another one
+		remove_key(key_of(&(val->*Link)));
 	}
 
-	[[nodiscard]] size_type size() const
+	void remove(T& val)
 	{
-		return size_;
+		remove(&val);
 	}
 
-	[[nodiscard]] bool empty() const
+	/// Remove val itself. Unlike remove(), does nothing if another element has its key.
+	/// \param val
+	/// \return false if val isn't in the tree
+	bool remove_element(T* val) TA_EXCL(lock_)
 	{
-		return size_ == 0;
-	}
+		lock_guard_type g{ lock_ };
 
-	iterator_type begin()
-	{
-		return iterator_type{ first_of(root_), this };
-	}
+		auto node = &(val->*Link);
+		if (find_node(key_of(node)) != node)
+			return false;
 
-	iterator_type end()
-	{
-		return iterator_type{ &back_sentinel_, this };
+		erase_node(node);
+		return true;
 	}
 
-	riterator_type rbegin()
+	bool remove_element(T& val)
 	{
-		return riterator_type{ last_of(root_), this };
+		return remove_element(&val);
 	}
 
-	riterator_type rend()
+	/// Remove the element with the given key as if by remove()
+	/// \param key
+	/// \return false if there isn't one
+	bool remove_by_key(const TKey& key) TA_EXCL(lock_)
 	{
-		return riterator_type{ &front_sentinel_, this };
+		lock_guard_type g{ lock_ };
+
+		return remove_key(key);
 	}
 
-	const_iterator_type cbegin() const
+	/// remove_by_key() with any type the transparent comparer compares with TKey
+	template<typename TKeyLike>
+	bool remove_by_key(const TKeyLike& key) requires AVLTransparentComparer<TCmp> TA_EXCL(lock_)
 	{
-		return const_iterator_type{ first_of(root_), const_cast<avl_tree*>( this) };
+		lock_guard_type g{ lock_ };
+
+		return remove_key(key);
 	}
 
-	const_iterator_type cend() const
+	/// Remove all elements as if by remove(), in O(n) without rebalancing
+	void clear()
 	{
-		return const_iterator_type{ const_cast<link_type*>( &back_sentinel_), const_cast<avl_tree*>( this) };
+		if constexpr (CallDeleteOnRemoval)
+			clear_and_dispose(deleter_);
+		else
+			clear_and_dispose([](T*)
+			{
+			});
 	}
 
-	T* front_ptr()
+	/// Remove all elements in O(n) without rebalancing, and call disposer on each of them instead of TDeleter.
+	/// Links are reset before disposer is called, so it may free the element or link it into another tree.
+	/// \tparam TDisposer callable with T*
+	/// \param disposer
+	template<typename TDisposer>
+	void clear_and_dispose(TDisposer&& disposer) TA_EXCL(lock_)
 	{
-		return (first_of(root_)->owner);
+		link_type* root = nullptr;
+
+		{
+			lock_guard_type g{ lock_ };
+
+			root = root_;
+
+			avl_store_link(root_, nullptr);
+			size_ = 0;
+			size_known_ = true;
+			update_bounds();
+		}
+
+		// the nodes are no longer reachable by others, so they are disposed without the lock
+		teardown(root, [&disposer](link_type* node)
+		{
+			disposer(owner_of(node));
+		});
 	}
 
-	T* back_ptr()
+	/// Remove the elements whose key is in [lo, hi) as if by remove(), in O(log n + k) for k elements removed
+	/// \param lo
+	/// \param hi
+	/// \return number of elements removed
+	size_type erase_range(const TKey& lo, const TKey& hi)
 	{
-		return (last_of(root_)->owner);
+		if constexpr (CallDeleteOnRemoval)
+			return erase_range_and_dispose(lo, hi, deleter_);
+		else
+			return erase_range_and_dispose(lo, hi, [](T*)
+			{
+			});
 	}
 
-	T& front()
+	/// erase_range(), but call disposer on each removed element in key order instead of TDeleter.
+	/// Links are reset before disposer is called, so it may free the element,
+	/// or link it into another container such as an intrusive_list to process the batch later.
+	/// \tparam TDisposer callable with T*
+	/// \param lo
+	/// \param hi
+	/// \param disposer
+	/// \return number of elements removed
+	template<typename TDisposer>
+	size_type erase_range_and_dispose(const TKey& lo, const TKey& hi, TDisposer&& disposer) TA_EXCL(lock_)
 	{
-		return *front_ptr();
+		link_type* range = nullptr;
+
+		{
+			lock_guard_type g{ lock_ };
+
+			if (cmp_(lo, hi) < 0)
+				range = detach_range(lower_bound_node(lo), lower_bound_node(hi));
+		}
+
+		return dispose_range(range, disposer);
 	}
 
-	T& back()
+	/// Remove the elements in [first, last) as if by remove(), in O(log n + k) for k elements removed
+	/// \param first
+	/// \param last
+	/// \return last
+	iterator_type erase(iterator_type first, iterator_type last)
 	{
-		return *back_ptr();
+		if constexpr (CallDeleteOnRemoval)
+			return erase_and_dispose(first, last, deleter_);
+		else
+			return erase_and_dispose(first, last, [](T*)
+			{
+			});
 	}
 
-private:
-	static inline constexpr size_type height_of(link_type* node)
+	/// erase(), but call disposer on each removed element in key order instead of TDeleter,
+	/// like erase_range_and_dispose()
+	/// \tparam TDisposer callable with T*
+	/// \param first
+	/// \param last
+	/// \param disposer
+	/// \return last
+	template<typename TDisposer>
+	iterator_type erase_and_dispose(iterator_type first, iterator_type last, TDisposer&& disposer) TA_EXCL(lock_)
 	{
-		return node == nullptr ? 0 : node->height;
+		if (first == last || is_sentinel(first.h_))
+			return last;
+
+		link_type* range = nullptr;
+
+		{
+			lock_guard_type g{ lock_ };
+
+			range = detach_range(first.h_, is_sentinel(last.h_) ? nullptr : last.h_);
+		}
+
+		dispose_range(range, disposer);
+		return last;
 	}
 
-	static inline constexpr TKey& key_of(link_type* node)
+	/// Find the element with the given key
+	/// \param key
+	/// \return pointer to the element, or nullptr if it doesn't exist
+	T* find_ptr(const TKey& key) TA_EXCL(lock_)
 	{
-		return node->owner->*Key;
+		auto node = lookup([&]
+		{
+			return find_node(key);
+		});
+
+		return node ? owner_of(node) : nullptr;
 	}
 
-	static inline void update_height(link_type* node)
+	/// Find the element with the given key
+	/// \param key
+	/// \return iterator to the element, or end() if it doesn't exist
+	iterator_type find(const TKey& key) TA_EXCL(lock_)
 	{
-		node->height = std::max(height_of(node->left), height_of(node->right)) + 1;
+		return iterator_of(lookup([&]
+		{
+			return find_node(key);
+		}));
 	}
 
-	static inline constexpr int64_t balance_factor(link_type* node)
+	/// \param key
+	/// \return iterator to the first element whose key is not less than key
+	iterator_type lower_bound(const TKey& key) TA_EXCL(lock_)
 	{
-		return height_of(node->left) - height_of(node->right);
+		return iterator_of(lookup([&]
+		{
+			return lower_bound_node(key);
+		}));
 	}
 
-	static inline link_type* left_rotate(link_type* root)
+	/// \param key
+	/// \return iterator to the first element whose key is greater than key
+	iterator_type upper_bound(const TKey& key) TA_EXCL(lock_)
 	{
-		auto right = root->right;
-
-		root->set_right(right->left);
-		right->set_left(root);
-//		root->right = right->left;
-//		right->left = root;
-
-		update_height(right);
-		update_height(root);
-
-		return right;
+		return iterator_of(lookup([&]
+		{
+			return upper_bound_node(key);
+		}));
 	}
 
-	static inline link_type* right_rotate(link_type* root)
+	/// \param key
+	/// \return [lower_bound(key), upper_bound(key))
+	std::pair<iterator_type, iterator_type> equal_range(const TKey& key) TA_EXCL(lock_)
 	{
-		auto left = root->left;
+		auto[lower, upper] = lookup([&]
+		{
+			return std::pair{ lower_bound_node(key), upper_bound_node(key) };
+		});
 
-		root->set_left(left->right);
-		left->set_right(root);
+		return { iterator_of(lower), iterator_of(upper) };
+	}
 
-//		root->left = left->right;
-//		left->right = root;
+	// the lookups above with any type the transparent comparer compares with TKey, without constructing a TKey
 
-		update_height(root);
-		update_height(left);
+	template<typename TKeyLike>
+	T* find_ptr(const TKeyLike& key) requires AVLTransparentComparer<TCmp> TA_EXCL(lock_)
+	{
+		auto node = lookup([&]
+		{
+			return find_node(key);
+		});
 
-		return left;
+		return node ? owner_of(node) : nullptr;
 	}
 
-	static inline link_type* min_node(link_type* root)
+	template<typename TKeyLike>
+	iterator_type find(const TKeyLike& key) requires AVLTransparentComparer<TCmp> TA_EXCL(lock_)
 	{
-		if (!root)return root;
+		return iterator_of(lookup([&]
+		{
+			return find_node(key);
+		}));
+	}
 
-		while (root->left)
-			root = root->left;
+	template<typename TKeyLike>
+	iterator_type lower_bound(const TKeyLike& key) requires AVLTransparentComparer<TCmp> TA_EXCL(lock_)
+	{
+		return iterator_of(lookup([&]
+		{
+			return lower_bound_node(key);
+		}));
+	}
 
-		return root;
+	template<typename TKeyLike>
+	iterator_type upper_bound(const TKeyLike& key) requires AVLTransparentComparer<TCmp> TA_EXCL(lock_)
+	{
+		return iterator_of(lookup([&]
+		{
+			return upper_bound_node(key);
+		}));
 	}
 
-	static inline link_type* max_node(link_type* root)
+	template<typename TKeyLike>
+	std::pair<iterator_type, iterator_type> equal_range(const TKeyLike& key) requires AVLTransparentComparer<TCmp> TA_EXCL(lock_)
 	{
-		if (!root)return root;
+		auto[lower, upper] = lookup([&]
+		{
+			return std::pair{ lower_bound_node(key), upper_bound_node(key) };
+		});
 
-		while (root->right)
-			root = root->right;
+		return { iterator_of(lower), iterator_of(upper) };
+	}
 
-		return root;
+	/// lower_bound() starting from pos rather than from the root. It climbs from pos to the lowest subtree
+	/// that may hold the result and descends from there, which costs O(log d) for most results
+	/// d elements away from pos, and O(log n) at worst. Suits lookups close to the previous one.
+	/// \param pos any iterator of this tree, end() starts from the last element
+	/// \param key
+	/// \return iterator to the first element whose key is not less than key
+	iterator_type lower_bound_from(iterator_type pos, const TKey& key) TA_EXCL(lock_)
+	{
+		return iterator_of(lookup([&]
+		{
+			return lower_bound_node_from(pos.h_, key);
+		}));
 	}
 
-	void update_sentinels()
+	/// find() starting from pos, like lower_bound_from()
+	/// \param pos any iterator of this tree, end() starts from the last element
+	/// \param key
+	/// \return iterator to the element, or end() if it doesn't exist
+	iterator_type find_from(iterator_type pos, const TKey& key) TA_EXCL(lock_)
 	{
-		back_sentinel_.root = root_;
-		front_sentinel_.root = root_;
+		return iterator_of(lookup([&]() -> link_type*
+		{
+			auto node = lower_bound_node_from(pos.h_, key);
+			return node && cmp_(key_of(node), key) == 0 ? node : nullptr;
+		}));
 	}
 
-	link_type* next_of(link_type* node)
+	/// Link the elements in [first, last) into a perfectly balanced tree in O(n).
+	/// They must be sorted by key without duplicates. If the tree isn't empty, they are united with it.
+	/// \tparam TIter iterator to T or T*
+	/// \param first
+	/// \param last
+	/// \return this
+	template<typename TIter>
+	avl_tree& build_from_sorted(TIter first, TIter last) TA_EXCL(lock_)
 	{
-		if (node->sentinel)return node;
+		lock_guard_type g{ lock_ };
 
-		if (node->parent == nullptr && node->left == nullptr && node->right == nullptr)
-			return nullptr;
+		auto count = static_cast<size_type>(std::distance(first, last));
+		if (count == 0)
+			return *this;
 
-		if (node->right)
+		link_type* prev = nullptr;
+		auto built = build_balanced(first, count, prev);
+
+		if (root_ == nullptr)
 		{
-			return first_of(node->right);
+			avl_store_link(root_, built);
+			size_ = count;
+			size_known_ = true;
 		}
+		else
+		{
+			sequential_executor executor{};
+			node_chain dropped{};
 
-		link_type* parent = nullptr;
-		while ((parent = node->parent) && node == parent->right)
-			node = parent;
+			avl_store_link(root_, union_of(root_, built, dropped, executor));
+			size_ += count - dropped.count;
 
-		if (!parent)return &back_sentinel_;
+			dispose_chain(dropped.head);
+		}
 
-		return parent;
+		update_bounds();
+		return *this;
 	}
 
-	link_type* prev_of(link_type* node)
+	/// build_from_sorted(), but check the order first
+	/// \return false, leaving the tree unchanged, if [first, last) isn't strictly ascending by key
+	template<typename TIter>
+	bool build_from_sorted_checked(TIter first, TIter last)
 	{
-		if (node->sentinel)return last_of(node->root);
+		if (first != last)
+		{
+			for (auto prev = first, iter = std::next(first); iter != last; prev = iter++)
+			{
+				if (cmp_(key_of(link_of(*prev)), key_of(link_of(*iter))) >= 0)
+					return false;
+			}
+		}
 
-		if (node->parent == nullptr && node->left == nullptr && node->right == nullptr)return nullptr;
+		build_from_sorted(first, last);
+		return true;
+	}
 
-		if (node->left)
+	/// The element at the given position in key order, in O(log n). Requires subtree sizes to be enabled.
+	/// \param k zero-based position
+	/// \return iterator to the element, or end() if k >= size()
+	iterator_type select(size_type k) requires link_type::subtree_size_enabled
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		auto node = root_;
+		while (node)
 		{
-			return last_of(node->left);
+			auto left_size = size_of(node->left);
+			if (k < left_size)
+			{
+				node = node->left;
+			}
+			else if (k == left_size)
+			{
+				break;
+			}
+			else
+			{
+				k -= left_size + 1;
+				node = node->right;
+			}
 		}
 
-		link_type* parent = nullptr;
-		while ((parent = node->parent) && node == parent->left)
-			node = parent;
+		return iterator_of(node);
+	}
 
-		if (!parent)return &front_sentinel_; // the very first
+	/// Number of elements whose key is less than key, in O(log n). Requires subtree sizes to be enabled.
+	/// \param key
+	/// \return
+	size_type rank(const TKey& key) requires link_type::subtree_size_enabled
+	{
+		shared_lock_guard_type g{ lock_ };
 
-		return parent;
+		return do_rank(key);
 	}
 
-	static inline link_type* first_of(link_type* root)
+	/// Number of elements whose key is in [lo, hi), in O(log n). Requires subtree sizes to be enabled.
+	/// \param lo
+	/// \param hi
+	/// \return
+	size_type count_range(const TKey& lo, const TKey& hi) requires link_type::subtree_size_enabled
 	{
-		if (root->sentinel)return nullptr;
-
-		if (root->left == nullptr)
-			return root;
+		shared_lock_guard_type g{ lock_ };
 
-		auto left = root->left;
-		while (left->left && !left->left->sentinel)
-			left = left->left;
+		if (cmp_(lo, hi) >= 0)
+			return 0;
 
-		return left;
+		return do_rank(hi) - do_rank(lo);
 	}
 
-	static inline link_type* last_of(link_type* root)
+	/// Concatenate another, whose keys are all greater or all less than the keys of this tree,
+	/// in O(log n). Falls back to unite() if the key ranges overlap.
+	/// After that another becomes empty.
+	/// \param another
+	/// \return this
+	avl_tree& join(avl_tree& another) TA_EXCL(lock_)
 	{
-		if (root->sentinel)return nullptr;
-
-		if (root->right == nullptr)
-			return root;
+		if (&another == this)
+			return *this;
 
-		auto right = root->right;
-		while (right->right && !right->right->sentinel)
-			right = right->right;
+		pair_lock_guard<false> g{ *this, another };
 
-		return right;
-	}
+		if (another.root_ == nullptr)
+			return *this;
 
-	std::strong_ordering compare(link_type* n1, link_type* n2)
+		if (root_ == nullptr)
+		{
+			avl_store_link(root_, another.root_);
+			avl_store_link(another.root_, nullptr);
+			std::swap(size_, another.size_);
+			std::swap(size_known_, another.size_known_);
+		}
+		else if (cmp_(key_of(max_node(root_)), key_of(min_node(another.root_))) < 0)
+		{
+			avl_store_link(root_, join2(root_, another.root_));
+			take_size_of(another);
+		}
+		else if (cmp_(key_of(max_node(another.root_)), key_of(min_node(root_))) < 0)
+		{
+			avl_store_link(root_, join2(another.root_, root_));
+			take_size_of(another);
+		}
+		else
+		{
+			sequential_executor executor{};
+			return do_unite(another, executor);
+		}
+
+		update_bounds();
+		another.update_bounds();
+
+		return *this;
+	}
+
+	/// Move all elements of another into this tree in O(m log(n/m + 1)), where m <= n are the sizes of the trees.
+	/// Elements of another whose key already exists in this tree are removed as if by remove().
+	/// After that another becomes empty.
+	/// \param another
+	/// \return this
+	avl_tree& unite(avl_tree& another)
+	{
+		sequential_executor executor{};
+		return unite(another, executor);
+	}
+
+	/// unite(), with the two halves of each recursion step forked on executor
+	/// \tparam TExecutor provides fork_join(f1, f2), for example kbl::fork_join_pool
+	/// \param another
+	/// \param executor
+	/// \return this
+	template<typename TExecutor>
+	avl_tree& unite(avl_tree& another, TExecutor& executor) TA_EXCL(lock_)
+	{
+		if (&another == this)
+			return *this;
+
+		pair_lock_guard<false> g{ *this, another };
+
+		return do_unite(another, executor);
+	}
+
+	/// Keep only the elements whose key also exists in another, in O(m log(n/m + 1)).
+	/// Other elements are removed as if by remove(). another is not modified.
+	/// \param another
+	/// \return this
+	avl_tree& intersect(const avl_tree& another)
+	{
+		sequential_executor executor{};
+		return intersect(another, executor);
+	}
+
+	/// intersect(), with the two halves of each recursion step forked on executor
+	template<typename TExecutor>
+	avl_tree& intersect(const avl_tree& another, TExecutor& executor) TA_EXCL(lock_)
+	{
+		if (&another == this)
+			return *this;
+
+		pair_lock_guard<true> g{ *this, another };
+
+		node_chain dropped{};
+
+		avl_store_link(root_, intersection_of(root_, another.root_, dropped, executor));
+		size_ -= dropped.count;
+
+		dispose_chain(dropped.head);
+		update_bounds();
+
+		return *this;
+	}
+
+	/// Remove the elements whose key exists in another, as if by remove(), in O(m log(n/m + 1)).
+	/// another is not modified.
+	/// \param another
+	/// \return this
+	avl_tree& subtract(const avl_tree& another)
+	{
+		sequential_executor executor{};
+		return subtract(another, executor);
+	}
+
+	/// subtract(), with the two halves of each recursion step forked on executor
+	template<typename TExecutor>
+	avl_tree& subtract(const avl_tree& another, TExecutor& executor) TA_EXCL(lock_)
+	{
+		pair_lock_guard<true> g{ *this, another };
+
+		node_chain dropped{};
+
+		if (&another == this)
+		{
+			chain_all(root_, dropped);
+			avl_store_link(root_, nullptr);
+		}
+		else
+		{
+			avl_store_link(root_, difference_of(root_, another.root_, dropped, executor));
+		}
+
+		size_ -= dropped.count;
+
+		dispose_chain(dropped.head);
+		update_bounds();
+
+		return *this;
+	}
+
+	/// Move the elements whose key is not less than key to another in O(log n).
+	/// Elements already in another are kept, as if by unite().
+	/// \param key
+	/// \param another
+	/// \return this
+	avl_tree& split(const TKey& key, avl_tree& another) TA_EXCL(lock_)
+	{
+		if (&another == this)
+			return *this;
+
+		pair_lock_guard<false> g{ *this, another };
+
+		return split_to(lower_bound_node(key), another);
+	}
+
+	/// Move the elements in [pos, end()) to another in O(log n).
+	/// Elements already in another are kept, as if by unite().
+	/// \param pos
+	/// \param another
+	/// \return this
+	avl_tree& split(iterator_type pos, avl_tree& another) TA_EXCL(lock_)
+	{
+		if (&another == this || is_sentinel(pos.h_))
+			return *this;
+
+		pair_lock_guard<false> g{ *this, another };
+
+		return split_to(pos.h_, another);
+	}
+
+	/// Number of elements. O(n) for the first call after split() unless subtree sizes are enabled, O(1) otherwise.
+	[[nodiscard]] size_type size() const TA_EXCL(lock_)
+	{
+		if constexpr (link_type::subtree_size_enabled)
+		{
+			shared_lock_guard_type g{ lock_ };
+			return size_of(root_);
+		}
+		else
+		{
+			{
+				shared_lock_guard_type g{ lock_ };
+				if (size_known_)
+					return size_;
+			}
+
+			// counting caches the size, which readers sharing the lock mustn't do
+			lock_guard_type g{ lock_ };
+			return do_size();
+		}
+	}
+
+	[[nodiscard]] bool empty() const TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return root_ == nullptr;
+	}
+
+	/// Call func on every element in key order, holding the lock shared throughout.
+	/// func mustn't modify the tree.
+	/// \tparam TFunc callable with T&
+	/// \param func
+	template<typename TFunc>
+	void for_each(TFunc&& func) TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		for (auto node = root_ ? first_ : nullptr; node && !is_sentinel(node); node = next_of(node))
+		{
+			func(*owner_of(node));
+		}
+	}
+
+	iterator_type begin() TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		if (root_ == nullptr)return end();
+		return iterator_type{ first_, this };
+	}
+
+	iterator_type end()
+	{
+		return iterator_type{ &back_sentinel_, this };
+	}
+
+	riterator_type rbegin() TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		if (root_ == nullptr)return rend();
+		return riterator_type{ last_, this };
+	}
+
+	riterator_type rend()
+	{
+		return riterator_type{ &front_sentinel_, this };
+	}
+
+	const_iterator_type cbegin() const TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		if (root_ == nullptr)return cend();
+		return const_iterator_type{ first_, const_cast<avl_tree*>( this) };
+	}
+
+	const_iterator_type cend() const
+	{
+		return const_iterator_type{ const_cast<link_type*>( &back_sentinel_), const_cast<avl_tree*>( this) };
+	}
+
+	T* front_ptr() TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return first_ ? owner_of(first_) : nullptr;
+	}
+
+	T* back_ptr() TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return last_ ? owner_of(last_) : nullptr;
+	}
+
+	T& front()
+	{
+		return *front_ptr();
+	}
+
+	T& back()
+	{
+		return *back_ptr();
+	}
+
+protected:
+	// the fields of link_type are reached through these, as avl_tree_compact_link packs some of them
+
+	static inline T* owner_of(link_type* node)
+	{
+		if constexpr (link_type::compact)
+		{
+			return reinterpret_cast<T*>(reinterpret_cast<char*>(node) - link_offset());
+		}
+		else
+		{
+			return node->owner;
+		}
+	}
+
+	static inline link_type* parent_of(link_type* node)
+	{
+		if constexpr (link_type::compact)
+		{
+			return node->parent();
+		}
+		else
+		{
+			return node->parent;
+		}
+	}
+
+	static inline void set_parent(link_type* node, link_type* parent)
+	{
+		if constexpr (link_type::compact)
+		{
+			node->set_parent(parent);
+		}
+		else
+		{
+			avl_store_link(node->parent, parent);
+		}
+	}
+
+	static inline constexpr size_type height_of(link_type* node)
+	{
+		if (node == nullptr)
+			return 0;
+
+		if constexpr (link_type::compact)
+		{
+			return node->height();
+		}
+		else
+		{
+			return node->height;
+		}
+	}
+
+	static inline void set_height(link_type* node, size_type height)
+	{
+		if constexpr (link_type::compact)
+		{
+			node->set_height(height);
+		}
+		else
+		{
+			avl_store_link(node->height, height);
+		}
+	}
+
+	static inline bool is_sentinel(link_type* node)
+	{
+		if constexpr (link_type::compact)
+		{
+			return node->sentinel();
+		}
+		else
+		{
+			return node->sentinel;
+		}
+	}
+
+	// sentinels keep the root in place of the parent
+	static inline link_type* sentinel_root(link_type* sentinel)
+	{
+		if constexpr (link_type::compact)
+		{
+			return sentinel->parent();
+		}
+		else
+		{
+			return sentinel->root;
+		}
+	}
+
+	// offset of the link in T, for avl_tree_compact_link which doesn't keep the owner. T is standard-layout,
+	// for which the Itanium and MSVC ABIs represent a pointer to data member as the offsetof of the member
+	static inline size_type link_offset()
+	{
+		if constexpr (sizeof(Link) == sizeof(int32_t))
+		{
+			return static_cast<size_type>(std::bit_cast<int32_t>(Link));
+		}
+		else
+		{
+			return static_cast<size_type>(std::bit_cast<ptrdiff_t>(Link));
+		}
+	}
+
+	static inline constexpr TKey& key_of(link_type* node)
+	{
+		return owner_of(node)->*Key;
+	}
+
+	static inline constexpr size_type size_of(link_type* node) requires link_type::subtree_size_enabled
+	{
+		return node == nullptr ? 0 : node->size;
+	}
+
+	// run a lookup that only reads the tree, with the lock shared,
+	// or without taking it if the lock supports optimistic reads.
+	// a writer running at the same time may make an optimistic walk meet a cycle a rotation makes for a moment,
+	// so the walks give up after as many steps as the tree is high, and read_retry() then discards what they return
+	template<typename TFunc>
+	auto lookup(TFunc&& func) TA_EXCL(lock_)
+	{
+		if constexpr (optimistic_reads)
+		{
+			for (;;)
+			{
+				auto seq = lock_.read_begin();
+				auto result = func();
+				if (!lock_.read_retry(seq))
+					return result;
+			}
+		}
+		else
+		{
+			shared_lock_guard_type g{ lock_ };
+			return func();
+		}
+	}
+
+	size_type do_rank(const TKey& key) requires link_type::subtree_size_enabled TA_REQ_SHARED(lock_)
+	{
+		size_type result = 0;
+		for (auto node = root_; node;)
+		{
+			if (cmp_(key_of(node), key) < 0)
+			{
+				result += size_of(node->left) + 1;
+				node = node->right;
+			}
+			else
+			{
+				node = node->left;
+			}
+		}
+
+		return result;
+	}
+
+	static constexpr bool has_summaries = link_type::subtree_size_enabled || link_type::augmented;
+	static constexpr bool weak_balance = link_type::balance_type::weak;
+
+	// recompute what the link keeps about its subtree besides the height
+	static inline void update_summaries(link_type* node)
+	{
+		if constexpr (link_type::subtree_size_enabled)
+		{
+			node->size = size_of(node->left) + size_of(node->right) + 1;
+		}
+
+		if constexpr (link_type::augmented)
+		{
+			node->summary = link_type::augment_type::summarize(*owner_of(node),
+					node->left ? &node->left->summary : nullptr,
+					node->right ? &node->right->summary : nullptr);
+		}
+	}
+
+	static inline void update_height(link_type* node)
+	{
+		set_height(node, std::max(height_of(node->left), height_of(node->right)) + 1);
+		update_summaries(node);
+	}
+
+	static inline constexpr int64_t balance_factor(link_type* node)
+	{
+		return height_of(node->left) - height_of(node->right);
+	}
+
+	// the new root of the subtree takes over the parent of the old one,
+	// but the parent's child pointer is left to the caller
+	static inline link_type* left_rotate(link_type* root)
+	{
+		auto right = root->right;
+		auto parent = parent_of(root);
+
+		root->set_right(right->left);
+		right->set_left(root);
+		set_parent(right, parent);
+
+		update_height(root);
+		update_height(right);
+
+		return right;
+	}
+
+	static inline link_type* right_rotate(link_type* root)
+	{
+		auto left = root->left;
+		auto parent = parent_of(root);
+
+		root->set_left(left->right);
+		left->set_right(root);
+		set_parent(left, parent);
+
+		update_height(root);
+		update_height(left);
+
+		return left;
+	}
+
+	static inline link_type* min_node(link_type* root)
+	{
+		if (!root)return root;
+
+		while (root->left)
+			root = root->left;
+
+		return root;
+	}
+
+	static inline link_type* max_node(link_type* root)
+	{
+		if (!root)return root;
+
+		while (root->right)
+			root = root->right;
+
+		return root;
+	}
+
+	template<typename TExecutor>
+	avl_tree& do_unite(avl_tree& another, TExecutor& executor) TA_REQ(lock_, another.lock_)
+	{
+		if (another.root_ == nullptr)
+			return *this;
+
+		node_chain dropped{};
+
+		avl_store_link(root_, union_of(root_, another.root_, dropped, executor));
+		take_size_of(another);
+		size_ -= dropped.count;
+
+		dispose_chain(dropped.head);
+
+		update_bounds();
+		another.update_bounds();
+
+		return *this;
+	}
+
+	size_type do_size() const TA_REQ(lock_)
+	{
+		if (!size_known_)
+		{
+			size_ = count_nodes(root_);
+			size_known_ = true;
+		}
+
+		return size_;
+	}
+
+	// holds the lock of this tree and that of another, which is only read if AnotherShared,
+	// taking them in address order so that two threads working on the same pair of trees can't deadlock.
+	// the analysis takes both as held exclusively, as it can't follow the order.
+	template<bool AnotherShared>
+	class TA_SCOPED_CAP pair_lock_guard
+	{
+	public:
+		pair_lock_guard(const avl_tree& self, const avl_tree& another) TA_ACQ(self.lock_, another.lock_)
+		TA_NO_THREAD_SAFETY_ANALYSIS
+				: self_(self), another_(another)
+		{
+			if constexpr (EnableLock)
+			{
+				if (&self_ == &another_)
+				{
+					self_.lock_.lock();
+				}
+				else if (&self_ < &another_)
+				{
+					self_.lock_.lock();
+					lock_another();
+				}
+				else
+				{
+					lock_another();
+					self_.lock_.lock();
+				}
+			}
+		}
+
+		~pair_lock_guard() TA_REL() TA_NO_THREAD_SAFETY_ANALYSIS
+		{
+			if constexpr (EnableLock)
+			{
+				if (&self_ != &another_)
+				{
+					if constexpr (AnotherShared)
+						another_.lock_.unlock_shared();
+					else
+						another_.lock_.unlock();
+				}
+
+				self_.lock_.unlock();
+			}
+		}
+
+		pair_lock_guard(const pair_lock_guard&) = delete;
+
+		pair_lock_guard& operator=(const pair_lock_guard&) = delete;
+
+	private:
+		void lock_another() TA_NO_THREAD_SAFETY_ANALYSIS
+		{
+			if constexpr (AnotherShared)
+				another_.lock_.lock_shared();
+			else
+				another_.lock_.lock();
+		}
+
+		const avl_tree& self_;
+		const avl_tree& another_;
+	};
+
+	// after moving all nodes of another in
+	void take_size_of(avl_tree& another) TA_REQ(lock_, another.lock_)
+	{
+		size_ += another.size_;
+		size_known_ = size_known_ && another.size_known_;
+
+		avl_store_link(another.root_, nullptr);
+		another.size_ = 0;
+		another.size_known_ = true;
+	}
+
+	// after operations that restructure the tree wholesale
+	void update_bounds() TA_REQ(lock_)
+	{
+		avl_store_link(first_, min_node(root_));
+		avl_store_link(last_, max_node(root_));
+		update_sentinels();
+	}
+
+	void update_sentinels() TA_REQ(lock_)
+	{
+		if constexpr (link_type::compact)
+		{
+			back_sentinel_.set_parent(root_);
+			front_sentinel_.set_parent(root_);
+		}
+		else
+		{
+			avl_store_link(back_sentinel_.root, root_);
+			avl_store_link(front_sentinel_.root, root_);
+		}
+	}
+
+	link_type* next_of(link_type* node) TA_REQ_SHARED(lock_)
+	{
+		if (is_sentinel(node))return node;
+
+		if (node != root_ && parent_of(node) == nullptr && node->left == nullptr && node->right == nullptr)
+			return nullptr;
+
+		if constexpr (link_type::threading_enabled)
+		{
+			return node->threads.next ? node->threads.next : &back_sentinel_;
+		}
+
+		if (node->right)
+		{
+			return first_of(node->right);
+		}
+
+		link_type* parent = nullptr;
+		while ((parent = parent_of(node)) && node == parent->right)
+			node = parent;
+
+		if (!parent)return &back_sentinel_;
+
+		return parent;
+	}
+
+	link_type* prev_of(link_type* node) TA_REQ_SHARED(lock_)
+	{
+		if (is_sentinel(node))return last_;
+
+		if (node != root_ && parent_of(node) == nullptr && node->left == nullptr && node->right == nullptr)return nullptr;
+
+		if constexpr (link_type::threading_enabled)
+		{
+			return node->threads.prev ? node->threads.prev : &front_sentinel_;
+		}
+
+		if (node->left)
+		{
+			return last_of(node->left);
+		}
+
+		link_type* parent = nullptr;
+		while ((parent = parent_of(node)) && node == parent->left)
+			node = parent;
+
+		if (!parent)return &front_sentinel_; // the very first
+
+		return parent;
+	}
+
+	static inline link_type* first_of(link_type* root)
+	{
+		if (is_sentinel(root))return nullptr;
+
+		if (root->left == nullptr)
+			return root;
+
+		auto left = root->left;
+		while (left->left && !is_sentinel(left->left))
+			left = left->left;
+
+		return left;
+	}
+
+	static inline link_type* last_of(link_type* root)
+	{
+		if (is_sentinel(root))return nullptr;
+
+		if (root->right == nullptr)
+			return root;
+
+		auto right = root->right;
+		while (right->right && !is_sentinel(right->right))
+			right = right->right;
+
+		return right;
+	}
+
+	iterator_type iterator_of(link_type* node)
+	{
+		return node ? iterator_type{ node, this } : end();
+	}
+
+	// the walks below run in lookup(), with the lock shared or optimistically without it,
+	// so they aren't checked against the lock.
+	// optimistic walks load the links with acquire: they may meet an element a writer is linking, and what was
+	// written to it before the writer took the lock must be visible. the others read them plainly, as the lock
+	// keeps writers away, which also lets the compiler load both children and pick one without a branch
+
+	static inline link_type* read_link(link_type* const& link)
+	{
+		if constexpr (optimistic_reads)
+		{
+			return avl_load_link(link, std::memory_order_acquire);
+		}
+		else
+		{
+			return link;
+		}
+	}
+
+	static inline link_type* read_left(link_type* node)
+	{
+		if constexpr (optimistic_reads)
+		{
+			return avl_load_link(node->left, std::memory_order_acquire);
+		}
+		else
+		{
+			return node->left;
+		}
+	}
+
+	static inline link_type* read_right(link_type* node)
+	{
+		if constexpr (optimistic_reads)
+		{
+			return avl_load_link(node->right, std::memory_order_acquire);
+		}
+		else
+		{
+			return node->right;
+		}
+	}
+
+	static inline link_type* read_parent(link_type* node)
+	{
+		if constexpr (!optimistic_reads)
+		{
+			return parent_of(node);
+		}
+		else if constexpr (link_type::compact)
+		{
+			return node->parent(std::memory_order_acquire);
+		}
+		else
+		{
+			return avl_load_link(node->parent, std::memory_order_acquire);
+		}
+	}
+
+	static inline size_type read_height(link_type* node)
+	{
+		if constexpr (!optimistic_reads)
+		{
+			return height_of(node);
+		}
+		else if constexpr (link_type::compact)
+		{
+			return node ? node->height(std::memory_order_relaxed) : 0;
+		}
+		else
+		{
+			return node ? avl_load_link(node->height, std::memory_order_relaxed) : 0;
+		}
+	}
+
+	// whether an optimistic walk has taken as many steps as it was given, see lookup().
+	// the others don't count them, which would keep the compiler from picking the child without a branch
+	static inline bool out_of_steps(size_type& steps)
+	{
+		if constexpr (optimistic_reads)
+		{
+			return steps-- == 0;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	template<typename TKeyLike>
+	link_type* find_node(const TKeyLike& key) TA_NO_THREAD_SAFETY_ANALYSIS
+	{
+		link_type* node = read_link(root_);
+		for (auto steps = read_height(node); node && !out_of_steps(steps);)
+		{
+			auto cmp_val = cmp_(key, key_of(node));
+			if (cmp_val < 0)
+				node = read_left(node);
+			else if (cmp_val > 0)
+				node = read_right(node);
+			else
+				return node;
+		}
+
+		return nullptr;
+	}
+
+	// the first node whose key is not less than key, nullptr if there is no such node
+	template<typename TKeyLike>
+	link_type* lower_bound_node(const TKeyLike& key) TA_NO_THREAD_SAFETY_ANALYSIS
 	{
-		if (n1->sentinel)return 1 <=> -1;
-		else if (n2->sentinel)return -1 <=> 1;
-		else return cmp_(key_of(n1), key_of(n2));
+		return lower_bound_node(read_link(root_), key);
 	}
 
-	link_type* insert(link_type* newnode, link_type* root)
+	// lower_bound in the tree (or detached subtree) rooted at root
+	template<typename TKeyLike>
+	link_type* lower_bound_node(link_type* root, const TKeyLike& key)
 	{
-		if (root == nullptr)
+		link_type* result = nullptr;
+		for (auto steps = read_height(root); root && !out_of_steps(steps);)
 		{
-			++size_;
-			return newnode;
+			if (cmp_(key_of(root), key) < 0)
+			{
+				root = read_right(root);
+			}
+			else
+			{
+				result = root;
+				root = read_left(root);
+			}
 		}
 
-		auto cmp_val = compare(newnode, root);
-		if (cmp_val < 0)
+		return result;
+	}
+
+	// lower_bound_node() that climbs from finger only as high as the result may be away, then descends.
+	// past half the height of the tree, starting over from the root is cheaper, as the top levels are likely cached
+	template<typename TKeyLike>
+	link_type* lower_bound_node_from(link_type* finger, const TKeyLike& key) TA_NO_THREAD_SAFETY_ANALYSIS
+	{
+		if (finger == &front_sentinel_)
+			finger = read_link(first_);
+		else if (finger == &back_sentinel_)
+			finger = read_link(last_);
+
+		if (finger == nullptr)
+			return lower_bound_node(key);
+
+		// heights grow on the way up, so climb_limit also bounds the steps of the climb
+		auto climb_limit = read_height(read_link(root_)) / 2;
+		size_type steps = 0;
+
+		auto node = finger;
+		if (cmp_(key_of(node), key) < 0)
+		{
+			// the result is on the right. a left child whose parent isn't less than key
+			// has the result in its subtree, or it is that parent
+			for (auto parent = read_parent(node); parent; node = parent, parent = read_parent(node))
+			{
+				if (read_height(parent) > climb_limit || ++steps > climb_limit)
+					break;
+
+				if (read_left(parent) == node && cmp_(key_of(parent), key) >= 0)
+				{
+					auto result = lower_bound_node(node, key);
+					return result ? result : parent;
+				}
+			}
+		}
+		else
 		{
-//			auto new_left = insert(newnode, root->left);
-//			root->left = new_left;
-//			new_left->parent_ = root;
-			root->set_left(insert(newnode, root->left));
+			// the result is finger or on its left. a right child whose parent is less than key has it in its subtree
+			for (auto parent = read_parent(node); parent; node = parent, parent = read_parent(node))
+			{
+				if (read_height(parent) > climb_limit || ++steps > climb_limit)
+					break;
+
+				if (read_right(parent) == node && cmp_(key_of(parent), key) < 0)
+					return lower_bound_node(node, key);
+			}
 		}
-		else if (cmp_val > 0)
+
+		return lower_bound_node(key);
+	}
+
+	// the first node whose key is greater than key, nullptr if there is no such node
+	template<typename TKeyLike>
+	link_type* upper_bound_node(const TKeyLike& key) TA_NO_THREAD_SAFETY_ANALYSIS
+	{
+		link_type* node = read_link(root_), * result = nullptr;
+		for (auto steps = read_height(node); node && !out_of_steps(steps);)
 		{
-//			auto new_right = insert(newnode, root->right);
-//			root->right = new_right;
-//			new_right->parent_ = root;
-			root->set_right(insert(newnode, root->right));
+			if (cmp_(key_of(node), key) <= 0)
+			{
+				node = read_right(node);
+			}
+			else
+			{
+				result = node;
+				node = read_left(node);
+			}
 		}
+
+		return result;
+	}
+
+	// hook subtree in the place of old, which was a child of parent (or the root)
+	static inline void replace_child(link_type* parent, link_type* old, link_type* subtree, link_type*& root)
+	{
+		if (parent == nullptr)
+			root = subtree;
+		else if (parent->left == old)
+			avl_store_link(parent->left, subtree);
 		else
+			avl_store_link(parent->right, subtree);
+
+		if (subtree)
+			set_parent(subtree, parent);
+	}
+
+	static inline void reset_link(link_type* node)
+	{
+		avl_store_link(node->left, nullptr);
+		avl_store_link(node->right, nullptr);
+		set_parent(node, nullptr);
+		set_height(node, 1);
+
+		update_summaries(node);
+	}
+
+	// restore the balance of node's subtree, return the new root of the subtree
+	static inline link_type* rebalance(link_type* node)
+	{
+		update_height(node);
+
+		auto bf = balance_factor(node);
+		if (bf > 1)
 		{
-			return root;
+			// Left Right Case
+			if (balance_factor(node->left) < 0)
+				avl_store_link(node->left, left_rotate(node->left));
+
+			// Left Left Case
+			return right_rotate(node);
 		}
+		else if (bf < -1)
+		{
+			// Right Left Case
+			if (balance_factor(node->right) > 0)
+				avl_store_link(node->right, right_rotate(node->right));
 
-		update_height(root);
+			// Right Right Case
+			return left_rotate(node);
+		}
+
+		return node;
+	}
+
+	// walk up from node, which still holds its height before the modification,
+	// and stop rebalancing as soon as a subtree keeps its height. summaries are updated up to the root.
+	// return the new root if the walk reached it, nullptr if the root is unchanged
+	static inline link_type* retrace(link_type* node)
+	{
+		while (node)
+		{
+			auto parent = parent_of(node);
+			auto old_height = height_of(node);
+
+			auto subtree = rebalance(node);
+			if (parent == nullptr)
+				return subtree;
+
+			if (subtree != node)
+			{
+				if (parent->left == node)
+					avl_store_link(parent->left, subtree);
+				else
+					avl_store_link(parent->right, subtree);
+			}
+
+			if (height_of(subtree) == old_height)
+			{
+				if constexpr (has_summaries)
+				{
+					for (; parent; parent = parent_of(parent))
+						update_summaries(parent);
+				}
+
+				break;
+			}
+
+			node = parent;
+		}
+
+		return nullptr;
+	}
+
+	// WAVL rebalancing after a removal below node, which may have been left a leaf of rank 1
+	// or with a child three ranks lower. ranks are kept as heights, one more than usual.
+	// return the new root if the walk reached it, nullptr if the root is unchanged
+	static inline link_type* weak_retrace(link_type* node)
+	{
+		while (node)
+		{
+			auto parent = parent_of(node);
+			auto subtree = node;
+			auto done = false;
+
+			auto h = height_of(node), hl = height_of(node->left), hr = height_of(node->right);
+			if (hl == 0 && hr == 0 && h == 2)
+			{
+				// a leaf must have the lowest rank
+				set_height(node, 1);
+				update_summaries(node);
+			}
+			else if (h == hl + 3 || h == hr + 3)
+			{
+				auto left_short = h == hl + 3;
+				auto sibling = left_short ? node->right : node->left;
+				auto hs = height_of(sibling);
+				auto outer = left_short ? sibling->right : sibling->left;
+				auto inner = left_short ? sibling->left : sibling->right;
+
+				if (h == hs + 2)
+				{
+					set_height(node, h - 1);
+					update_summaries(node);
+				}
+				else if (hs == height_of(outer) + 2 && hs == height_of(inner) + 2)
+				{
+					set_height(sibling, hs - 1);
+					set_height(node, h - 1);
+					update_summaries(node);
+				}
+				else if (hs == height_of(outer) + 1)
+				{
+					// the rotations compute heights as AVL trees do, they are then corrected
+					subtree = left_short ? left_rotate(node) : right_rotate(node);
+
+					set_height(sibling, hs + 1);
+					set_height(node, node->left || node->right ? h - 1 : 1);
+					done = true;
+				}
+				else
+				{
+					auto hi = height_of(inner);
+					if (left_short)
+						avl_store_link(node->right, right_rotate(sibling));
+					else
+						avl_store_link(node->left, left_rotate(sibling));
+
+					subtree = left_short ? left_rotate(node) : right_rotate(node);
+
+					set_height(inner, hi + 2);
+					set_height(sibling, hs - 1);
+					set_height(node, h - 2);
+					done = true;
+				}
+			}
+			else
+			{
+				update_summaries(node);
+				done = true;
+			}
+
+			if (parent == nullptr)
+				return subtree;
+
+			if (subtree != node)
+			{
+				if (parent->left == node)
+					avl_store_link(parent->left, subtree);
+				else
+					avl_store_link(parent->right, subtree);
+			}
+
+			if (done)
+			{
+				if constexpr (has_summaries)
+				{
+					for (; parent; parent = parent_of(parent))
+						update_summaries(parent);
+				}
+
+				break;
+			}
+
+			node = parent;
+		}
+
+		return nullptr;
+	}
+
+	// unlink a node of this tree and dispose it
+	void erase_node(link_type* node) TA_REQ(lock_)
+	{
+		remove_node(node);
+		update_sentinels();
+
+		if constexpr (CallDeleteOnRemoval)
+		{
+			deleter_(owner_of(node));
+		}
+	}
+
+	template<typename TKeyLike>
+	bool remove_key(const TKeyLike& key) TA_REQ(lock_)
+	{
+		auto node = find_node(key);
+		if (node == nullptr)
+			return false;
+
+		erase_node(node);
+		return true;
+	}
+
+	// return newnode if it is inserted, otherwise the node with the same key
+	link_type* insert_node(link_type* newnode) TA_REQ(lock_)
+	{
+		link_type* parent = nullptr, ** pos = &root_;
+		while (*pos)
+		{
+			parent = *pos;
+
+			auto cmp_val = cmp_(key_of(newnode), key_of(parent));
+			if (cmp_val < 0)
+				pos = &parent->left;
+			else if (cmp_val > 0)
+				pos = &parent->right;
+			else
+				return parent;
+		}
+
+		attach_node(newnode, parent, pos);
+		return newnode;
+	}
+
+	iterator_type insert_without_hint(link_type* newnode) TA_REQ(lock_)
+	{
+		auto node = insert_node(newnode);
+		update_sentinels();
+
+		return iterator_of(node);
+	}
+
+	// hook newnode at pos, an empty child of parent (or the root), and rebalance
+	void attach_node(link_type* newnode, link_type* parent, link_type** pos) TA_REQ(lock_)
+	{
+		reset_link(newnode);
+		set_parent(newnode, parent);
+		avl_store_link(*pos, newnode);
+
+		if constexpr (link_type::threading_enabled)
+		{
+			newnode->threads = {};
+			if (parent && pos == &parent->left)
+			{
+				link_threads(parent->threads.prev, newnode);
+				link_threads(newnode, parent);
+			}
+			else if (parent)
+			{
+				link_threads(newnode, parent->threads.next);
+				link_threads(parent, newnode);
+			}
+		}
+
+		++size_;
+
+		if (parent == first_ && (parent == nullptr || pos == &parent->left))
+			avl_store_link(first_, newnode);
 
-		auto bf = balance_factor(root);
-		if (bf > 1 && compare(newnode, root->left) > 0)
+		if (parent == last_ && (parent == nullptr || pos == &parent->right))
+			avl_store_link(last_, newnode);
+
+		if (auto root = retrace(parent))
+			avl_store_link(root_, root);
+	}
+
+	// unlink node from the tree (or detached subtree) rooted at root, return the new root
+	static inline link_type* unlink_node(link_type* node, link_type* root)
+	{
+		link_type* retrace_from = nullptr;
+		if (node->left && node->right)
 		{
-//			root->left = left_rotate(root->left);
-			root->set_left(left_rotate(root->left));
-			return right_rotate(root);
+			// replace node with its successor, which has no left child
+			auto successor = min_node(node->right);
+			if (parent_of(successor) != node)
+			{
+				retrace_from = parent_of(successor);
+
+				avl_store_link(retrace_from->left, successor->right);
+				if (successor->right)
+					set_parent(successor->right, retrace_from);
+
+				avl_store_link(successor->right, node->right);
+				set_parent(node->right, successor);
+			}
+			else
+			{
+				retrace_from = successor;
+			}
+
+			avl_store_link(successor->left, node->left);
+			set_parent(node->left, successor);
+
+			set_height(successor, height_of(node));
+			replace_child(parent_of(node), node, successor, root);
 		}
-		else if (bf > 1 && compare(newnode, root->left) < 0)
+		else
 		{
-			return right_rotate(root);
+			retrace_from = parent_of(node);
+			replace_child(parent_of(node), node, node->left ? node->left : node->right, root);
 		}
-		else if (bf < -1 && compare(newnode, root->right) > 0)
+
+		reset_link(node);
+
+		if constexpr (weak_balance)
 		{
-			return left_rotate(root);
+			if (auto new_root = weak_retrace(retrace_from))
+				root = new_root;
 		}
-		else if (bf < -1 && compare(newnode, root->right) < 0)
+		else
 		{
-//			root->right = right_rotate(root->right);
-			root->set_right(right_rotate(root->right));
-			return left_rotate(root);
+			if (auto new_root = retrace(retrace_from))
+				root = new_root;
 		}
 
 		return root;
 	}
 
-	link_type* do_remove(link_type* node, link_type* root)
+	void remove_node(link_type* node) TA_REQ(lock_)
 	{
-		if (root->left == nullptr && root->right == nullptr)
+		if (node == first_)
+			avl_store_link(first_, node->right ? min_node(node->right) : parent_of(node));
+
+		if (node == last_)
+			avl_store_link(last_, node->left ? max_node(node->left) : parent_of(node));
+
+		avl_store_link(root_, unlink_node(node, root_));
+		--size_;
+
+		if constexpr (link_type::threading_enabled)
 		{
-			root->parent = nullptr;
-			root = nullptr;
-			--size_;
+			link_threads(node->threads.prev, node->threads.next);
+			node->threads = {};
 		}
-		else if (root->left == nullptr || root->right == nullptr)
+	}
+
+	// make second follow first in the in-order threads
+	static inline void link_threads(link_type* first, link_type* second)
+	{
+		if constexpr (link_type::threading_enabled)
 		{
-			auto newroot = root->left ? root->left : root->right;
-			newroot->parent = root->parent;
-			root->parent = nullptr;
-			root = newroot;
-			--size_;
+			if (first)first->threads.next = second;
+			if (second)second->threads.prev = first;
 		}
-		else
+	}
+
+	static inline void cut_thread_before(link_type* node)
+	{
+		if constexpr (link_type::threading_enabled)
+		{
+			if (node->threads.prev)node->threads.prev->threads.next = nullptr;
+			node->threads.prev = nullptr;
+		}
+	}
+
+	static inline void cut_thread_after(link_type* node)
+	{
+		if constexpr (link_type::threading_enabled)
+		{
+			if (node->threads.next)node->threads.next->threads.prev = nullptr;
+			node->threads.next = nullptr;
+		}
+	}
+
+	// join3() that also threads node between left and right,
+	// which costs O(height(left) + height(right)) with threading enabled
+	static inline link_type* threaded_join3(link_type* left, link_type* node, link_type* right)
+	{
+		if constexpr (link_type::threading_enabled)
+		{
+			link_threads(max_node(left), node);
+			link_threads(node, min_node(right));
+		}
+
+		return join3(left, node, right);
+	}
+
+	// link left, node and right, where keys of left < key of node < keys of right,
+	// into one tree in O(|height(left) - height(right)|). all of them must be detached.
+	// the threads are left to the caller.
+	static inline link_type* join3(link_type* left, link_type* node, link_type* right)
+	{
+		auto hl = height_of(left), hr = height_of(right);
+		if (hl > hr + 1)
 		{
-			auto newroot = min_node(root->right);
+			// hang node in the right spine of left, where the heights fit
+			auto spine = left;
+			while (height_of(spine->right) > hr + 1)
+				spine = spine->right;
 
-			// it must be a leaf, so this will not cause infinite recursion
-//			root->right = remove(root->right, newroot);
-			root->set_right(remove(root->right, newroot));
+			node->set_left(spine->right);
+			node->set_right(right);
+			update_height(node);
 
-//			newroot->left = root->left;
-//			newroot->right = root->right;
-//			newroot->parent_ = root->parent_;
+			spine->set_right(node);
+
+			auto root = retrace(spine);
+			return root ? root : left;
+		}
+		else if (hr > hl + 1)
+		{
+			auto spine = right;
+			while (height_of(spine->left) > hl + 1)
+				spine = spine->left;
 
-			newroot->set_left(root->left);
-			newroot->set_right(root->right);
+			node->set_right(spine->left);
+			node->set_left(left);
+			update_height(node);
 
-			newroot->parent = root->parent;
-			root->parent = nullptr;
+			spine->set_left(node);
 
-			root = newroot;
+			auto root = retrace(spine);
+			return root ? root : right;
 		}
 
-		return root;
+		node->set_left(left);
+		node->set_right(right);
+		set_parent(node, nullptr);
+		update_height(node);
+
+		return node;
+	}
+
+	// link left and right, where keys of left < keys of right, into one tree
+	static inline link_type* join2(link_type* left, link_type* right)
+	{
+		if (left == nullptr)return right;
+		if (right == nullptr)return left;
+
+		auto middle = min_node(right);
+		right = unlink_node(middle, right);
+
+		// middle stays threaded to the rest of right
+		link_threads(max_node(left), middle);
+
+		return join3(left, middle, right);
 	}
 
-	link_type* remove(link_type* node, link_type* root)
+	// split the tree containing node into the nodes before node and the nodes after it.
+	// node itself goes to the latter if keep is true, otherwise it is left detached.
+	static inline std::pair<link_type*, link_type*> split_at(link_type* node, bool keep)
 	{
-		if (root == nullptr)
+		auto left = node->left, right = node->right;
+		auto parent = parent_of(node), child = node;
+
+		if (left)set_parent(left, nullptr);
+		if (right)set_parent(right, nullptr);
+		reset_link(node);
+
+		// both sides keep their order, so the threads are only cut around node
+		cut_thread_before(node);
+		if (!keep)
+			cut_thread_after(node);
+
+		if (keep)
+			right = join3(nullptr, node, right);
+
+		// climb up and join each ancestor with its other subtree to the side it belongs to
+		while (parent)
 		{
-			return root; // do not exist
+			auto grandparent = parent_of(parent);
+			auto from_left = parent->left == child;
+			auto other = from_left ? parent->right : parent->left;
+
+			if (other)set_parent(other, nullptr);
+			reset_link(parent);
+
+			if (from_left)
+				right = join3(right, parent, other);
+			else
+				left = join3(other, parent, left);
+
+			child = parent;
+			parent = grandparent;
 		}
 
+		return { left, right };
+	}
+
+	// split the detached subtree rooted at root by key.
+	// return the nodes less than key, the node equal to key (detached) and the nodes greater than key
+	std::tuple<link_type*, link_type*, link_type*> split_by_key(link_type* root, const TKey& key)
+	{
+		auto node = lower_bound_node(root, key);
+		if (node == nullptr)
+			return { root, nullptr, nullptr };
+
+		auto equal = cmp_(key_of(node), key) == 0;
+		auto[left, right] = split_at(node, !equal);
 
-		if (auto cmp_val = compare(node, root);cmp_val < 0)
+		return { left, equal ? node : nullptr, right };
+	}
+
+	// nodes taken out by the set operations, linked by their right link
+	struct node_chain
+	{
+		link_type* head{ nullptr }, * tail{ nullptr };
+		size_type count{ 0 };
+
+		void push(link_type* node)
+		{
+			reset_link(node);
+
+			if (tail)
+				avl_store_link(tail->right, node);
+			else
+				head = node;
+
+			tail = node;
+			++count;
+		}
+
+		void append(node_chain& another)
 		{
-//			root->left = remove(node, root->left);
-			root->set_left(remove(node, root->left));
+			if (another.head == nullptr)
+				return;
+
+			if (tail)
+				avl_store_link(tail->right, another.head);
+			else
+				head = another.head;
+
+			tail = another.tail;
+			count += another.count;
 		}
-		else if (cmp_val > 0)
+	};
+
+	// subtrees lower than this are not worth a fork
+	static constexpr size_type PARALLEL_CUTOFF_HEIGHT = 10;
+
+	template<typename TExecutor, typename F1, typename F2>
+	static inline void fork_join(TExecutor& executor, size_type height, F1&& f1, F2&& f2)
+	{
+		if (height < PARALLEL_CUTOFF_HEIGHT)
 		{
-//			root->right = remove(node, root->right);
-			root->set_right(remove(node, root->right));
+			f1();
+			f2();
 		}
 		else
 		{
-			root = do_remove(node, root);
+			executor.fork_join(f1, f2);
+		}
+	}
+
+	// cut the children off a detached node
+	static inline std::pair<link_type*, link_type*> detach_children(link_type* node)
+	{
+		auto left = node->left, right = node->right;
+		if (left)set_parent(left, nullptr);
+		if (right)set_parent(right, nullptr);
+
+		reset_link(node);
+		cut_thread_before(node);
+		cut_thread_after(node);
+
+		return { left, right };
+	}
+
+	// take apart the detached subtree rooted at node in post order without rotation.
+	// func gets each node after its link is reset.
+	template<typename TFunc>
+	static inline void teardown(link_type* node, TFunc&& func)
+	{
+		while (node)
+		{
+			if (node->left)
+			{
+				node = node->left;
+			}
+			else if (node->right)
+			{
+				node = node->right;
+			}
+			else
+			{
+				auto parent = parent_of(node);
+				if (parent)
+				{
+					if (parent->left == node)
+						avl_store_link(parent->left, nullptr);
+					else
+						avl_store_link(parent->right, nullptr);
+				}
+
+				reset_link(node);
+				if constexpr (link_type::threading_enabled)
+				{
+					node->threads = {};
+				}
+
+				func(node);
+
+				node = parent;
+			}
 		}
+	}
 
-		if (root == nullptr)
+	static inline void chain_all(link_type* node, node_chain& chain)
+	{
+		teardown(node, [&chain](link_type* leaf)
 		{
-			return root;
+			chain.push(leaf);
+		});
+	}
+
+	// union of detached subtrees a and b. nodes of b whose key is in a are dropped.
+	template<typename TExecutor>
+	link_type* union_of(link_type* a, link_type* b, node_chain& dropped, TExecutor& executor)
+	{
+		if (a == nullptr)return b;
+		if (b == nullptr)return a;
+
+		auto height = height_of(a);
+
+		link_type* al = nullptr, * ar = nullptr;
+		std::tie(al, ar) = detach_children(a);
+
+		link_type* bl = nullptr, * duplicate = nullptr, * br = nullptr;
+		std::tie(bl, duplicate, br) = split_by_key(b, key_of(a));
+		if (duplicate)
+			dropped.push(duplicate);
+
+		link_type* left = nullptr, * right = nullptr;
+		node_chain right_dropped{};
+
+		fork_join(executor, height,
+				[&]
+				{
+					left = union_of(al, bl, dropped, executor);
+				},
+				[&]
+				{
+					right = union_of(ar, br, right_dropped, executor);
+				});
+
+		dropped.append(right_dropped);
+
+		return threaded_join3(left, a, right);
+	}
+
+	// nodes of the detached subtree a whose key is in b. others are dropped. b is not modified.
+	template<typename TExecutor>
+	link_type* intersection_of(link_type* a, link_type* b, node_chain& dropped, TExecutor& executor)
+	{
+		if (a == nullptr)
+			return nullptr;
+
+		if (b == nullptr)
+		{
+			chain_all(a, dropped);
+			return nullptr;
 		}
 
-		update_height(root);
+		link_type* al = nullptr, * equal = nullptr, * ar = nullptr;
+		std::tie(al, equal, ar) = split_by_key(a, key_of(b));
+
+		link_type* left = nullptr, * right = nullptr;
+		node_chain right_dropped{};
+
+		fork_join(executor, height_of(b),
+				[&]
+				{
+					left = intersection_of(al, b->left, dropped, executor);
+				},
+				[&]
+				{
+					right = intersection_of(ar, b->right, right_dropped, executor);
+				});
 
-		auto bf = balance_factor(root);
+		dropped.append(right_dropped);
 
-		// Left Left Case
-		if (bf > 1 && balance_factor(root->left) >= 0)
+		return equal ? threaded_join3(left, equal, right) : join2(left, right);
+	}
+
+	// nodes of the detached subtree a whose key is not in b. others are dropped. b is not modified.
+	template<typename TExecutor>
+	link_type* difference_of(link_type* a, link_type* b, node_chain& dropped, TExecutor& executor)
+	{
+		if (a == nullptr)return nullptr;
+		if (b == nullptr)return a;
+
+		link_type* al = nullptr, * equal = nullptr, * ar = nullptr;
+		std::tie(al, equal, ar) = split_by_key(a, key_of(b));
+		if (equal)
+			dropped.push(equal);
+
+		link_type* left = nullptr, * right = nullptr;
+		node_chain right_dropped{};
+
+		fork_join(executor, height_of(b),
+				[&]
+				{
+					left = difference_of(al, b->left, dropped, executor);
+				},
+				[&]
+				{
+					right = difference_of(ar, b->right, right_dropped, executor);
+				});
+
+		dropped.append(right_dropped);
+
+		return join2(left, right);
+	}
+
+	// dispose nodes taken out by the set operations as if they were removed
+	void dispose_chain(link_type* chain)
+	{
+		while (chain)
 		{
-			return right_rotate(root);
+			auto next = chain->right;
+			reset_link(chain);
+
+			if constexpr (CallDeleteOnRemoval)
+			{
+				deleter_(owner_of(chain));
+			}
+
+			chain = next;
 		}
+	}
+
+	// cut the nodes from first up to but excluding last (nullptr for all the rest) out of the tree
+	// and return them as a detached subtree
+	link_type* detach_range(link_type* first, link_type* last) TA_REQ(lock_)
+	{
+		if (first == nullptr || first == last)
+			return nullptr;
 
-		// Left Right Case
-		if (bf > 1 && balance_factor(root->left) < 0)
+		auto[left, range] = split_at(first, true);
+
+		link_type* right = nullptr;
+		if (last)
+			std::tie(range, right) = split_at(last, true);
+
+		avl_store_link(root_, join2(left, right));
+
+		if (size_known_)
 		{
-//			root->left = left_rotate(root->left);
-			root->set_left(left_rotate(root->left));
-			return right_rotate(root);
+			if constexpr (link_type::subtree_size_enabled)
+				size_ -= size_of(range);
+			else
+				size_ -= count_nodes(range);
 		}
 
-		// Right Right Case
-		if (bf < -1 && balance_factor(root->right) <= 0)
+		update_bounds();
+
+		return range;
+	}
+
+	// dispose a subtree taken out by detach_range() in key order
+	template<typename TDisposer>
+	static inline size_type dispose_range(link_type* range, TDisposer& disposer)
+	{
+		size_type count = 0;
+
+		// keep taking out the leftmost node, which its right subtree replaces, without rebalancing
+		for (auto node = min_node(range); node; ++count)
 		{
-			return left_rotate(root);
+			auto parent = parent_of(node), right = node->right;
+			if (right)set_parent(right, parent);
+			if (parent)avl_store_link(parent->left, right);
+
+			auto next = right ? min_node(right) : parent;
+
+			reset_link(node);
+			if constexpr (link_type::threading_enabled)
+			{
+				node->threads = {};
+			}
+
+			disposer(owner_of(node));
+			node = next;
 		}
 
-		// Right Left Case
-		if (bf < -1 && balance_factor(root->right) > 0)
+		return count;
+	}
+
+	// move the nodes from node on to another
+	avl_tree& split_to(link_type* node, avl_tree& another) TA_REQ(lock_, another.lock_)
+	{
+		if (node == nullptr)
+			return *this;
+
+		auto[left, right] = split_at(node, true);
+
+		avl_store_link(root_, left);
+		size_known_ = false;
+
+		if (another.root_ == nullptr)
 		{
-//			root->right = right_rotate(root->right);
-			root->set_right(right_rotate(root->right));
-			return left_rotate(root);
+			avl_store_link(another.root_, right);
 		}
+		else
+		{
+			sequential_executor executor{};
+			node_chain dropped{};
 
-		return root;
+			avl_store_link(another.root_, another.union_of(another.root_, right, dropped, executor));
+			another.dispose_chain(dropped.head);
+		}
+		another.size_known_ = false;
+
+		update_bounds();
+		another.update_bounds();
+
+		return *this;
 	}
 
+	static inline link_type* link_of(T& val)
+	{
+		return &(val.*Link);
+	}
 
-private:
-	size_type size_{ 0 };
-	link_type* root_{ nullptr };
+	static inline link_type* link_of(T* val)
+	{
+		return &(val->*Link);
+	}
+
+	// link the next count elements from iter into a perfectly balanced subtree.
+	// prev is the element linked last, which the first one is threaded after.
+	template<typename TIter>
+	static inline link_type* build_balanced(TIter& iter, size_type count, link_type*& prev)
+	{
+		if (count == 0)
+			return nullptr;
+
+		auto left = build_balanced(iter, (count - 1) / 2, prev);
+
+		auto node = link_of(*iter);
+		++iter;
+
+		if constexpr (link_type::threading_enabled)
+		{
+			node->threads = {};
+			link_threads(prev, node);
+		}
+		prev = node;
+
+		auto right = build_balanced(iter, count - 1 - (count - 1) / 2, prev);
+
+		avl_store_link(node->left, left);
+		avl_store_link(node->right, right);
+		set_parent(node, nullptr);
+
+		if (left)set_parent(left, node);
+		if (right)set_parent(right, node);
+
+		update_height(node);
+		return node;
+	}
+
+	static inline size_type count_nodes(link_type* root)
+	{
+		size_type count = 0;
+		for (auto node = min_node(root); node; ++count)
+		{
+			// in-order successor within the subtree
+			if (node->right)
+			{
+				node = min_node(node->right);
+			}
+			else
+			{
+				auto parent = parent_of(node);
+				while (parent && node == parent->right)
+				{
+					node = parent;
+					parent = parent_of(node);
+				}
+				node = parent;
+			}
+		}
+
+		return count;
+	}
+
+protected:
+	[[no_unique_address]] mutable mutex_type lock_{};
+
+	mutable size_type size_ TA_GUARDED(lock_){ 0 };
+	mutable bool size_known_ TA_GUARDED(lock_){ true };
+
+	link_type* root_ TA_GUARDED(lock_){ nullptr };
 	TCmp cmp_{};
 	TDeleter deleter_{};
 
-	link_type back_sentinel_{ true };
-	link_type front_sentinel_{ true };
+	// the leftmost and the rightmost nodes, for the ends and hinted insertion there
+	link_type* first_ TA_GUARDED(lock_){ nullptr };
+	link_type* last_ TA_GUARDED(lock_){ nullptr };
+
+	link_type back_sentinel_ TA_GUARDED(lock_){ true };
+	link_type front_sentinel_ TA_GUARDED(lock_){ true };
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,1065 @@
+#pragma once
+
+#include "utility.h"
+#include "lock_guard.h"
+#include "shared_mutex.h"
+
+#include <algorithm>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+namespace kbl
+{
+
+template<typename T>
+concept BTreeKey=
+requires(T a, T b)
+{
+	a <=> b;
+};
+
+template<BTreeKey T>
+struct btree_default_comparer
+{
+	auto operator()(const T& a, const T& b) const
+	{
+		return a <=> b;
+	}
+};
+
+/// Default number of keys in a node of btree: the keys fill two cache lines.
+template<typename TKey>
+inline constexpr size_t btree_default_width = std::max<size_t>(8, 128 / sizeof(TKey));
+
+template<typename T, typename TContainer, bool EnableLock>
+class btree_iterator
+{
+public:
+	using value_type = T;
+	using size_type = size_t;
+	using container_type = TContainer;
+	using leaf_type = typename container_type::leaf_type;
+
+	using dummy_type = int;
+
+	friend TContainer;
+
+	// index of rend(), which is before the first element
+	static constexpr size_type BEFORE_FIRST = static_cast<size_type>(-1);
+
+public:
+	btree_iterator() = default;
+
+	explicit btree_iterator(leaf_type* leaf, size_type index, container_type* cont) :
+			leaf_(leaf),
+			index_(index),
+			cont_(cont)
+	{
+	}
+
+	T& operator*()
+	{
+		return *operator->();
+	}
+
+	T* operator->()
+	{
+		return leaf_->values[index_];
+	}
+
+	bool operator==(btree_iterator const& other) const
+	{
+		return leaf_ == other.leaf_ && index_ == other.index_;
+	}
+
+	bool operator!=(btree_iterator const& other) const
+	{
+		return !(*this == other);
+	}
+
+	// iterating needs the tree kept from modification by the caller, see btree
+	btree_iterator& operator++() TA_NO_THREAD_SAFETY_ANALYSIS
+	{
+		if (leaf_ == nullptr)
+		{
+			// past rend() comes the first element, past end() stays there
+			if (index_ == BEFORE_FIRST)
+				*this = cont_->first_position();
+		}
+		else if (++index_ == leaf_->count)
+		{
+			leaf_ = leaf_->next;
+			index_ = 0;
+		}
+
+		return *this;
+	}
+
+	btree_iterator operator++(dummy_type) noexcept
+	{
+		btree_iterator rc(*this);
+		operator++();
+		return rc;
+	}
+
+	btree_iterator& operator--() TA_NO_THREAD_SAFETY_ANALYSIS
+	{
+		if (leaf_ == nullptr)
+		{
+			if (index_ != BEFORE_FIRST)
+				*this = cont_->last_position();
+		}
+		else if (index_ == 0)
+		{
+			leaf_ = leaf_->prev;
+			index_ = leaf_ ? leaf_->count - 1 : BEFORE_FIRST;
+		}
+		else
+		{
+			--index_;
+		}
+
+		return *this;
+	}
+
+	btree_iterator operator--(dummy_type) noexcept
+	{
+		btree_iterator rc(*this);
+		operator--();
+		return rc;
+	}
+
+private:
+	leaf_type* leaf_{ nullptr };
+	size_type index_{ 0 };
+	container_type* cont_{ nullptr };
+};
+
+/// \brief B+ tree holding pointers to the elements, with the map/set-style interface of avl_tree.
+/// Nodes keep up to Width keys contiguously, starting at a cache line, and the elements are reached
+/// from the leaves, so a lookup touches about log_{Width/2}(n) nodes. For integral keys ordered by
+/// the default comparer the keys of a node are compared with SIMD instructions where available.
+/// Unlike avl_tree, nodes are allocated with TAllocator, so insert() may fail, and
+/// iterators are invalidated by any modification. Keys of the elements mustn't change while they're in the tree.
+/// With EnableLock, operations on the tree take an internal reader-writer lock of type TMutex, see no_lock.
+template<typename T, BTreeKey TKey,
+		TKey T::*Key,
+		bool EnableLock = false,
+		bool CallDeleteOnRemoval = false,
+		typename TCmp = btree_default_comparer<TKey>,
+		typename TDeleter = default_deleter<T>,
+		typename TAllocator = default_allocator,
+		typename TMutex = lock::shared_mutex,
+		size_t Width = btree_default_width<TKey>>
+class btree
+{
+public:
+	using value_type = T;
+	using size_type = size_t;
+	using mutex_type = std::conditional_t<EnableLock, TMutex, no_lock>;
+	using lock_guard_type = std::conditional_t<EnableLock, lock::lock_guard<TMutex>, no_lock_guard<no_lock>>;
+	using shared_lock_guard_type = std::conditional_t<EnableLock,
+			lock::shared_lock_guard<TMutex>,
+			no_lock_guard<no_lock>>;
+	using iterator_type = btree_iterator<T, btree, EnableLock>;
+	using riterator_type = kbl::reversed_iterator<iterator_type>;
+	using const_iterator_type = const iterator_type;
+
+	template<typename, typename, bool>
+	friend
+	class btree_iterator;
+
+	static_assert(Width >= 4 && Width <= UINT16_MAX, "a node holds from 4 to 65535 keys");
+
+	static constexpr size_t CACHE_LINE_SIZE = 64;
+
+	// nodes other than the root keep at least this many keys
+	static constexpr size_type MIN_FILL = Width / 2;
+
+	// for Width >= 4 each level multiplies the number of keys at least by two
+	static constexpr size_type MAX_DEPTH = 64;
+
+	struct alignas(CACHE_LINE_SIZE) node_type
+	{
+		TKey keys[Width];
+		uint16_t count{ 0 };
+		bool leaf{ false };
+	};
+
+	struct leaf_type : node_type
+	{
+		T* values[Width];
+		leaf_type* prev{ nullptr }, * next{ nullptr };
+	};
+
+	// children[i] holds the keys in [keys[i - 1], keys[i])
+	struct inner_type : node_type
+	{
+		node_type* children[Width + 1];
+	};
+
+public:
+	btree() = default;
+
+	explicit btree(const TAllocator& allocator) : allocator_(allocator)
+	{
+	}
+
+	btree(const btree&) = delete;
+
+	btree& operator=(const btree&) = delete;
+
+	/// Free the nodes. The elements are left alone, even with CallDeleteOnRemoval.
+	~btree()
+	{
+		free_subtree(root_);
+	}
+
+	/// Insert an element. Does nothing if an element with the same key exists.
+	/// \param val
+	/// \return false if an element with the same key exists or a node couldn't be allocated
+	bool insert(T* val) TA_EXCL(lock_)
+	{
+		lock_guard_type g{ lock_ };
+
+		return do_insert(val);
+	}
+
+	bool insert(T& val)
+	{
+		return insert(&val);
+	}
+
+	/// Remove the element with the same key as val, which needn't be val itself. Does nothing if there isn't one.
+	/// \param val
+	void remove(T* val)
+	{
+		remove_by_key(val->*Key);
+	}
+
+	void remove(T& val)
+	{
+		remove(&val);
+	}
+
+	/// Remove val itself. Unlike remove(), does nothing if another element has its key.
+	/// \param val
+	/// \return false if val isn't in the tree
+	bool remove_element(T* val) TA_EXCL(lock_)
+	{
+		lock_guard_type g{ lock_ };
+
+		auto[leaf, index] = find_leaf(val->*Key);
+		if (leaf == nullptr || leaf->values[index] != val)
+			return false;
+
+		return do_remove(val->*Key);
+	}
+
+	bool remove_element(T& val)
+	{
+		return remove_element(&val);
+	}
+
+	/// Remove the element with the given key as if by remove()
+	/// \param key
+	/// \return false if there isn't one
+	bool remove_by_key(const TKey& key) TA_EXCL(lock_)
+	{
+		lock_guard_type g{ lock_ };
+
+		return do_remove(key);
+	}
+
+	/// Remove the element at pos as if by remove()
+	/// \param pos
+	/// \return iterator to the element after it
+	iterator_type erase(iterator_type pos) TA_EXCL(lock_)
+	{
+		lock_guard_type g{ lock_ };
+
+		if (pos.leaf_ == nullptr)
+			return pos;
+
+		TKey key = pos.leaf_->keys[pos.index_];
+		do_remove(key);
+
+		return position_of(lower_bound_leaf(key));
+	}
+
+	/// Remove all elements as if by remove()
+	void clear()
+	{
+		if constexpr (CallDeleteOnRemoval)
+			clear_and_dispose(deleter_);
+		else
+			clear_and_dispose([](T*)
+			{
+			});
+	}
+
+	/// Remove all elements and call disposer on each of them in key order instead of TDeleter
+	/// \tparam TDisposer callable with T*
+	/// \param disposer
+	template<typename TDisposer>
+	void clear_and_dispose(TDisposer&& disposer) TA_EXCL(lock_)
+	{
+		lock_guard_type g{ lock_ };
+
+		for (auto leaf = first_; leaf; leaf = leaf->next)
+		{
+			for (size_type i = 0; i < leaf->count; i++)
+				disposer(leaf->values[i]);
+		}
+
+		free_subtree(root_);
+		root_ = nullptr;
+		first_ = last_ = nullptr;
+		size_ = 0;
+	}
+
+	/// Find the element with the given key
+	/// \param key
+	/// \return pointer to the element, or nullptr if it doesn't exist
+	T* find_ptr(const TKey& key) TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		auto[leaf, index] = find_leaf(key);
+		return leaf ? leaf->values[index] : nullptr;
+	}
+
+	/// Find the element with the given key
+	/// \param key
+	/// \return iterator to the element, or end() if it doesn't exist
+	iterator_type find(const TKey& key) TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return position_of(find_leaf(key));
+	}
+
+	/// \param key
+	/// \return iterator to the first element whose key is not less than key
+	iterator_type lower_bound(const TKey& key) TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return position_of(lower_bound_leaf(key));
+	}
+
+	/// \param key
+	/// \return iterator to the first element whose key is greater than key
+	iterator_type upper_bound(const TKey& key) TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return position_of(upper_bound_leaf(key));
+	}
+
+	/// \param key
+	/// \return [lower_bound(key), upper_bound(key))
+	std::pair<iterator_type, iterator_type> equal_range(const TKey& key) TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return { position_of(lower_bound_leaf(key)), position_of(upper_bound_leaf(key)) };
+	}
+
+	/// Call func on every element in key order, holding the lock shared throughout.
+	/// func mustn't modify the tree.
+	/// \tparam TFunc callable with T&
+	/// \param func
+	template<typename TFunc>
+	void for_each(TFunc&& func) TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		for (auto leaf = first_; leaf; leaf = leaf->next)
+		{
+			for (size_type i = 0; i < leaf->count; i++)
+				func(*leaf->values[i]);
+		}
+	}
+
+	[[nodiscard]] size_type size() const TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return size_;
+	}
+
+	[[nodiscard]] bool empty() const TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return size_ == 0;
+	}
+
+	iterator_type begin() TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return first_position();
+	}
+
+	iterator_type end()
+	{
+		return iterator_type{ nullptr, 0, this };
+	}
+
+	riterator_type rbegin() TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return riterator_type{ last_position() };
+	}
+
+	riterator_type rend()
+	{
+		return riterator_type{ nullptr, iterator_type::BEFORE_FIRST, this };
+	}
+
+	T* front_ptr() TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return first_ ? first_->values[0] : nullptr;
+	}
+
+	T* back_ptr() TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return last_ ? last_->values[last_->count - 1] : nullptr;
+	}
+
+	T& front()
+	{
+		return *front_ptr();
+	}
+
+	T& back()
+	{
+		return *back_ptr();
+	}
+
+	/// Number of levels, 0 for an empty tree
+	[[nodiscard]] size_type height() const TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return height_;
+	}
+
+protected:
+	// keys compared by the SIMD paths of count_less() and count_greater()
+	static constexpr bool simd_search = std::is_integral_v<TKey> && std::is_same_v<TCmp, btree_default_comparer<TKey>>;
+
+	// number of keys less than key in the sorted keys[0, count)
+	size_type count_less(const TKey* keys, size_type count, const TKey& key)
+	{
+		if constexpr (simd_search)
+		{
+			return count_ordered<false>(keys, count, key);
+		}
+		else
+		{
+			size_type lo = 0, hi = count;
+			while (lo < hi)
+			{
+				auto mid = (lo + hi) / 2;
+				if (cmp_(keys[mid], key) < 0)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			return lo;
+		}
+	}
+
+	// number of keys not greater than key in the sorted keys[0, count)
+	size_type count_not_greater(const TKey* keys, size_type count, const TKey& key)
+	{
+		if constexpr (simd_search)
+		{
+			return count - count_ordered<true>(keys, count, key);
+		}
+		else
+		{
+			size_type lo = 0, hi = count;
+			while (lo < hi)
+			{
+				auto mid = (lo + hi) / 2;
+				if (cmp_(keys[mid], key) <= 0)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			return lo;
+		}
+	}
+
+	// count the keys less than key, or greater than key if Greater, comparing the whole node without branches.
+	// sorting doesn't matter here, which lets the compares run in parallel.
+	template<bool Greater>
+	static inline size_type count_ordered(const TKey* keys, size_type count, TKey key)
+	{
+		size_type result = 0, i = 0;
+
+#if defined(__SSE2__)
+		if constexpr (sizeof(TKey) == 4)
+		{
+			// SSE2 only compares signed integers, so unsigned ones are biased into that range
+			constexpr uint32_t bias = std::is_signed_v<TKey> ? 0 : 0x80000000u;
+			auto pivot = _mm_set1_epi32(static_cast<int32_t>(static_cast<uint32_t>(key) ^ bias));
+			auto flip = _mm_set1_epi32(static_cast<int32_t>(bias));
+
+			for (; i + 4 <= count; i += 4)
+			{
+				auto lanes = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), flip);
+				auto mask = Greater ? _mm_cmpgt_epi32(lanes, pivot) : _mm_cmpgt_epi32(pivot, lanes);
+				result += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(mask)));
+			}
+		}
+#endif
+
+#if defined(__SSE4_2__)
+		if constexpr (sizeof(TKey) == 8)
+		{
+			constexpr uint64_t bias = std::is_signed_v<TKey> ? 0 : 0x8000000000000000ull;
+			auto pivot = _mm_set1_epi64x(static_cast<int64_t>(static_cast<uint64_t>(key) ^ bias));
+			auto flip = _mm_set1_epi64x(static_cast<int64_t>(bias));
+
+			for (; i + 2 <= count; i += 2)
+			{
+				auto lanes = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), flip);
+				auto mask = Greater ? _mm_cmpgt_epi64(lanes, pivot) : _mm_cmpgt_epi64(pivot, lanes);
+				result += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(mask)));
+			}
+		}
+#endif
+
+		for (; i < count; i++)
+		{
+			result += Greater ? key < keys[i] : keys[i] < key;
+		}
+
+		return result;
+	}
+
+	// the child of inner that may hold key
+	node_type* child_for(inner_type* inner, const TKey& key, size_type& index)
+	{
+		index = count_not_greater(inner->keys, inner->count, key);
+		return inner->children[index];
+	}
+
+	leaf_type* leaf_for(const TKey& key) TA_REQ_SHARED(lock_)
+	{
+		auto node = root_;
+		if (node == nullptr)
+			return nullptr;
+
+		size_type index = 0;
+		while (!node->leaf)
+			node = child_for(static_cast<inner_type*>(node), key, index);
+
+		return static_cast<leaf_type*>(node);
+	}
+
+	// a position in the leaves, with index == count standing for the first element of the next leaf
+	struct leaf_position
+	{
+		leaf_type* leaf;
+		size_type index;
+	};
+
+	leaf_position find_leaf(const TKey& key) TA_REQ_SHARED(lock_)
+	{
+		auto leaf = leaf_for(key);
+		if (leaf == nullptr)
+			return { nullptr, 0 };
+
+		auto index = count_less(leaf->keys, leaf->count, key);
+		if (index == leaf->count || cmp_(leaf->keys[index], key) != 0)
+			return { nullptr, 0 };
+
+		return { leaf, index };
+	}
+
+	leaf_position lower_bound_leaf(const TKey& key) TA_REQ_SHARED(lock_)
+	{
+		auto leaf = leaf_for(key);
+		if (leaf == nullptr)
+			return { nullptr, 0 };
+
+		return { leaf, count_less(leaf->keys, leaf->count, key) };
+	}
+
+	leaf_position upper_bound_leaf(const TKey& key) TA_REQ_SHARED(lock_)
+	{
+		auto leaf = leaf_for(key);
+		if (leaf == nullptr)
+			return { nullptr, 0 };
+
+		return { leaf, count_not_greater(leaf->keys, leaf->count, key) };
+	}
+
+	iterator_type position_of(leaf_position pos)
+	{
+		auto[leaf, index] = pos;
+		if (leaf && index == leaf->count)
+		{
+			leaf = leaf->next;
+			index = 0;
+		}
+
+		return leaf ? iterator_type{ leaf, index, this } : end();
+	}
+
+	iterator_type first_position() TA_REQ_SHARED(lock_)
+	{
+		return first_ ? iterator_type{ first_, 0, this } : end();
+	}
+
+	iterator_type last_position() TA_REQ_SHARED(lock_)
+	{
+		return last_ ? iterator_type{ last_, last_->count - 1u, this } : iterator_type{ nullptr, iterator_type::BEFORE_FIRST, this };
+	}
+
+	template<typename TNode>
+	TNode* allocate_node()
+	{
+		auto memory = allocator_.allocate(sizeof(TNode), alignof(TNode));
+		if (memory == nullptr)
+			return nullptr;
+
+		auto node = new(memory) TNode{};
+		node->leaf = std::is_same_v<TNode, leaf_type>;
+		return node;
+	}
+
+	template<typename TNode>
+	void free_node(TNode* node)
+	{
+		node->~TNode();
+		allocator_.deallocate(node, sizeof(TNode), alignof(TNode));
+	}
+
+	void free_subtree(node_type* node)
+	{
+		if (node == nullptr)
+			return;
+
+		if (node->leaf)
+		{
+			free_node(static_cast<leaf_type*>(node));
+			return;
+		}
+
+		auto inner = static_cast<inner_type*>(node);
+		for (size_type i = 0; i <= inner->count; i++)
+			free_subtree(inner->children[i]);
+
+		free_node(inner);
+	}
+
+	// the nodes from the root down to a leaf, with the index of the child taken at each inner node
+	struct node_path
+	{
+		node_type* nodes[MAX_DEPTH];
+		size_type indices[MAX_DEPTH];
+		size_type depth{ 0 };
+	};
+
+	leaf_type* descend(const TKey& key, node_path& path) TA_REQ(lock_)
+	{
+		auto node = root_;
+		path.depth = 0;
+
+		while (!node->leaf)
+		{
+			size_type index = 0;
+			auto child = child_for(static_cast<inner_type*>(node), key, index);
+
+			path.nodes[path.depth] = node;
+			path.indices[path.depth] = index;
+			path.depth++;
+
+			node = child;
+		}
+
+		path.nodes[path.depth] = node;
+		return static_cast<leaf_type*>(node);
+	}
+
+	bool do_insert(T* val) TA_REQ(lock_)
+	{
+		const TKey& key = val->*Key;
+
+		if (root_ == nullptr)
+		{
+			auto leaf = allocate_node<leaf_type>();
+			if (leaf == nullptr)
+				return false;
+
+			leaf->keys[0] = key;
+			leaf->values[0] = val;
+			leaf->count = 1;
+
+			root_ = first_ = last_ = leaf;
+			height_ = 1;
+			size_ = 1;
+			return true;
+		}
+
+		node_path path{};
+		auto leaf = descend(key, path);
+
+		auto index = count_less(leaf->keys, leaf->count, key);
+		if (index < leaf->count && cmp_(leaf->keys[index], key) == 0)
+			return false;
+
+		if (leaf->count < Width)
+		{
+			std::copy_backward(leaf->keys + index, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+			std::copy_backward(leaf->values + index, leaf->values + leaf->count, leaf->values + leaf->count + 1);
+			leaf->keys[index] = key;
+			leaf->values[index] = val;
+			leaf->count++;
+
+			size_++;
+			return true;
+		}
+
+		// allocate all the nodes the split may need up front, so that failing leaves the tree unchanged
+		size_type splits = 1;
+		for (auto level = path.depth; level > 0 && path.nodes[level - 1]->count == Width; level--)
+			splits++;
+
+		inner_type* spare[MAX_DEPTH + 1]{};
+		auto spare_count = splits - 1 + (splits > path.depth ? 1 : 0);
+
+		auto right_leaf = allocate_node<leaf_type>();
+		for (size_type i = 0; i < spare_count && right_leaf; i++)
+		{
+			spare[i] = allocate_node<inner_type>();
+			if (spare[i] == nullptr)
+			{
+				for (size_type j = 0; j < i; j++)
+					free_node(spare[j]);
+
+				free_node(right_leaf);
+				right_leaf = nullptr;
+			}
+		}
+
+		if (right_leaf == nullptr)
+			return false;
+
+		TKey separator = split_leaf(leaf, right_leaf, index, key, val);
+		node_type* right = right_leaf;
+
+		size_type used = 0;
+		for (auto level = path.depth; level > 0; level--)
+		{
+			auto parent = static_cast<inner_type*>(path.nodes[level - 1]);
+			auto at = path.indices[level - 1];
+
+			if (parent->count < Width)
+			{
+				std::copy_backward(parent->keys + at, parent->keys + parent->count, parent->keys + parent->count + 1);
+				std::copy_backward(parent->children + at + 1,
+						parent->children + parent->count + 1,
+						parent->children + parent->count + 2);
+				parent->keys[at] = separator;
+				parent->children[at + 1] = right;
+				parent->count++;
+
+				right = nullptr;
+				break;
+			}
+
+			auto right_inner = spare[used++];
+			separator = split_inner(parent, right_inner, at, separator, right);
+			right = right_inner;
+		}
+
+		if (right)
+		{
+			// the root was split
+			auto root = spare[used++];
+			root->keys[0] = separator;
+			root->children[0] = root_;
+			root->children[1] = right;
+			root->count = 1;
+
+			root_ = root;
+			height_++;
+		}
+
+		size_++;
+		return true;
+	}
+
+	// move about half of the full leaf, with (key, val) inserted at index, to the empty right.
+	// return the first key of right
+	TKey split_leaf(leaf_type* leaf, leaf_type* right, size_type index, const TKey& key, T* val) TA_REQ(lock_)
+	{
+		TKey keys[Width + 1];
+		T* values[Width + 1];
+
+		std::copy(leaf->keys, leaf->keys + index, keys);
+		std::copy(leaf->keys + index, leaf->keys + Width, keys + index + 1);
+		std::copy(leaf->values, leaf->values + index, values);
+		std::copy(leaf->values + index, leaf->values + Width, values + index + 1);
+		keys[index] = key;
+		values[index] = val;
+
+		constexpr size_type keep = (Width + 1) / 2;
+
+		std::copy(keys, keys + keep, leaf->keys);
+		std::copy(values, values + keep, leaf->values);
+		leaf->count = keep;
+
+		std::copy(keys + keep, keys + Width + 1, right->keys);
+		std::copy(values + keep, values + Width + 1, right->values);
+		right->count = Width + 1 - keep;
+
+		right->prev = leaf;
+		right->next = leaf->next;
+		if (leaf->next)
+			leaf->next->prev = right;
+		else
+			last_ = right;
+		leaf->next = right;
+
+		return right->keys[0];
+	}
+
+	// move about half of the full inner node, with (separator, child) inserted after its child at index,
+	// to the empty right. return the key that separates them in their parent
+	TKey split_inner(inner_type* inner, inner_type* right, size_type index, const TKey& separator, node_type* child)
+	{
+		TKey keys[Width + 1];
+		node_type* children[Width + 2];
+
+		std::copy(inner->keys, inner->keys + index, keys);
+		std::copy(inner->keys + index, inner->keys + Width, keys + index + 1);
+		std::copy(inner->children, inner->children + index + 1, children);
+		std::copy(inner->children + index + 1, inner->children + Width + 1, children + index + 2);
+		keys[index] = separator;
+		children[index + 1] = child;
+
+		constexpr size_type middle = (Width + 1) / 2;
+
+		std::copy(keys, keys + middle, inner->keys);
+		std::copy(children, children + middle + 1, inner->children);
+		inner->count = middle;
+
+		std::copy(keys + middle + 1, keys + Width + 1, right->keys);
+		std::copy(children + middle + 1, children + Width + 2, right->children);
+		right->count = Width - middle;
+
+		return keys[middle];
+	}
+
+	bool do_remove(const TKey& key) TA_REQ(lock_)
+	{
+		if (root_ == nullptr)
+			return false;
+
+		node_path path{};
+		auto leaf = descend(key, path);
+
+		auto index = count_less(leaf->keys, leaf->count, key);
+		if (index == leaf->count || cmp_(leaf->keys[index], key) != 0)
+			return false;
+
+		auto val = leaf->values[index];
+
+		std::copy(leaf->keys + index + 1, leaf->keys + leaf->count, leaf->keys + index);
+		std::copy(leaf->values + index + 1, leaf->values + leaf->count, leaf->values + index);
+		leaf->count--;
+		size_--;
+
+		// separators above may still hold the removed key, which keeps them valid bounds
+		for (auto level = path.depth; level > 0 && path.nodes[level]->count < MIN_FILL; level--)
+			fix_underflow(path, level);
+
+		if (root_->count == 0)
+		{
+			if (root_->leaf)
+			{
+				free_node(static_cast<leaf_type*>(root_));
+				root_ = first_ = last_ = nullptr;
+				height_ = 0;
+			}
+			else
+			{
+				auto old_root = static_cast<inner_type*>(root_);
+				root_ = old_root->children[0];
+				free_node(old_root);
+				height_--;
+			}
+		}
+
+		if constexpr (CallDeleteOnRemoval)
+		{
+			deleter_(val);
+		}
+
+		return true;
+	}
+
+	// refill the node at level of path, which is below MIN_FILL, from a sibling or merge it with one
+	void fix_underflow(node_path& path, size_type level) TA_REQ(lock_)
+	{
+		auto parent = static_cast<inner_type*>(path.nodes[level - 1]);
+		auto at = path.indices[level - 1];
+		auto node = path.nodes[level];
+
+		auto left = at > 0 ? parent->children[at - 1] : nullptr;
+		auto right = at < parent->count ? parent->children[at + 1] : nullptr;
+
+		if (left && left->count > MIN_FILL)
+		{
+			if (node->leaf)
+				borrow_from_left(static_cast<leaf_type*>(left), static_cast<leaf_type*>(node), parent->keys[at - 1]);
+			else
+				borrow_from_left(static_cast<inner_type*>(left), static_cast<inner_type*>(node), parent->keys[at - 1]);
+		}
+		else if (right && right->count > MIN_FILL)
+		{
+			if (node->leaf)
+				borrow_from_right(static_cast<leaf_type*>(node), static_cast<leaf_type*>(right), parent->keys[at]);
+			else
+				borrow_from_right(static_cast<inner_type*>(node), static_cast<inner_type*>(right), parent->keys[at]);
+		}
+		else
+		{
+			// merge into the left one of the pair, and drop the separator and the right one from parent
+			auto separator_index = left ? at - 1 : at;
+			auto merged_left = left ? left : node;
+			auto merged_right = left ? node : right;
+
+			if (node->leaf)
+				merge(static_cast<leaf_type*>(merged_left), static_cast<leaf_type*>(merged_right));
+			else
+				merge(static_cast<inner_type*>(merged_left), static_cast<inner_type*>(merged_right), parent->keys[separator_index]);
+
+			std::copy(parent->keys + separator_index + 1, parent->keys + parent->count, parent->keys + separator_index);
+			std::copy(parent->children + separator_index + 2,
+					parent->children + parent->count + 1,
+					parent->children + separator_index + 1);
+			parent->count--;
+		}
+	}
+
+	static inline void borrow_from_left(leaf_type* left, leaf_type* node, TKey& separator)
+	{
+		std::copy_backward(node->keys, node->keys + node->count, node->keys + node->count + 1);
+		std::copy_backward(node->values, node->values + node->count, node->values + node->count + 1);
+
+		node->keys[0] = left->keys[left->count - 1];
+		node->values[0] = left->values[left->count - 1];
+		node->count++;
+		left->count--;
+
+		separator = node->keys[0];
+	}
+
+	static inline void borrow_from_right(leaf_type* node, leaf_type* right, TKey& separator)
+	{
+		node->keys[node->count] = right->keys[0];
+		node->values[node->count] = right->values[0];
+		node->count++;
+
+		std::copy(right->keys + 1, right->keys + right->count, right->keys);
+		std::copy(right->values + 1, right->values + right->count, right->values);
+		right->count--;
+
+		separator = right->keys[0];
+	}
+
+	// the separator comes down into node, and the last key of left replaces it
+	static inline void borrow_from_left(inner_type* left, inner_type* node, TKey& separator)
+	{
+		std::copy_backward(node->keys, node->keys + node->count, node->keys + node->count + 1);
+		std::copy_backward(node->children, node->children + node->count + 1, node->children + node->count + 2);
+
+		node->keys[0] = separator;
+		node->children[0] = left->children[left->count];
+		node->count++;
+
+		separator = left->keys[left->count - 1];
+		left->count--;
+	}
+
+	static inline void borrow_from_right(inner_type* node, inner_type* right, TKey& separator)
+	{
+		node->keys[node->count] = separator;
+		node->children[node->count + 1] = right->children[0];
+		node->count++;
+
+		separator = right->keys[0];
+
+		std::copy(right->keys + 1, right->keys + right->count, right->keys);
+		std::copy(right->children + 1, right->children + right->count + 1, right->children);
+		right->count--;
+	}
+
+	void merge(leaf_type* left, leaf_type* right) TA_REQ(lock_)
+	{
+		std::copy(right->keys, right->keys + right->count, left->keys + left->count);
+		std::copy(right->values, right->values + right->count, left->values + left->count);
+		left->count += right->count;
+
+		left->next = right->next;
+		if (right->next)
+			right->next->prev = left;
+		else
+			last_ = left;
+
+		free_node(right);
+	}
+
+	void merge(inner_type* left, inner_type* right, const TKey& separator) TA_REQ(lock_)
+	{
+		left->keys[left->count] = separator;
+		std::copy(right->keys, right->keys + right->count, left->keys + left->count + 1);
+		std::copy(right->children, right->children + right->count + 1, left->children + left->count + 1);
+		left->count += right->count + 1;
+
+		free_node(right);
+	}
+
+private:
+	node_type* root_ TA_GUARDED(lock_){ nullptr };
+	leaf_type* first_ TA_GUARDED(lock_){ nullptr };
+	leaf_type* last_ TA_GUARDED(lock_){ nullptr };
+
+	size_type size_ TA_GUARDED(lock_){ 0 };
+	size_type height_ TA_GUARDED(lock_){ 0 };
+
+	TCmp cmp_{};
+	TDeleter deleter_{};
+	[[no_unique_address]] TAllocator allocator_{};
+
+	[[no_unique_address]] mutable mutex_type lock_{};
+};
+
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include "lock_guard.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kbl
+{
+
+/// \brief A small work-stealing thread pool for fork-join parallelism.
+/// Each worker owns a deque of tasks: it pushes and pops forked tasks at the back,
+/// while idle workers steal from the front. Threads outside the pool share one extra deque.
+class fork_join_pool
+{
+public:
+	using size_type = size_t;
+
+public:
+	/// \param workers number of worker threads besides the threads calling fork_join()
+	explicit fork_join_pool(size_type workers = std::thread::hardware_concurrency())
+			: queues_(workers + 1)
+	{
+		for (auto& q:queues_)
+		{
+			q = std::make_unique<task_queue>();
+		}
+
+		threads_.reserve(workers);
+		for (size_type i = 0; i < workers; i++)
+		{
+			threads_.emplace_back([this, i]
+			{
+				worker_main(i);
+			});
+		}
+	}
+
+	~fork_join_pool()
+	{
+		{
+			std::unique_lock<std::mutex> lk{ sleep_lock_ };
+			stop_ = true;
+		}
+		sleep_cv_.notify_all();
+
+		for (auto& t:threads_)
+		{
+			t.join();
+		}
+	}
+
+	fork_join_pool(const fork_join_pool&) = delete;
+
+	fork_join_pool& operator=(const fork_join_pool&) = delete;
+
+	/// Run f1 and f2, possibly in parallel, and return when both of them have finished.
+	/// While waiting, the calling thread runs other tasks of the pool.
+	/// \param f1 runs on the calling thread
+	/// \param f2 may be stolen by another worker
+	template<typename F1, typename F2>
+	void fork_join(F1&& f1, F2&& f2)
+	{
+		task forked{ [](void* arg)
+					 {
+						 (*static_cast<std::remove_reference_t<F2>*>(arg))();
+					 }, &f2 };
+
+		auto index = local_index();
+		push(index, &forked);
+
+		f1();
+
+		if (queues_[index]->pop_if_back(&forked))
+		{
+			--pending_;
+			forked.run();
+		}
+		else
+		{
+			wait(index, &forked);
+		}
+	}
+
+	[[nodiscard]] size_type worker_count() const
+	{
+		return threads_.size();
+	}
+
+private:
+	struct task
+	{
+		void (* func)(void*);
+		void* arg;
+		std::atomic<bool> done{ false };
+
+		task(void (* f)(void*), void* a) : func(f), arg(a)
+		{
+		}
+
+		void run()
+		{
+			func(arg);
+			done.store(true, std::memory_order_release);
+		}
+	};
+
+	struct alignas(64) task_queue
+	{
+		std::mutex lock;
+		std::deque<task*> tasks;
+
+		void push(task* t)
+		{
+			lock::lock_guard<std::mutex> g{ lock };
+			tasks.push_back(t);
+		}
+
+		bool pop_if_back(task* t)
+		{
+			lock::lock_guard<std::mutex> g{ lock };
+			if (tasks.empty() || tasks.back() != t)
+				return false;
+
+			tasks.pop_back();
+			return true;
+		}
+
+		task* pop_back()
+		{
+			lock::lock_guard<std::mutex> g{ lock };
+			if (tasks.empty())
+				return nullptr;
+
+			auto t = tasks.back();
+			tasks.pop_back();
+			return t;
+		}
+
+		task* steal()
+		{
+			lock::lock_guard<std::mutex> g{ lock };
+			if (tasks.empty())
+				return nullptr;
+
+			auto t = tasks.front();
+			tasks.pop_front();
+			return t;
+		}
+	};
+
+	struct worker_identity
+	{
+		fork_join_pool* pool;
+		size_type index;
+	};
+
+	// zero-initialized, so threads outside any pool have a null pool
+	static inline thread_local worker_identity current_;
+
+	// the queue owned by the calling thread, the shared one for threads outside the pool
+	size_type local_index() const
+	{
+		return current_.pool == this ? current_.index : threads_.size();
+	}
+
+	void push(size_type index, task* t)
+	{
+		queues_[index]->push(t);
+		++pending_;
+
+		{
+			// pairs with the predicate check of sleeping workers so that the wakeup isn't lost
+			std::unique_lock<std::mutex> lk{ sleep_lock_ };
+		}
+		sleep_cv_.notify_one();
+	}
+
+	task* find_task(size_type index)
+	{
+		if (pending_.load(std::memory_order_acquire) == 0)
+			return nullptr;
+
+		if (auto t = queues_[index]->pop_back())
+		{
+			--pending_;
+			return t;
+		}
+
+		for (size_type i = 1; i < queues_.size(); i++)
+		{
+			if (auto t = queues_[(index + i) % queues_.size()]->steal())
+			{
+				--pending_;
+				return t;
+			}
+		}
+
+		return nullptr;
+	}
+
+	// help the pool until the forked task, which has been stolen, is done
+	void wait(size_type index, task* forked)
+	{
+		while (!forked->done.load(std::memory_order_acquire))
+		{
+			if (auto t = find_task(index))
+				t->run();
+			else
+				std::this_thread::yield();
+		}
+	}
+
+	void worker_main(size_type index)
+	{
+		current_ = worker_identity{ this, index };
+
+		for (;;)
+		{
+			if (auto t = find_task(index))
+			{
+				t->run();
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lk{ sleep_lock_ };
+			sleep_cv_.wait(lk, [this]
+			{
+				return stop_ || pending_.load() > 0;
+			});
+
+			if (stop_)
+				break;
+		}
+	}
+
+	std::vector<std::unique_ptr<task_queue>> queues_;
+	std::vector<std::thread> threads_;
+
+	std::atomic<size_type> pending_{ 0 };
+
+	std::mutex sleep_lock_;
+	std::condition_variable sleep_cv_;
+	bool stop_{ false };
+};
+
+}
@@ -1,6 +1,3021 @@
 #pragma once
 
+#include "utility.h"
+#include "lock_guard.h"
+#include "shared_mutex.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace kbl
 {
 
-}
\ No newline at end of file
+/// Link of intrusive_hash_table, chaining the elements of a bucket
+template<typename TOwner>
+struct hash_table_link
+{
+	TOwner* owner{ nullptr };
+
+	hash_table_link* next{ nullptr };
+
+	// hash of the key, so that rehashing doesn't hash again and most mismatches skip the key comparison
+	size_t hash{ 0 };
+
+	[[nodiscard]] hash_table_link() = default;
+
+	[[nodiscard]] explicit hash_table_link(TOwner* o) : owner(o)
+	{
+	}
+};
+
+template<typename T, typename TContainer, bool EnableLock>
+class intrusive_hash_table_iterator
+{
+public:
+	using value_type = T;
+	using size_type = size_t;
+	using container_type = TContainer;
+	using link_type = typename container_type::link_type;
+
+	using dummy_type = int;
+
+	friend TContainer;
+
+public:
+	intrusive_hash_table_iterator() = default;
+
+	explicit intrusive_hash_table_iterator(link_type* h, size_type bucket, container_type* cont) :
+			h_(h),
+			bucket_(bucket),
+			cont_(cont)
+	{
+	}
+
+	T& operator*()
+	{
+		return *operator->();
+	}
+
+	T* operator->()
+	{
+		return h_->owner;
+	}
+
+	bool operator==(intrusive_hash_table_iterator const& other) const
+	{
+		return h_ == other.h_;
+	}
+
+	bool operator!=(intrusive_hash_table_iterator const& other) const
+	{
+		return !(*this == other);
+	}
+
+	// iterating needs the table kept from modification by the caller, see intrusive_hash_table
+	intrusive_hash_table_iterator& operator++() TA_NO_THREAD_SAFETY_ANALYSIS
+	{
+		if (h_->next)
+		{
+			h_ = h_->next;
+		}
+		else
+		{
+			bucket_ = cont_->next_bucket(bucket_ + 1);
+			h_ = cont_->bucket_head(bucket_);
+		}
+
+		return *this;
+	}
+
+	intrusive_hash_table_iterator operator++(dummy_type) noexcept
+	{
+		intrusive_hash_table_iterator rc(*this);
+		operator++();
+		return rc;
+	}
+
+private:
+	link_type* h_{ nullptr };
+	size_type bucket_{ 0 };
+	container_type* cont_{ nullptr };
+};
+
+/// \brief Intrusive hash table with separate chaining, providing an interface similar to STL unordered_set.
+/// Each bucket is a singly-linked chain of the links embedded in the elements, so inserting never allocates.
+/// The bucket array is supplied by the caller, its size rounded down to a power of two, and can be
+/// replaced with rehash() at once, or with begin_rehash() incrementally to bound the latency of growing.
+/// Keys of the elements mustn't change while they're in the table.
+/// With EnableLock, operations on the table take an internal reader-writer lock of type TMutex, see no_lock.
+template<typename T, typename TKey,
+		TKey T::*Key,
+		auto T::*Link,
+		typename THash = std::hash<TKey>,
+		typename TEq = std::equal_to<TKey>,
+		bool EnableLock = false,
+		bool CallDeleteOnRemoval = false,
+		typename TDeleter = default_deleter<T>,
+		typename TMutex = lock::shared_mutex>
+class intrusive_hash_table
+{
+public:
+	using value_type = T;
+	using size_type = size_t;
+	using mutex_type = std::conditional_t<EnableLock, TMutex, no_lock>;
+	using lock_guard_type = std::conditional_t<EnableLock, lock::lock_guard<TMutex>, no_lock_guard<no_lock>>;
+	using shared_lock_guard_type = std::conditional_t<EnableLock,
+			lock::shared_lock_guard<TMutex>,
+			no_lock_guard<no_lock>>;
+	using link_type = std::remove_cvref_t<decltype(std::declval<T&>().*Link)>;
+	using bucket_type = link_type*;
+	using iterator_type = intrusive_hash_table_iterator<T, intrusive_hash_table, EnableLock>;
+	using const_iterator_type = const iterator_type;
+
+	template<typename, typename, bool>
+	friend
+	class intrusive_hash_table_iterator;
+
+public:
+	/// \param buckets array of count empty buckets, which the table uses until rehash()
+	/// \param count number of buckets, at least one, rounded down to a power of two
+	intrusive_hash_table(bucket_type* buckets, size_type count)
+	{
+		assert(count > 0);
+		attach_buckets(buckets, count);
+	}
+
+	template<size_type N>
+	explicit intrusive_hash_table(bucket_type (& buckets)[N])
+			: intrusive_hash_table(buckets, N)
+	{
+	}
+
+	intrusive_hash_table(const intrusive_hash_table&) = delete;
+
+	intrusive_hash_table& operator=(const intrusive_hash_table&) = delete;
+
+	/// Insert an element. Does nothing if an element with the same key exists.
+	/// \param val
+	/// \return false if an element with the same key exists
+	bool insert(T* val) TA_EXCL(lock_)
+	{
+		lock_guard_type g{ lock_ };
+
+		migrate(rehash_budget_);
+		return do_insert(val);
+	}
+
+	bool insert(T& val)
+	{
+		return insert(&val);
+	}
+
+	/// Remove an element of the table. Does nothing if it isn't in the table.
+	/// \param val
+	/// \return false if val isn't in the table
+	bool remove(T* val) TA_EXCL(lock_)
+	{
+		lock_guard_type g{ lock_ };
+
+		migrate(rehash_budget_);
+
+		auto node = link_of(val);
+		auto pos = position_of(node);
+		if (pos == nullptr)
+			return false;
+
+		erase_at(pos);
+		return true;
+	}
+
+	bool remove(T& val)
+	{
+		return remove(&val);
+	}
+
+	/// Remove the element with the given key as if by remove()
+	/// \param key
+	/// \return false if there isn't one
+	bool remove_by_key(const TKey& key) TA_EXCL(lock_)
+	{
+		lock_guard_type g{ lock_ };
+
+		migrate(rehash_budget_);
+
+		auto pos = find_position(key, hash_of(key));
+		if (*pos == nullptr)
+			return false;
+
+		erase_at(pos);
+		return true;
+	}
+
+	/// Remove all elements as if by remove(), in O(n + buckets)
+	void clear()
+	{
+		if constexpr (CallDeleteOnRemoval)
+			clear_and_dispose(deleter_);
+		else
+			clear_and_dispose([](T*)
+			{
+			});
+	}
+
+	/// Remove all elements and call disposer on each of them instead of TDeleter.
+	/// Links are reset before disposer is called, so it may free the element or link it into another table.
+	/// An incremental rehash in progress completes.
+	/// \tparam TDisposer callable with T*
+	/// \param disposer
+	template<typename TDisposer>
+	void clear_and_dispose(TDisposer&& disposer) TA_EXCL(lock_)
+	{
+		lock_guard_type g{ lock_ };
+
+		auto dispose_chains = [&disposer](bucket_type* buckets, size_type count)
+		{
+			for (size_type i = 0; i < count; i++)
+			{
+				for (auto node = buckets[i]; node;)
+				{
+					auto next = node->next;
+					node->next = nullptr;
+
+					disposer(node->owner);
+					node = next;
+				}
+
+				buckets[i] = nullptr;
+			}
+		};
+
+		if (old_buckets_)
+		{
+			dispose_chains(old_buckets_ + migrated_, old_count_ - migrated_);
+			retire_old_buckets();
+		}
+
+		dispose_chains(buckets_, bucket_count_);
+
+		size_ = 0;
+	}
+
+	/// Find the element with the given key
+	/// \param key
+	/// \return pointer to the element, or nullptr if it doesn't exist
+	T* find_ptr(const TKey& key) TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		auto node = *find_position(key, hash_of(key));
+		return node ? node->owner : nullptr;
+	}
+
+	/// Find the element with the given key
+	/// \param key
+	/// \return iterator to the element, or end() if it doesn't exist
+	iterator_type find(const TKey& key) TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		auto hash = hash_of(key);
+		auto node = *find_position(key, hash);
+		return node ? iterator_type{ node, iteration_index_of(hash), this } : end();
+	}
+
+	bool contains(const TKey& key)
+	{
+		return find_ptr(key) != nullptr;
+	}
+
+	/// Call func on every element in the order of iteration, holding the lock shared throughout.
+	/// func mustn't modify the table.
+	/// \tparam TFunc callable with T&
+	/// \param func
+	template<typename TFunc>
+	void for_each(TFunc&& func) TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		for (auto bucket = next_bucket(0); bucket < old_count_ + bucket_count_; bucket = next_bucket(bucket + 1))
+		{
+			for (auto node = bucket_head(bucket); node; node = node->next)
+				func(*node->owner);
+		}
+	}
+
+	/// Move the elements to another bucket array in O(n + buckets), at once.
+	/// Refused while an incremental rehash is in progress, which rehash_step() can complete first.
+	/// \param buckets array of count empty buckets
+	/// \param count number of buckets, rounded down to a power of two
+	/// \return the array the table used before the call, which the caller may free,
+	/// or nullptr if count is zero or an incremental rehash is in progress, which leaves the table as it was
+	bucket_type* rehash(bucket_type* buckets, size_type count) TA_EXCL(lock_)
+	{
+		lock_guard_type g{ lock_ };
+
+		if (count == 0 || old_buckets_)
+			return nullptr;
+
+		auto old_buckets = buckets_;
+		auto old_count = bucket_count_;
+
+		attach_buckets(buckets, count);
+
+		for (size_type i = 0; i < old_count; i++)
+		{
+			move_chain(old_buckets[i]);
+		}
+
+		return old_buckets;
+	}
+
+	/// \brief Start moving the elements to another bucket array a few buckets at a time.
+	/// Until the move completes, the old and the new array are used side by side: each insert(), remove()
+	/// and remove_by_key() first moves the chains of budget buckets of the old array, so no single
+	/// operation pays for the whole rehash. Lookups only read, so they may run under the shared lock.
+	/// Once every chain is moved, the old array is retired, and take_retired_buckets() hands it back.
+	/// Inserting and removing during the move may reorder the iteration.
+	/// \param buckets array of count empty buckets
+	/// \param count number of buckets, rounded down to a power of two
+	/// \param budget number of old buckets each modification moves, at least one
+	/// \return false if count is zero, or a rehash is in progress or its retired array hasn't been taken
+	bool begin_rehash(bucket_type* buckets, size_type count, size_type budget) TA_EXCL(lock_)
+	{
+		lock_guard_type g{ lock_ };
+
+		if (count == 0 || old_buckets_ || retired_buckets_)
+			return false;
+
+		old_buckets_ = buckets_;
+		old_count_ = bucket_count_;
+		old_shift_ = bucket_shift_;
+		migrated_ = 0;
+		rehash_budget_ = budget ? budget : 1;
+
+		attach_buckets(buckets, count);
+
+		return true;
+	}
+
+	/// Move up to budget buckets of an incremental rehash in progress, for callers that would like to
+	/// advance it outside insert() and remove(), such as from an idle path.
+	/// \param budget
+	/// \return true if the rehash has completed
+	bool rehash_step(size_type budget) TA_EXCL(lock_)
+	{
+		lock_guard_type g{ lock_ };
+
+		migrate(budget);
+		return old_buckets_ == nullptr;
+	}
+
+	[[nodiscard]] bool rehashing() const TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return old_buckets_ != nullptr;
+	}
+
+	/// Take the bucket array an incremental rehash has finished with
+	/// \return the array, which the caller may free, or nullptr if there isn't one
+	bucket_type* take_retired_buckets() TA_EXCL(lock_)
+	{
+		lock_guard_type g{ lock_ };
+
+		return std::exchange(retired_buckets_, nullptr);
+	}
+
+	[[nodiscard]] size_type size() const TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return size_;
+	}
+
+	[[nodiscard]] bool empty() const TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return size_ == 0;
+	}
+
+	/// Number of buckets, those of the new array while an incremental rehash is in progress
+	[[nodiscard]] size_type bucket_count() const TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return bucket_count_;
+	}
+
+	/// Average number of elements in a bucket
+	[[nodiscard]] double load_factor() const TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		return static_cast<double>(size_) / static_cast<double>(bucket_count_);
+	}
+
+	iterator_type begin() TA_EXCL(lock_)
+	{
+		shared_lock_guard_type g{ lock_ };
+
+		auto bucket = next_bucket(0);
+		auto head = bucket_head(bucket);
+		return head ? iterator_type{ head, bucket, this } : end();
+	}
+
+	iterator_type end()
+	{
+		return iterator_type{ nullptr, 0, this };
+	}
+
+protected:
+	// without buckets until attach_buckets(), for tables that own a share of another's array
+	intrusive_hash_table() = default;
+
+	static inline link_type* link_of(T* val)
+	{
+		return &(val->*Link);
+	}
+
+	static inline const TKey& key_of(link_type* node)
+	{
+		return node->owner->*Key;
+	}
+
+	size_t hash_of(const TKey& key)
+	{
+		return static_cast<size_t>(hasher_(key));
+	}
+
+	// fibonacci hashing: the top bits of the product depend on all bits of the hash,
+	// which spreads hashes like the identity hash of integers over the buckets.
+	// shifting twice keeps a table of one bucket, which shifts by 64, well-defined.
+	static inline size_type bucket_index(size_t hash, int shift)
+	{
+		return static_cast<size_type>(((static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull) >> (shift - 1)) >> 1);
+	}
+
+	void attach_buckets(bucket_type* buckets, size_type count) TA_REQ(lock_)
+	{
+		buckets_ = buckets;
+		bucket_count_ = std::bit_floor(count);
+		bucket_shift_ = 64 - std::countr_zero(static_cast<uint64_t>(bucket_count_));
+	}
+
+	// the chain an element of the given hash belongs to: its bucket in the old array while that one
+	// hasn't been moved, otherwise its bucket in the current array
+	bucket_type& chain_of(size_t hash) TA_REQ_SHARED(lock_)
+	{
+		if (old_buckets_)
+		{
+			auto index = bucket_index(hash, old_shift_);
+			if (index >= migrated_)
+				return old_buckets_[index];
+		}
+
+		return buckets_[bucket_index(hash, bucket_shift_)];
+	}
+
+	// iterators walk the unmoved buckets of the old array, then the current array
+	size_type iteration_index_of(size_t hash) const TA_REQ_SHARED(lock_)
+	{
+		if (old_buckets_)
+		{
+			auto index = bucket_index(hash, old_shift_);
+			if (index >= migrated_)
+				return index;
+		}
+
+		return old_count_ + bucket_index(hash, bucket_shift_);
+	}
+
+	bucket_type bucket_head(size_type index) const TA_REQ_SHARED(lock_)
+	{
+		if (index < old_count_)
+			return old_buckets_[index];
+
+		index -= old_count_;
+		return index < bucket_count_ ? buckets_[index] : nullptr;
+	}
+
+	// the first non-empty bucket from index on, in the order of iteration_index_of()
+	size_type next_bucket(size_type index) const TA_REQ_SHARED(lock_)
+	{
+		while (index < old_count_ + bucket_count_ && bucket_head(index) == nullptr)
+			index++;
+
+		return index;
+	}
+
+	// the pointer to the node with the given key in its chain, or to the null pointer ending the chain
+	link_type** find_position(const TKey& key, size_t hash) TA_REQ_SHARED(lock_)
+	{
+		auto pos = &chain_of(hash);
+		while (*pos && ((*pos)->hash != hash || !eq_(key_of(*pos), key)))
+			pos = &(*pos)->next;
+
+		return pos;
+	}
+
+	// the pointer to node in its chain, nullptr if node isn't in this table
+	link_type** position_of(link_type* node) TA_REQ_SHARED(lock_)
+	{
+		if (node->owner == nullptr)
+			return nullptr;
+
+		auto pos = &chain_of(node->hash);
+		while (*pos && *pos != node)
+			pos = &(*pos)->next;
+
+		return *pos ? pos : nullptr;
+	}
+
+	void push_front(link_type* node) TA_REQ(lock_)
+	{
+		auto& head = buckets_[bucket_index(node->hash, bucket_shift_)];
+		node->next = head;
+		head = node;
+	}
+
+	// move every node of chain to the current array
+	void move_chain(bucket_type& chain) TA_REQ(lock_)
+	{
+		for (auto node = chain; node;)
+		{
+			auto next = node->next;
+			push_front(node);
+			node = next;
+		}
+
+		chain = nullptr;
+	}
+
+	// move the chains of up to budget buckets of the old array, retiring it once they're all moved
+	void migrate(size_type budget) TA_REQ(lock_)
+	{
+		if (old_buckets_ == nullptr)
+			return;
+
+		for (; budget && migrated_ < old_count_; budget--)
+		{
+			move_chain(old_buckets_[migrated_++]);
+		}
+
+		if (migrated_ == old_count_)
+		{
+			retire_old_buckets();
+		}
+	}
+
+	void retire_old_buckets() TA_REQ(lock_)
+	{
+		retired_buckets_ = old_buckets_;
+		old_buckets_ = nullptr;
+		old_count_ = 0;
+		migrated_ = 0;
+	}
+
+	bool do_insert(T* val) TA_REQ(lock_)
+	{
+		return do_insert(val, hash_of(val->*Key));
+	}
+
+	bool do_insert(T* val, size_t hash) TA_REQ(lock_)
+	{
+		auto node = link_of(val);
+
+		auto pos = find_position(val->*Key, hash);
+		if (*pos)
+			return false;
+
+		// pos is the end of the chain the key belongs to
+		node->owner = val;
+		node->hash = hash;
+		node->next = nullptr;
+		*pos = node;
+		size_++;
+
+		return true;
+	}
+
+	void erase_at(link_type** pos) TA_REQ(lock_)
+	{
+		auto node = *pos;
+		*pos = node->next;
+		node->next = nullptr;
+		size_--;
+
+		if constexpr (CallDeleteOnRemoval)
+		{
+			deleter_(node->owner);
+		}
+	}
+
+	bucket_type* buckets_ TA_GUARDED(lock_){ nullptr };
+	size_type bucket_count_ TA_GUARDED(lock_){ 0 };
+	int bucket_shift_ TA_GUARDED(lock_){ 0 };
+
+	// the array an incremental rehash moves elements out of, nullptr if none is in progress.
+	// buckets below migrated_ are already moved.
+	bucket_type* old_buckets_ TA_GUARDED(lock_){ nullptr };
+	size_type old_count_ TA_GUARDED(lock_){ 0 };
+	int old_shift_ TA_GUARDED(lock_){ 0 };
+	size_type migrated_ TA_GUARDED(lock_){ 0 };
+	size_type rehash_budget_ TA_GUARDED(lock_){ 0 };
+
+	bucket_type* retired_buckets_ TA_GUARDED(lock_){ nullptr };
+
+	size_type size_ TA_GUARDED(lock_){ 0 };
+
+	THash hasher_{};
+	TEq eq_{};
+	TDeleter deleter_{};
+
+	[[no_unique_address]] mutable mutex_type lock_{};
+};
+
+/// Default number of lock stripes of striped_hash_table
+inline constexpr size_t hash_table_default_stripes = 64;
+
+/// \brief Concurrent intrusive hash table, whose buckets are partitioned into lock stripes.
+/// Each stripe is an intrusive_hash_table over its share of the caller-supplied buckets, guarded by a
+/// reader-writer lock of its own and padded to whole cache lines, so operations on different stripes
+/// neither wait for each other nor share cache lines. Lookups of one stripe share its lock.
+/// rehash() takes the stripes one at a time, so the others stay available while it runs.
+/// Pointers returned by lookups stay valid only as long as the caller keeps the element alive.
+template<typename T, typename TKey,
+		TKey T::*Key,
+		auto T::*Link,
+		typename THash = std::hash<TKey>,
+		typename TEq = std::equal_to<TKey>,
+		bool CallDeleteOnRemoval = false,
+		typename TDeleter = default_deleter<T>,
+		typename TMutex = lock::shared_mutex,
+		size_t StripeCount = hash_table_default_stripes>
+class striped_hash_table
+{
+public:
+	static_assert(std::has_single_bit(StripeCount), "StripeCount must be a power of two");
+
+	using value_type = T;
+	using size_type = size_t;
+	using mutex_type = TMutex;
+	using lock_guard_type = lock::lock_guard<TMutex>;
+	using shared_lock_guard_type = lock::shared_lock_guard<TMutex>;
+	using table_type = intrusive_hash_table<T, TKey, Key, Link, THash, TEq, false, CallDeleteOnRemoval, TDeleter>;
+	using link_type = typename table_type::link_type;
+	using bucket_type = typename table_type::bucket_type;
+
+	static constexpr size_t CACHE_LINE_SIZE = 64;
+
+public:
+	/// \param buckets array of count empty buckets, split evenly between the stripes
+	/// \param count number of buckets, at least StripeCount, rounded down to a power of two
+	striped_hash_table(bucket_type* buckets, size_type count)
+	{
+		assert(count >= StripeCount);
+		attach_buckets(buckets, count);
+	}
+
+	template<size_type N>
+	explicit striped_hash_table(bucket_type (& buckets)[N])
+			: striped_hash_table(buckets, N)
+	{
+		static_assert(N >= StripeCount, "each stripe needs a bucket at least");
+	}
+
+	striped_hash_table(const striped_hash_table&) = delete;
+
+	striped_hash_table& operator=(const striped_hash_table&) = delete;
+
+	/// Insert an element. Does nothing if an element with the same key exists.
+	/// \param val
+	/// \return false if an element with the same key exists
+	bool insert(T* val)
+	{
+		auto hash = hash_of(val->*Key);
+		auto& s = stripe_of(hash);
+
+		lock_guard_type g{ s.lock };
+		return s.table.insert_hashed(val, hash);
+	}
+
+	bool insert(T& val)
+	{
+		return insert(&val);
+	}
+
+	/// Remove an element of the table. Does nothing if it isn't in the table.
+	/// \param val
+	/// \return false if val isn't in the table
+	bool remove(T* val)
+	{
+		auto& s = stripe_of(hash_of(val->*Key));
+
+		lock_guard_type g{ s.lock };
+		return s.table.remove(val);
+	}
+
+	bool remove(T& val)
+	{
+		return remove(&val);
+	}
+
+	/// Remove the element with the given key as if by remove()
+	/// \param key
+	/// \return false if there isn't one
+	bool remove_by_key(const TKey& key)
+	{
+		auto hash = hash_of(key);
+		auto& s = stripe_of(hash);
+
+		lock_guard_type g{ s.lock };
+
+		return s.table.remove_hashed(key, hash);
+	}
+
+	/// Find the element with the given key
+	/// \param key
+	/// \return pointer to the element, or nullptr if it doesn't exist
+	T* find_ptr(const TKey& key)
+	{
+		auto hash = hash_of(key);
+		auto& s = stripe_of(hash);
+
+		shared_lock_guard_type g{ s.lock };
+
+		return s.table.find_hashed(key, hash);
+	}
+
+	bool contains(const TKey& key)
+	{
+		return find_ptr(key) != nullptr;
+	}
+
+	/// Call func on every element, holding the lock of each stripe shared while visiting it.
+	/// func mustn't modify the table.
+	/// \tparam TFunc callable with T&
+	/// \param func
+	template<typename TFunc>
+	void for_each(TFunc&& func)
+	{
+		for (auto& s:stripes_)
+		{
+			shared_lock_guard_type g{ s.lock };
+
+			s.table.for_each(func);
+		}
+	}
+
+	/// Remove all elements as if by remove(), one stripe at a time
+	void clear()
+	{
+		for (auto& s:stripes_)
+		{
+			lock_guard_type g{ s.lock };
+
+			s.table.clear();
+		}
+	}
+
+	/// Remove all elements, one stripe at a time, and call disposer on each of them instead of TDeleter.
+	/// \tparam TDisposer callable with T*
+	/// \param disposer
+	template<typename TDisposer>
+	void clear_and_dispose(TDisposer&& disposer)
+	{
+		for (auto& s:stripes_)
+		{
+			lock_guard_type g{ s.lock };
+
+			s.table.clear_and_dispose(disposer);
+		}
+	}
+
+	/// Move the elements to another bucket array, locking one stripe at a time
+	/// \param buckets array of count empty buckets
+	/// \param count number of buckets, at least StripeCount, rounded down to a power of two
+	/// \return the previous bucket array, which the caller may free,
+	/// or nullptr if count is less than StripeCount, which leaves the table as it was
+	bucket_type* rehash(bucket_type* buckets, size_type count)
+	{
+		if (count < StripeCount)
+			return nullptr;
+
+		auto per_stripe = buckets_per_stripe(count);
+
+		bucket_type* old_buckets = nullptr;
+		for (size_type i = 0; i < StripeCount; i++)
+		{
+			lock_guard_type g{ stripes_[i].lock };
+
+			auto old = stripes_[i].table.rehash(buckets + i * per_stripe, per_stripe);
+			if (i == 0)
+				old_buckets = old;
+		}
+
+		return old_buckets;
+	}
+
+	/// Number of elements. It's exact only if nothing modifies the table meanwhile.
+	[[nodiscard]] size_type size() const
+	{
+		size_type ret = 0;
+		for (auto& s:stripes_)
+		{
+			shared_lock_guard_type g{ s.lock };
+
+			ret += s.table.size();
+		}
+
+		return ret;
+	}
+
+	[[nodiscard]] bool empty() const
+	{
+		return size() == 0;
+	}
+
+	[[nodiscard]] size_type bucket_count() const
+	{
+		size_type ret = 0;
+		for (auto& s:stripes_)
+		{
+			shared_lock_guard_type g{ s.lock };
+
+			ret += s.table.bucket_count();
+		}
+
+		return ret;
+	}
+
+	[[nodiscard]] static constexpr size_type stripe_count()
+	{
+		return StripeCount;
+	}
+
+protected:
+	// exposes the helpers of intrusive_hash_table that take a hash computed beforehand, so picking the stripe
+	// and the bucket hashes the key only once. the lock of the stripe guards the table, whose own lock is
+	// the no_lock placeholder, taken here only for the thread safety analysis.
+	class stripe_table : public table_type
+	{
+	public:
+		using table_lock_guard_type = typename table_type::lock_guard_type;
+
+		stripe_table() = default;
+
+		void attach(bucket_type* buckets, size_type count)
+		{
+			table_lock_guard_type g{ this->lock_ };
+
+			this->attach_buckets(buckets, count);
+		}
+
+		bool insert_hashed(T* val, size_t hash)
+		{
+			table_lock_guard_type g{ this->lock_ };
+
+			return this->do_insert(val, hash);
+		}
+
+		bool remove_hashed(const TKey& key, size_t hash)
+		{
+			table_lock_guard_type g{ this->lock_ };
+
+			auto pos = this->find_position(key, hash);
+			if (*pos == nullptr)
+				return false;
+
+			this->erase_at(pos);
+			return true;
+		}
+
+		T* find_hashed(const TKey& key, size_t hash)
+		{
+			typename table_type::shared_lock_guard_type g{ this->lock_ };
+
+			auto node = *this->find_position(key, hash);
+			return node ? node->owner : nullptr;
+		}
+	};
+
+	struct alignas(CACHE_LINE_SIZE) stripe
+	{
+		mutable mutex_type lock{};
+
+		stripe_table table TA_GUARDED(lock){};
+	};
+
+	// count is at least StripeCount, so that each stripe gets a bucket of its own
+	static inline size_type buckets_per_stripe(size_type count)
+	{
+		return std::bit_floor(count) / StripeCount;
+	}
+
+	void attach_buckets(bucket_type* buckets, size_type count) TA_NO_THREAD_SAFETY_ANALYSIS
+	{
+		auto per_stripe = buckets_per_stripe(count);
+		for (size_type i = 0; i < StripeCount; i++)
+		{
+			stripes_[i].table.attach(buckets + i * per_stripe, per_stripe);
+		}
+	}
+
+	size_t hash_of(const TKey& key)
+	{
+		return static_cast<size_t>(hasher_(key));
+	}
+
+	// the tables pick buckets by the top bits of the hash times the golden ratio; a different multiplier
+	// keeps the choice of the stripe independent of them, so each stripe uses all of its buckets
+	stripe& stripe_of(size_t hash)
+	{
+		constexpr int shift = 64 - std::countr_zero(static_cast<uint64_t>(StripeCount));
+
+		auto index = ((static_cast<uint64_t>(hash) * 0xC2B2AE3D27D4EB4Full) >> (shift - 1)) >> 1;
+		return stripes_[index];
+	}
+
+	stripe stripes_[StripeCount]{};
+
+	THash hasher_{};
+};
+
+/// Link of split_ordered_hash_table
+template<typename TOwner>
+struct split_ordered_link
+{
+	TOwner* owner{ nullptr };
+
+	// successor in the split-ordered list. the lowest bit set marks this node as removed.
+	std::atomic<uintptr_t> next{ 0 };
+
+	// the hash with its bits reversed, odd for elements and even for the sentinels of the buckets
+	uint64_t so_key{ 0 };
+
+	// chains removed elements waiting to be deleted
+	split_ordered_link* retired_next{ nullptr };
+
+	[[nodiscard]] split_ordered_link() = default;
+
+	[[nodiscard]] explicit split_ordered_link(TOwner* o) : owner(o)
+	{
+	}
+};
+
+/// \brief Concurrent intrusive hash table built on split-ordered lists (Shalev and Shavit).
+/// All elements are in one lock-free list sorted by their bit-reversed hashes, so that the elements of a
+/// bucket are contiguous and doubling the buckets splits every bucket in place. A bucket is a sentinel
+/// node in the list, which the first modification of the bucket links in after the sentinel of its parent.
+/// Growing only doubles the bucket count, so it never pauses the table.
+/// Lookups take no lock and never write the list: they start at the nearest bucket that is ready and skip
+/// removed nodes, so they are wait-free. Insertions and removals are lock-free.
+///
+/// Readers are protected by epoch-based reclamation. Every operation announces the epoch it started in,
+/// and the epoch advances only when no operation of the two epochs before it is left. With
+/// CallDeleteOnRemoval, removed elements are handed to TDeleter once the epoch has advanced twice after
+/// they were unlinked. Otherwise, a removed element may be freed or inserted again only after
+/// synchronize() returns.
+/// The buckets beyond InitialBuckets are allocated by TAllocator in segments. If an allocation fails,
+/// the bucket is served by its parent, which is slower but correct.
+template<typename T, typename TKey,
+		TKey T::*Key,
+		auto T::*Link,
+		typename THash = std::hash<TKey>,
+		typename TEq = std::equal_to<TKey>,
+		bool CallDeleteOnRemoval = false,
+		typename TDeleter = default_deleter<T>,
+		typename TAllocator = default_allocator,
+		size_t InitialBuckets = 64,
+		size_t ReaderSlots = 16>
+class split_ordered_hash_table
+{
+public:
+	static_assert(std::has_single_bit(InitialBuckets), "InitialBuckets must be a power of two");
+
+	using value_type = T;
+	using size_type = size_t;
+	using link_type = std::remove_cvref_t<decltype(std::declval<T&>().*Link)>;
+
+	static constexpr size_t CACHE_LINE_SIZE = 64;
+
+	// average number of elements in a bucket before the buckets double
+	static constexpr size_type MAX_LOAD = 2;
+
+	static constexpr size_type MAX_BUCKETS_LOG = 40;
+
+public:
+	split_ordered_hash_table()
+	{
+		// the sentinel of bucket 0 heads the list
+		first_segment_[0].state.store(BUCKET_READY, std::memory_order_relaxed);
+		segments_[0].store(first_segment_, std::memory_order_relaxed);
+	}
+
+	explicit split_ordered_hash_table(const TAllocator& allocator)
+			: split_ordered_hash_table()
+	{
+		allocator_ = allocator;
+	}
+
+	split_ordered_hash_table(const split_ordered_hash_table&) = delete;
+
+	split_ordered_hash_table& operator=(const split_ordered_hash_table&) = delete;
+
+	/// Free the segments and delete the removed elements still waiting. The elements in the table are left alone.
+	~split_ordered_hash_table()
+	{
+		for (auto& limbo:limbo_)
+		{
+			dispose(limbo.exchange(nullptr));
+		}
+
+		for (size_type k = 1; k < SEGMENT_COUNT; k++)
+		{
+			if (auto segment = segments_[k].load(std::memory_order_relaxed))
+			{
+				std::destroy_n(segment, segment_size(k));
+				allocator_.deallocate(segment, segment_size(k) * sizeof(bucket_slot), alignof(bucket_slot));
+			}
+		}
+	}
+
+	/// Insert an element. Does nothing if an element with the same key exists.
+	/// \param val
+	/// \return false if an element with the same key exists
+	bool insert(T* val)
+	{
+		auto node = link_of(val);
+		auto mixed = mix(hasher_(val->*Key));
+
+		node->owner = val;
+		node->so_key = element_key(mixed);
+		node->retired_next = nullptr;
+
+		{
+			read_guard g{ *this };
+
+			auto start = writable_bucket(bucket_index(mixed));
+			for (;;)
+			{
+				auto pos = search(start, node->so_key, &(val->*Key));
+				if (pos.found)
+					return false;
+
+				node->next.store(to_word(pos.curr), std::memory_order_relaxed);
+
+				auto expected = to_word(pos.curr);
+				if (pos.prev->compare_exchange_strong(expected, to_word(node),
+						std::memory_order_release, std::memory_order_relaxed))
+					break;
+			}
+
+			auto count = count_.fetch_add(1, std::memory_order_relaxed) + 1;
+			auto buckets = bucket_count_.load(std::memory_order_relaxed);
+			if (count > buckets * MAX_LOAD && buckets < (size_type{ 1 } << MAX_BUCKETS_LOG))
+			{
+				// losing the race means someone else has doubled it
+				bucket_count_.compare_exchange_strong(buckets, buckets * 2, std::memory_order_relaxed);
+			}
+
+			prepare_buckets(PREPARE_BUDGET);
+		}
+
+		return true;
+	}
+
+	bool insert(T& val)
+	{
+		return insert(&val);
+	}
+
+	/// Remove an element of the table. Does nothing if it isn't in the table.
+	/// \param val
+	/// \return false if val isn't in the table
+	bool remove(T* val)
+	{
+		return do_remove(val->*Key, link_of(val));
+	}
+
+	bool remove(T& val)
+	{
+		return remove(&val);
+	}
+
+	/// Remove the element with the given key as if by remove()
+	/// \param key
+	/// \return false if there isn't one
+	bool remove_by_key(const TKey& key)
+	{
+		return do_remove(key, nullptr);
+	}
+
+	/// Find the element with the given key, without waiting for any other operation
+	/// \param key
+	/// \return pointer to the element, or nullptr if it doesn't exist. Unless CallDeleteOnRemoval,
+	/// the element stays valid until the caller frees it; otherwise, the pointer may only be
+	/// used while the element can't be removed concurrently, and visit() is the safe way.
+	T* find_ptr(const TKey& key)
+	{
+		read_guard g{ *this };
+
+		auto node = do_find(key);
+		return node ? node->owner : nullptr;
+	}
+
+	/// Call func on the element with the given key, which can't be deleted before func returns
+	/// even if it is removed concurrently.
+	/// \tparam TFunc callable with T&
+	/// \param key
+	/// \param func
+	/// \return false if there isn't such an element
+	template<typename TFunc>
+	bool visit(const TKey& key, TFunc&& func)
+	{
+		read_guard g{ *this };
+
+		auto node = do_find(key);
+		if (node == nullptr)
+			return false;
+
+		func(*node->owner);
+		return true;
+	}
+
+	bool contains(const TKey& key)
+	{
+		return find_ptr(key) != nullptr;
+	}
+
+	/// Call func on every element in the order of the list. Elements inserted or removed meanwhile
+	/// may or may not be visited.
+	/// \tparam TFunc callable with T&
+	/// \param func
+	template<typename TFunc>
+	void for_each(TFunc&& func)
+	{
+		read_guard g{ *this };
+
+		auto curr = to_node(first_segment_[0].sentinel.next.load(std::memory_order_acquire));
+		for (; curr; curr = to_node(curr->next.load(std::memory_order_acquire)))
+		{
+			if (curr->owner && !is_marked(curr->next.load(std::memory_order_acquire)))
+				func(*curr->owner);
+		}
+	}
+
+	/// Wait until every operation that started before the call has finished, so that elements removed
+	/// before it may be freed or inserted again. Mustn't be called from within func of for_each().
+	void synchronize()
+	{
+		auto target = epoch_.load() + 2;
+		while (epoch_.load() < target)
+		{
+			if (!try_advance())
+				std::this_thread::yield();
+		}
+	}
+
+	/// Advance the epoch if the readers allow, deleting the removed elements that no reader can reach.
+	/// Removals do it already, so it's for callers that would like to reclaim on an idle path.
+	void reclaim()
+	{
+		try_advance();
+	}
+
+	/// Number of elements. It's exact only if nothing modifies the table meanwhile.
+	[[nodiscard]] size_type size() const
+	{
+		return count_.load(std::memory_order_relaxed);
+	}
+
+	[[nodiscard]] bool empty() const
+	{
+		return size() == 0;
+	}
+
+	[[nodiscard]] size_type bucket_count() const
+	{
+		return bucket_count_.load(std::memory_order_relaxed);
+	}
+
+protected:
+	static constexpr uintptr_t MARK = 1;
+
+	static constexpr uint8_t BUCKET_EMPTY = 0;
+	static constexpr uint8_t BUCKET_LINKING = 1;
+	static constexpr uint8_t BUCKET_READY = 2;
+
+	static constexpr size_type INITIAL_LOG = std::countr_zero(InitialBuckets);
+
+	// after doubling to 2n buckets, it takes about n * MAX_LOAD insertions to double again,
+	// so preparing two buckets at each of them keeps up with the n new ones
+	static constexpr size_type PREPARE_BUDGET = 2;
+
+	// segment 0 holds the first InitialBuckets buckets, and segment k after it as many as all before it
+	static constexpr size_type SEGMENT_COUNT = MAX_BUCKETS_LOG - INITIAL_LOG + 1;
+
+	struct bucket_slot
+	{
+		link_type sentinel{};
+
+		// BUCKET_READY once the sentinel is in the list
+		std::atomic<uint8_t> state{ BUCKET_EMPTY };
+	};
+
+	// operations started in each epoch modulo 3, padded so that readers on different slots don't share lines
+	struct alignas(CACHE_LINE_SIZE) reader_slot
+	{
+		std::atomic<size_type> active[3]{};
+	};
+
+	class read_guard
+	{
+	public:
+		explicit read_guard(split_ordered_hash_table& table)
+				: slot_(&table.readers_[reader_slot_index()])
+		{
+			epoch_class_ = table.epoch_.load() % 3;
+			slot_->active[epoch_class_].fetch_add(1);
+		}
+
+		~read_guard()
+		{
+			slot_->active[epoch_class_].fetch_sub(1);
+		}
+
+		read_guard(const read_guard&) = delete;
+
+		read_guard& operator=(const read_guard&) = delete;
+
+	private:
+		reader_slot* slot_;
+		size_type epoch_class_;
+	};
+
+	struct position
+	{
+		std::atomic<uintptr_t>* prev;
+		link_type* curr;
+		bool found;
+	};
+
+	static inline link_type* link_of(T* val)
+	{
+		return &(val->*Link);
+	}
+
+	static inline const TKey& key_of(link_type* node)
+	{
+		return node->owner->*Key;
+	}
+
+	static inline link_type* to_node(uintptr_t word)
+	{
+		return reinterpret_cast<link_type*>(word & ~MARK);
+	}
+
+	static inline uintptr_t to_word(link_type* node)
+	{
+		return reinterpret_cast<uintptr_t>(node);
+	}
+
+	static inline bool is_marked(uintptr_t word)
+	{
+		return word & MARK;
+	}
+
+	static inline uint64_t reverse_bits(uint64_t v)
+	{
+		v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+		v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+		v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
+		return __builtin_bswap64(v);
+	}
+
+	// buckets are picked by the low bits, which the multiplication alone leaves weak
+	static inline uint64_t mix(size_t hash)
+	{
+		auto mixed = static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull;
+		return mixed ^ (mixed >> 32);
+	}
+
+	static inline uint64_t element_key(uint64_t mixed)
+	{
+		return reverse_bits(mixed) | 1;
+	}
+
+	static inline uint64_t sentinel_key(size_type bucket)
+	{
+		return reverse_bits(bucket);
+	}
+
+	// a bucket splits off its parent, which has the same index without the highest bit
+	static inline size_type parent_of(size_type bucket)
+	{
+		return bucket & ~std::bit_floor(bucket);
+	}
+
+	static inline size_type segment_size(size_type segment)
+	{
+		return segment == 0 ? InitialBuckets : InitialBuckets << (segment - 1);
+	}
+
+	static size_type reader_slot_index()
+	{
+		static std::atomic<size_type> next_index{ 0 };
+		thread_local size_type index = next_index.fetch_add(1, std::memory_order_relaxed) % ReaderSlots;
+		return index;
+	}
+
+	size_type bucket_index(uint64_t mixed) const
+	{
+		return static_cast<size_type>(mixed & (bucket_count_.load(std::memory_order_relaxed) - 1));
+	}
+
+	// the slot of the bucket, allocating its segment if allocate is set. nullptr if it isn't there.
+	bucket_slot* slot_of(size_type bucket, bool allocate)
+	{
+		size_type segment = 0, offset = bucket;
+		if (bucket >= InitialBuckets)
+		{
+			auto width = std::bit_width(bucket);
+			segment = width - INITIAL_LOG;
+			offset = bucket - (size_type{ 1 } << (width - 1));
+		}
+
+		auto slots = segments_[segment].load(std::memory_order_acquire);
+		if (slots == nullptr && allocate)
+		{
+			auto count = segment_size(segment);
+			auto memory = allocator_.allocate(count * sizeof(bucket_slot), alignof(bucket_slot));
+			if (memory == nullptr)
+				return nullptr;
+
+			auto fresh = static_cast<bucket_slot*>(memory);
+			std::uninitialized_default_construct_n(fresh, count);
+
+			if (segments_[segment].compare_exchange_strong(slots, fresh, std::memory_order_acq_rel))
+			{
+				slots = fresh;
+			}
+			else
+			{
+				std::destroy_n(fresh, count);
+				allocator_.deallocate(memory, count * sizeof(bucket_slot), alignof(bucket_slot));
+			}
+		}
+
+		return slots ? &slots[offset] : nullptr;
+	}
+
+	// the sentinel lookups of the bucket start from: its own if it's ready, otherwise the nearest ready ancestor's
+	link_type* readable_bucket(size_type bucket)
+	{
+		for (;; bucket = parent_of(bucket))
+		{
+			auto slot = slot_of(bucket, false);
+			if (slot && slot->state.load(std::memory_order_acquire) == BUCKET_READY)
+				return &slot->sentinel;
+		}
+	}
+
+	// like readable_bucket(), but links the sentinel of the bucket into the list first if nobody has.
+	// if another thread is linking it, or its segment can't be allocated, the parent serves instead.
+	link_type* writable_bucket(size_type bucket)
+	{
+		auto slot = slot_of(bucket, true);
+		if (slot && slot->state.load(std::memory_order_acquire) == BUCKET_READY)
+			return &slot->sentinel;
+
+		auto parent = writable_bucket(parent_of(bucket));
+		if (slot == nullptr)
+			return parent;
+
+		auto state = BUCKET_EMPTY;
+		if (!slot->state.compare_exchange_strong(state, BUCKET_LINKING, std::memory_order_acquire))
+			return state == BUCKET_READY ? &slot->sentinel : parent;
+
+		auto sentinel = &slot->sentinel;
+		sentinel->so_key = sentinel_key(bucket);
+		for (;;)
+		{
+			auto pos = search(parent, sentinel->so_key, nullptr);
+			sentinel->next.store(to_word(pos.curr), std::memory_order_relaxed);
+
+			auto expected = to_word(pos.curr);
+			if (pos.prev->compare_exchange_strong(expected, to_word(sentinel),
+					std::memory_order_release, std::memory_order_relaxed))
+				break;
+		}
+
+		slot->state.store(BUCKET_READY, std::memory_order_release);
+		return sentinel;
+	}
+
+	// link in the sentinels of up to budget buckets that nobody has used since they came to be.
+	// lookups don't link sentinels, so without this they'd keep starting from the parent buckets,
+	// each of them holding the elements of its children as well.
+	void prepare_buckets(size_type budget)
+	{
+		for (; budget; budget--)
+		{
+			auto bucket = prepared_.load(std::memory_order_relaxed);
+			if (bucket >= bucket_count_.load(std::memory_order_relaxed))
+				return;
+
+			if (prepared_.compare_exchange_strong(bucket, bucket + 1, std::memory_order_relaxed))
+				writable_bucket(bucket);
+		}
+	}
+
+	// find the first node from start on whose so_key is at least so_key, unlinking the removed nodes
+	// on the way. With a key, it's found if a node of the same so_key has an equal key; without one,
+	// a sentinel of the same so_key is.
+	position search(link_type* start, uint64_t so_key, const TKey* key)
+	{
+		for (;;)
+		{
+			auto prev = &start->next;
+			auto curr = to_node(prev->load(std::memory_order_acquire));
+			bool restart = false;
+
+			while (curr)
+			{
+				auto next = curr->next.load(std::memory_order_acquire);
+				if (is_marked(next))
+				{
+					auto expected = to_word(curr);
+					if (!prev->compare_exchange_strong(expected, next & ~MARK,
+							std::memory_order_acq_rel, std::memory_order_relaxed))
+					{
+						restart = true;
+						break;
+					}
+
+					retire(curr);
+					curr = to_node(next);
+					continue;
+				}
+
+				if (curr->so_key > so_key)
+					break;
+
+				if (curr->so_key == so_key && (key ? eq_(key_of(curr), *key) : curr->owner == nullptr))
+					return { prev, curr, true };
+
+				prev = &curr->next;
+				curr = to_node(next);
+			}
+
+			if (!restart)
+				return { prev, curr, false };
+		}
+	}
+
+	link_type* do_find(const TKey& key)
+	{
+		auto mixed = mix(hasher_(key));
+		auto so_key = element_key(mixed);
+
+		auto curr = to_node(readable_bucket(bucket_index(mixed))->next.load(std::memory_order_acquire));
+		for (; curr && curr->so_key <= so_key; curr = to_node(curr->next.load(std::memory_order_acquire)))
+		{
+			if (curr->so_key == so_key && !is_marked(curr->next.load(std::memory_order_acquire)) &&
+				eq_(key_of(curr), key))
+				return curr;
+		}
+
+		return nullptr;
+	}
+
+	// remove the element with the given key, only if it is node when node isn't nullptr
+	bool do_remove(const TKey& key, link_type* node)
+	{
+		auto mixed = mix(hasher_(key));
+		auto so_key = element_key(mixed);
+
+		bool removed = false;
+		{
+			read_guard g{ *this };
+
+			auto start = writable_bucket(bucket_index(mixed));
+			for (;;)
+			{
+				auto pos = search(start, so_key, &key);
+				if (!pos.found || (node && pos.curr != node))
+					break;
+
+				// marking the node removes it; whoever unlinks it afterwards retires it
+				auto next = pos.curr->next.load(std::memory_order_acquire);
+				if (is_marked(next) || !pos.curr->next.compare_exchange_strong(next, next | MARK,
+						std::memory_order_acq_rel, std::memory_order_relaxed))
+					continue;
+
+				count_.fetch_sub(1, std::memory_order_relaxed);
+
+				auto expected = to_word(pos.curr);
+				if (pos.prev->compare_exchange_strong(expected, next,
+						std::memory_order_acq_rel, std::memory_order_relaxed))
+					retire(pos.curr);
+				else
+					search(start, so_key, &key);
+
+				removed = true;
+				break;
+			}
+		}
+
+		if constexpr (CallDeleteOnRemoval)
+		{
+			if (removed)
+				try_advance();
+		}
+
+		return removed;
+	}
+
+	void retire(link_type* node)
+	{
+		if constexpr (CallDeleteOnRemoval)
+		{
+			auto& limbo = limbo_[epoch_.load() % 3];
+
+			auto head = limbo.load(std::memory_order_relaxed);
+			do
+			{
+				node->retired_next = head;
+			} while (!limbo.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+		}
+	}
+
+	void dispose(link_type* node)
+	{
+		while (node)
+		{
+			auto next = node->retired_next;
+			deleter_(node->owner);
+			node = next;
+		}
+	}
+
+	bool quiescent(size_type epoch_class) const
+	{
+		for (auto& slot:readers_)
+		{
+			if (slot.active[epoch_class].load() != 0)
+				return false;
+		}
+
+		return true;
+	}
+
+	// epoch e may become e + 1 once no operation of e - 1 or e - 2 is left. then nothing retired in
+	// e - 1 can be reached: it was unlinked before any of the remaining operations started.
+	bool try_advance()
+	{
+		bool expected = false;
+		if (!reclaiming_.compare_exchange_strong(expected, true, std::memory_order_acquire))
+			return false;
+
+		auto epoch = epoch_.load();
+		bool advanced = quiescent((epoch + 1) % 3) && quiescent((epoch + 2) % 3);
+		if (advanced)
+		{
+			epoch_.store(epoch + 1);
+
+			if constexpr (CallDeleteOnRemoval)
+			{
+				dispose(limbo_[(epoch + 2) % 3].exchange(nullptr, std::memory_order_acquire));
+			}
+		}
+
+		reclaiming_.store(false, std::memory_order_release);
+		return advanced;
+	}
+
+	bucket_slot first_segment_[InitialBuckets]{};
+	std::atomic<bucket_slot*> segments_[SEGMENT_COUNT]{};
+
+	std::atomic<size_type> bucket_count_{ InitialBuckets };
+	std::atomic<size_type> count_{ 0 };
+
+	// the buckets below it have been prepared by insertions
+	std::atomic<size_type> prepared_{ 1 };
+
+	reader_slot readers_[ReaderSlots]{};
+
+	std::atomic<size_type> epoch_{ 0 };
+	std::atomic<bool> reclaiming_{ false };
+
+	// removed elements waiting for deletion, by the epoch they were retired in modulo 3
+	std::atomic<link_type*> limbo_[3]{};
+
+	THash hasher_{};
+	TEq eq_{};
+	TDeleter deleter_{};
+	TAllocator allocator_{};
+};
+
+// control bytes of flat_hash_map: a full slot holds the 7 low bits of its hash (H2), the others have the top bit set
+enum class flat_hash_ctrl : int8_t
+{
+	EMPTY = -128,
+	DELETED = -2,
+};
+
+/// \brief A group of control bytes of flat_hash_map, matched all at once.
+/// Masks have a bit for each matching slot, which index() turns into the slot's offset in the group.
+struct flat_hash_group
+{
+#if defined(__SSE2__)
+	static constexpr size_t WIDTH = 16;
+	static constexpr int INDEX_SHIFT = 0;
+
+	using mask_type = uint32_t;
+
+	explicit flat_hash_group(const int8_t* ctrl)
+			: ctrl_(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl)))
+	{
+	}
+
+	[[nodiscard]] mask_type match(int8_t h2) const
+	{
+		return static_cast<mask_type>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl_)));
+	}
+
+	[[nodiscard]] mask_type match_empty() const
+	{
+		return match(static_cast<int8_t>(flat_hash_ctrl::EMPTY));
+	}
+
+	// both special values, and only they, have the sign bit set
+	[[nodiscard]] mask_type match_empty_or_deleted() const
+	{
+		return static_cast<mask_type>(_mm_movemask_epi8(ctrl_));
+	}
+
+	// the number of slots before the first match, and after the last one
+	static inline size_t leading_slots(mask_type mask)
+	{
+		return std::countr_zero(mask);
+	}
+
+	static inline size_t trailing_slots(mask_type mask)
+	{
+		return std::countl_zero(static_cast<uint16_t>(mask));
+	}
+
+	__m128i ctrl_;
+#else
+	// eight control bytes in a word, matched with the bit tricks of finding a zero byte.
+	// match() may report a false positive next to a true one, which comparing the keys filters out.
+	static constexpr size_t WIDTH = 8;
+	static constexpr int INDEX_SHIFT = 3;
+
+	using mask_type = uint64_t;
+
+	static constexpr uint64_t LSBS = 0x0101010101010101ull;
+	static constexpr uint64_t MSBS = 0x8080808080808080ull;
+
+	explicit flat_hash_group(const int8_t* ctrl)
+	{
+		__builtin_memcpy(&ctrl_, ctrl, sizeof(ctrl_));
+	}
+
+	[[nodiscard]] mask_type match(int8_t h2) const
+	{
+		auto x = ctrl_ ^ (LSBS * static_cast<uint8_t>(h2));
+		return (x - LSBS) & ~x & MSBS;
+	}
+
+	// EMPTY is the only value with the top bit set and the next one clear
+	[[nodiscard]] mask_type match_empty() const
+	{
+		return ctrl_ & ~(ctrl_ << 1) & MSBS;
+	}
+
+	[[nodiscard]] mask_type match_empty_or_deleted() const
+	{
+		return ctrl_ & MSBS;
+	}
+
+	static inline size_t leading_slots(mask_type mask)
+	{
+		return std::countr_zero(mask) >> INDEX_SHIFT;
+	}
+
+	static inline size_t trailing_slots(mask_type mask)
+	{
+		return std::countl_zero(mask) >> INDEX_SHIFT;
+	}
+
+	uint64_t ctrl_;
+#endif
+
+	// offset of the lowest match of mask in the group
+	static inline size_t index(mask_type mask)
+	{
+		return std::countr_zero(mask) >> INDEX_SHIFT;
+	}
+
+	// mask without its lowest match
+	static inline mask_type next(mask_type mask)
+	{
+		return mask & (mask - 1);
+	}
+};
+
+template<typename TMap>
+class flat_hash_map_iterator
+{
+public:
+	using value_type = typename TMap::value_type;
+	using size_type = size_t;
+
+	using dummy_type = int;
+
+	friend TMap;
+
+public:
+	flat_hash_map_iterator() = default;
+
+	explicit flat_hash_map_iterator(size_type index, TMap* map) : index_(index), map_(map)
+	{
+	}
+
+	value_type& operator*()
+	{
+		return map_->slots_[index_];
+	}
+
+	value_type* operator->()
+	{
+		return &map_->slots_[index_];
+	}
+
+	bool operator==(flat_hash_map_iterator const& other) const
+	{
+		return index_ == other.index_;
+	}
+
+	bool operator!=(flat_hash_map_iterator const& other) const
+	{
+		return !(*this == other);
+	}
+
+	flat_hash_map_iterator& operator++()
+	{
+		index_ = map_->next_full(index_ + 1);
+		return *this;
+	}
+
+	flat_hash_map_iterator operator++(dummy_type) noexcept
+	{
+		flat_hash_map_iterator rc(*this);
+		operator++();
+		return rc;
+	}
+
+private:
+	size_type index_{ 0 };
+	TMap* map_{ nullptr };
+};
+
+/// Swiss-table probing for flat_hash_map: control bytes holding 7 bits of the hash, matched a group at a time
+struct flat_hash_swiss_probing
+{
+	static constexpr bool robin_hood = false;
+};
+
+/// Robin Hood probing for flat_hash_map: linear probing in which every slot records its distance from
+/// the home slot of its element, and an element is placed before any element closer to its home.
+/// Probe lengths vary little, a lookup misses as soon as it meets an element closer to home than the key
+/// would be, and erasing shifts the following elements back instead of leaving a tombstone.
+struct flat_hash_robin_hood_probing
+{
+	static constexpr bool robin_hood = true;
+};
+
+/// Probe lengths of the elements of a flat_hash_map: the slots past the home slot with Robin Hood
+/// probing, the groups past the first one with Swiss-table probing
+struct flat_hash_probe_stats
+{
+	size_t max{ 0 };
+	double average{ 0.0 };
+};
+
+/// \brief Open-addressing hash map storing keys and values in one contiguous slot array, for the tables
+/// whose elements can't embed links. Unlike the other containers here it owns its elements.
+/// Each slot has a control byte holding 7 bits of the hash of its key, and a lookup matches a whole
+/// group of them at once with SSE2 (or 8 at a time in a word without it), so it compares keys only
+/// on a likely hit and usually finishes within one group, where chaining follows a pointer per element.
+/// The map holds up to 7/8 of its capacity. Erasing leaves a tombstone only if a probe may have passed
+/// the slot while its group was full; the tombstones go away when the map grows or is rebuilt.
+/// With flat_hash_robin_hood_probing as TProbing, the control bytes hold probe distances instead; see there.
+/// Inserting may move the elements, invalidating pointers and iterators to them.
+/// Memory comes from TAllocator, and insert() reports allocation failures instead of throwing.
+template<typename TKey,
+		typename TValue,
+		typename THash = std::hash<TKey>,
+		typename TEq = std::equal_to<TKey>,
+		typename TAllocator = default_allocator,
+		typename TProbing = flat_hash_swiss_probing>
+class flat_hash_map
+{
+public:
+	using key_type = TKey;
+	using mapped_type = TValue;
+	using value_type = std::pair<TKey, TValue>;
+	using size_type = size_t;
+	using iterator_type = flat_hash_map_iterator<flat_hash_map>;
+
+	template<typename>
+	friend
+	class flat_hash_map_iterator;
+
+	static constexpr size_type GROUP_WIDTH = flat_hash_group::WIDTH;
+
+	static constexpr bool robin_hood = TProbing::robin_hood;
+
+	// the smallest capacity, with room for a group past any slot
+	static constexpr size_type MIN_CAPACITY = 16;
+
+public:
+	flat_hash_map() = default;
+
+	explicit flat_hash_map(const TAllocator& allocator) : allocator_(allocator)
+	{
+	}
+
+	flat_hash_map(const flat_hash_map&) = delete;
+
+	flat_hash_map& operator=(const flat_hash_map&) = delete;
+
+	~flat_hash_map()
+	{
+		destroy_all();
+		free_arrays();
+	}
+
+	/// Insert a value for the key. Does nothing if the key exists.
+	/// \param key
+	/// \param value
+	/// \return pointer to the value of the key, and whether it was inserted. The pointer is nullptr if the
+	/// map had to grow but couldn't allocate, or with Robin Hood probing, if the key would be further
+	/// than MAX_DISTANCE from its home even after growing, which only a degenerate hash leads to.
+	template<typename TArg>
+	std::pair<TValue*, bool> insert(const TKey& key, TArg&& value)
+	{
+		if constexpr (robin_hood)
+		{
+			return robin_hood_insert(key, std::forward<TArg>(value));
+		}
+
+		auto hash = hash_of(key);
+		if (auto index = find_index(key, hash); index != NPOS)
+			return { &slots_[index].second, false };
+
+		if (growth_left_ == 0 && !rehash(next_capacity()))
+			return { nullptr, false };
+
+		auto index = find_insert_slot(hash);
+		if (ctrl_[index] == static_cast<int8_t>(flat_hash_ctrl::EMPTY))
+			growth_left_--;
+
+		set_ctrl(index, h2_of(hash));
+		new(&slots_[index]) value_type(key, std::forward<TArg>(value));
+		size_++;
+
+		return { &slots_[index].second, true };
+	}
+
+	/// Find the value of the key
+	/// \param key
+	/// \return pointer to the value, or nullptr if the key doesn't exist
+	TValue* find_ptr(const TKey& key)
+	{
+		auto index = find_index(key, hash_of(key));
+		return index == NPOS ? nullptr : &slots_[index].second;
+	}
+
+	iterator_type find(const TKey& key)
+	{
+		auto index = find_index(key, hash_of(key));
+		return index == NPOS ? end() : iterator_type{ index, this };
+	}
+
+	bool contains(const TKey& key)
+	{
+		return find_ptr(key) != nullptr;
+	}
+
+	/// Erase the key and its value
+	/// \param key
+	/// \return false if the key doesn't exist
+	bool erase(const TKey& key)
+	{
+		auto index = find_index(key, hash_of(key));
+		if (index == NPOS)
+			return false;
+
+		erase_at(index);
+		return true;
+	}
+
+	/// Erase the element of the iterator
+	/// \param iter
+	/// \return iterator to the next element. With Robin Hood probing, erasing shifts the following elements
+	/// back, so one at the start of the slots may come again when a run wraps around the end.
+	iterator_type erase(iterator_type iter)
+	{
+		erase_at(iter.index_);
+
+		if constexpr (robin_hood)
+		{
+			return iterator_type{ next_full(iter.index_), this };
+		}
+
+		return ++iter;
+	}
+
+	/// Erase everything, keeping the capacity
+	void clear()
+	{
+		destroy_all();
+
+		if (capacity_)
+		{
+			reset_ctrl();
+		}
+		size_ = 0;
+	}
+
+	/// Grow the map to hold count elements without growing again
+	/// \param count
+	/// \return false if it couldn't allocate
+	bool reserve(size_type count)
+	{
+		auto capacity = MIN_CAPACITY;
+		while (max_load(capacity) < count)
+			capacity *= 2;
+
+		return capacity <= capacity_ || rehash(capacity);
+	}
+
+	[[nodiscard]] size_type size() const
+	{
+		return size_;
+	}
+
+	[[nodiscard]] bool empty() const
+	{
+		return size_ == 0;
+	}
+
+	[[nodiscard]] size_type capacity() const
+	{
+		return capacity_;
+	}
+
+	[[nodiscard]] double load_factor() const
+	{
+		return capacity_ ? static_cast<double>(size_) / static_cast<double>(capacity_) : 0.0;
+	}
+
+	/// Longest and average probe of the elements, in O(capacity), for sizing the map
+	[[nodiscard]] flat_hash_probe_stats probe_stats() const
+	{
+		flat_hash_probe_stats stats{};
+
+		size_type total = 0;
+		for (size_type i = 0; i < capacity_; i++)
+		{
+			if (!is_full(ctrl_[i]))
+				continue;
+
+			auto length = robin_hood ? distance_at(i) - 1 : groups_before(i);
+			stats.max = std::max(stats.max, length);
+			total += length;
+		}
+
+		if (size_)
+		{
+			stats.average = static_cast<double>(total) / static_cast<double>(size_);
+		}
+
+		return stats;
+	}
+
+	iterator_type begin()
+	{
+		return iterator_type{ next_full(0), this };
+	}
+
+	iterator_type end()
+	{
+		return iterator_type{ capacity_, this };
+	}
+
+protected:
+	static constexpr size_type NPOS = static_cast<size_type>(-1);
+
+	// the largest distance from home a control byte records with Robin Hood probing, where 0 means empty
+	static constexpr size_type MAX_DISTANCE = UINT8_MAX;
+
+	static constexpr size_type CTRL_ALIGNMENT = 16;
+	static constexpr size_type SLOT_ALIGNMENT = std::max(CTRL_ALIGNMENT, alignof(value_type));
+
+	// control bytes of a map without capacity, so that lookups need no special case
+	static inline const int8_t empty_group[GROUP_WIDTH] = {
+			static_cast<int8_t>(flat_hash_ctrl::EMPTY), static_cast<int8_t>(flat_hash_ctrl::EMPTY),
+			static_cast<int8_t>(flat_hash_ctrl::EMPTY), static_cast<int8_t>(flat_hash_ctrl::EMPTY),
+			static_cast<int8_t>(flat_hash_ctrl::EMPTY), static_cast<int8_t>(flat_hash_ctrl::EMPTY),
+			static_cast<int8_t>(flat_hash_ctrl::EMPTY), static_cast<int8_t>(flat_hash_ctrl::EMPTY),
+#if defined(__SSE2__)
+			static_cast<int8_t>(flat_hash_ctrl::EMPTY), static_cast<int8_t>(flat_hash_ctrl::EMPTY),
+			static_cast<int8_t>(flat_hash_ctrl::EMPTY), static_cast<int8_t>(flat_hash_ctrl::EMPTY),
+			static_cast<int8_t>(flat_hash_ctrl::EMPTY), static_cast<int8_t>(flat_hash_ctrl::EMPTY),
+			static_cast<int8_t>(flat_hash_ctrl::EMPTY), static_cast<int8_t>(flat_hash_ctrl::EMPTY),
+#endif
+	};
+
+	static inline size_type max_load(size_type capacity)
+	{
+		return capacity - capacity / 8;
+	}
+
+	// fibonacci hashing: the top bits of the product depend on all bits of the hash. they pick the home
+	// slot, and the 7 bits below them go to the control byte. low bits would leave keys that differ only
+	// in their high bits, such as aligned pointers, piled up on a few slots.
+	size_t hash_of(const TKey& key) const
+	{
+		return static_cast<size_t>(static_cast<uint64_t>(hasher_(key)) * 0x9E3779B97F4A7C15ull);
+	}
+
+	size_type h1_of(size_t hash) const
+	{
+		return hash >> shift_;
+	}
+
+	int8_t h2_of(size_t hash) const
+	{
+		return static_cast<int8_t>((hash >> (shift_ - 7)) & 0x7F);
+	}
+
+	static inline bool is_full(int8_t ctrl)
+	{
+		return robin_hood ? ctrl != 0 : ctrl >= 0;
+	}
+
+	// slots are probed a group at a time, the groups visited in triangular steps,
+	// which reach every group of a power-of-two capacity
+	size_type find_index(const TKey& key, size_t hash) const
+	{
+		if constexpr (robin_hood)
+		{
+			auto pos = robin_hood_search(key, hash);
+			return pos.found ? pos.index : NPOS;
+		}
+
+		auto h2 = h2_of(hash);
+		auto pos = h1_of(hash) & mask_;
+
+		for (size_type step = GROUP_WIDTH;; step += GROUP_WIDTH)
+		{
+			flat_hash_group group{ ctrl_ + pos };
+			for (auto mask = group.match(h2); mask; mask = flat_hash_group::next(mask))
+			{
+				auto index = (pos + flat_hash_group::index(mask)) & mask_;
+				if (eq_(slots_[index].first, key))
+					return index;
+			}
+
+			if (group.match_empty())
+				return NPOS;
+
+			pos = (pos + step) & mask_;
+		}
+	}
+
+	// the number of groups the probe sequence of the element in slot index visits before the one holding it
+	size_type groups_before(size_type index) const
+	{
+		auto pos = h1_of(hash_of(slots_[index].first)) & mask_;
+
+		size_type groups = 0;
+		for (size_type step = GROUP_WIDTH; ((index - pos) & mask_) >= GROUP_WIDTH; step += GROUP_WIDTH)
+		{
+			pos = (pos + step) & mask_;
+			groups++;
+		}
+
+		return groups;
+	}
+
+	// the first empty or deleted slot of the probe sequence of hash. there's always one, as the map never fills up.
+	size_type find_insert_slot(size_t hash) const
+	{
+		auto pos = h1_of(hash) & mask_;
+
+		for (size_type step = GROUP_WIDTH;; step += GROUP_WIDTH)
+		{
+			flat_hash_group group{ ctrl_ + pos };
+			if (auto mask = group.match_empty_or_deleted())
+				return (pos + flat_hash_group::index(mask)) & mask_;
+
+			pos = (pos + step) & mask_;
+		}
+	}
+
+	// the first GROUP_WIDTH control bytes are repeated after the last one, so that a group read near the
+	// end sees the start of the array instead of running past it
+	void set_ctrl(size_type index, int8_t value)
+	{
+		ctrl_[index] = value;
+		if (index < GROUP_WIDTH)
+			ctrl_[capacity_ + index] = value;
+	}
+
+	void erase_at(size_type index)
+	{
+		slots_[index].~value_type();
+		size_--;
+
+		if constexpr (robin_hood)
+		{
+			robin_hood_shift_back(index);
+			return;
+		}
+
+		// if no group containing the slot has ever been full, no probe has passed it, so it can be empty again
+		auto before = (index - GROUP_WIDTH) & mask_;
+		auto empty_after = flat_hash_group{ ctrl_ + index }.match_empty();
+		auto empty_before = flat_hash_group{ ctrl_ + before }.match_empty();
+
+		bool never_full = empty_before && empty_after &&
+						  flat_hash_group::leading_slots(empty_after) + flat_hash_group::trailing_slots(empty_before) <
+						  GROUP_WIDTH;
+
+		if (never_full)
+		{
+			set_ctrl(index, static_cast<int8_t>(flat_hash_ctrl::EMPTY));
+			growth_left_++;
+		}
+		else
+		{
+			set_ctrl(index, static_cast<int8_t>(flat_hash_ctrl::DELETED));
+		}
+	}
+
+	// the next full slot from index on, capacity_ if there is none
+	size_type next_full(size_type index) const
+	{
+		while (index < capacity_ && !is_full(ctrl_[index]))
+			index++;
+
+		return index;
+	}
+
+	// out of room: grow if the elements take over 25/32 of the capacity, otherwise tombstones take much of it,
+	// and rebuilding at the same size drops them while leaving at least 3/32 of the capacity to insert into
+	size_type next_capacity() const
+	{
+		if (capacity_ == 0)
+			return MIN_CAPACITY;
+
+		return size_ * 32 > capacity_ * 25 ? capacity_ * 2 : capacity_;
+	}
+
+	static inline size_type slots_offset(size_type capacity)
+	{
+		return (capacity + GROUP_WIDTH + SLOT_ALIGNMENT - 1) / SLOT_ALIGNMENT * SLOT_ALIGNMENT;
+	}
+
+	static inline size_type allocation_size(size_type capacity)
+	{
+		return slots_offset(capacity) + capacity * sizeof(value_type);
+	}
+
+	void reset_ctrl()
+	{
+		auto empty = robin_hood ? 0 : static_cast<int8_t>(flat_hash_ctrl::EMPTY);
+		__builtin_memset(ctrl_, empty, capacity_ + GROUP_WIDTH);
+		growth_left_ = max_load(capacity_);
+	}
+
+	// move everything into new arrays of the given capacity
+	bool rehash(size_type capacity)
+	{
+		auto memory = static_cast<char*>(allocator_.allocate(allocation_size(capacity), SLOT_ALIGNMENT));
+		if (memory == nullptr)
+			return false;
+
+		auto old_ctrl = ctrl_;
+		auto old_slots = slots_;
+		auto old_capacity = capacity_;
+
+		ctrl_ = reinterpret_cast<int8_t*>(memory);
+		slots_ = reinterpret_cast<value_type*>(memory + slots_offset(capacity));
+		capacity_ = capacity;
+		mask_ = capacity - 1;
+		shift_ = 64 - std::countr_zero(static_cast<uint64_t>(capacity));
+		reset_ctrl();
+
+		for (size_type i = 0; i < old_capacity; i++)
+		{
+			if (!is_full(old_ctrl[i]))
+				continue;
+
+			auto hash = hash_of(old_slots[i].first);
+			if constexpr (robin_hood)
+			{
+				// doubling the capacity spreads every run of the old array over the new one, so no element
+				// ends up further from home than it was, and the distances still fit
+				auto pos = robin_hood_search(old_slots[i].first, hash);
+				robin_hood_make_room(pos.index);
+
+				set_distance(pos.index, pos.distance);
+				new(&slots_[pos.index]) value_type(std::move(old_slots[i]));
+			}
+			else
+			{
+				auto index = find_insert_slot(hash);
+
+				set_ctrl(index, h2_of(hash));
+				new(&slots_[index]) value_type(std::move(old_slots[i]));
+			}
+			old_slots[i].~value_type();
+		}
+		growth_left_ -= size_;
+
+		if (old_capacity)
+		{
+			allocator_.deallocate(old_ctrl, allocation_size(old_capacity), SLOT_ALIGNMENT);
+		}
+
+		return true;
+	}
+
+	// where a probe for key stopped: the slot holding it, or the slot it would take, and its distance
+	// from home there, counting the home slot as 1
+	struct robin_hood_position
+	{
+		size_type index;
+		size_type distance;
+		bool found;
+	};
+
+	size_type distance_at(size_type index) const
+	{
+		return static_cast<uint8_t>(ctrl_[index]);
+	}
+
+	void set_distance(size_type index, size_type distance)
+	{
+		ctrl_[index] = static_cast<int8_t>(static_cast<uint8_t>(distance));
+	}
+
+	// elements of a run are ordered by their home slots, so only those as far from home as the key can
+	// have an equal key, and meeting one closer to home (or an empty slot) ends the search
+	robin_hood_position robin_hood_search(const TKey& key, size_t hash) const
+	{
+		if (capacity_ == 0)
+			return { 0, 1, false };
+
+		auto index = h1_of(hash) & mask_;
+		for (size_type distance = 1;; distance++, index = (index + 1) & mask_)
+		{
+			auto current = distance_at(index);
+			if (current < distance)
+				return { index, distance, false };
+
+			if (current == distance && eq_(slots_[index].first, key))
+				return { index, distance, true };
+		}
+	}
+
+	// whether the elements from index up to the next empty slot can each move one slot further from home
+	bool robin_hood_can_shift(size_type index) const
+	{
+		for (; distance_at(index) != 0; index = (index + 1) & mask_)
+		{
+			if (distance_at(index) == MAX_DISTANCE)
+				return false;
+		}
+
+		return true;
+	}
+
+	// move the elements from index up to the next empty slot one slot forward, leaving index free
+	void robin_hood_make_room(size_type index)
+	{
+		auto last = index;
+		while (distance_at(last) != 0)
+			last = (last + 1) & mask_;
+
+		for (; last != index; last = (last - 1) & mask_)
+		{
+			auto prev = (last - 1) & mask_;
+
+			new(&slots_[last]) value_type(std::move(slots_[prev]));
+			slots_[prev].~value_type();
+			set_distance(last, distance_at(prev) + 1);
+		}
+	}
+
+	// backward-shift deletion: the elements after the freed slot move back one slot until one is at home
+	void robin_hood_shift_back(size_type index)
+	{
+		growth_left_++;
+
+		for (auto next = (index + 1) & mask_; distance_at(next) > 1; next = (next + 1) & mask_)
+		{
+			new(&slots_[index]) value_type(std::move(slots_[next]));
+			slots_[next].~value_type();
+			set_distance(index, distance_at(next) - 1);
+
+			index = next;
+		}
+
+		set_distance(index, 0);
+	}
+
+	template<typename TArg>
+	std::pair<TValue*, bool> robin_hood_insert(const TKey& key, TArg&& value)
+	{
+		auto hash = hash_of(key);
+		auto pos = robin_hood_search(key, hash);
+		if (pos.found)
+			return { &slots_[pos.index].second, false };
+
+		bool grown = false;
+		if (growth_left_ == 0)
+		{
+			if (!rehash(next_capacity()))
+				return { nullptr, false };
+
+			grown = true;
+			pos = robin_hood_search(key, hash);
+		}
+
+		// the key or an element after it would be too far from home, which growing once should fix
+		while (pos.distance > MAX_DISTANCE || !robin_hood_can_shift(pos.index))
+		{
+			if (grown || !rehash(capacity_ * 2))
+				return { nullptr, false };
+
+			grown = true;
+			pos = robin_hood_search(key, hash);
+		}
+
+		robin_hood_make_room(pos.index);
+		growth_left_--;
+
+		set_distance(pos.index, pos.distance);
+		new(&slots_[pos.index]) value_type(key, std::forward<TArg>(value));
+		size_++;
+
+		return { &slots_[pos.index].second, true };
+	}
+
+	void destroy_all()
+	{
+		if constexpr (!std::is_trivially_destructible_v<value_type>)
+		{
+			for (size_type i = 0; i < capacity_; i++)
+			{
+				if (is_full(ctrl_[i]))
+					slots_[i].~value_type();
+			}
+		}
+	}
+
+	void free_arrays()
+	{
+		if (capacity_)
+		{
+			allocator_.deallocate(ctrl_, allocation_size(capacity_), SLOT_ALIGNMENT);
+		}
+	}
+
+	int8_t* ctrl_{ const_cast<int8_t*>(empty_group) };
+	value_type* slots_{ nullptr };
+	size_type capacity_{ 0 };
+	size_type mask_{ 0 };
+	int shift_{ 57 };
+
+	size_type size_{ 0 };
+
+	// how many more elements fit before growing; erasing into tombstones doesn't give any back
+	size_type growth_left_{ 0 };
+
+	THash hasher_{};
+	TEq eq_{};
+	TAllocator allocator_{};
+};
+
+
+/// Result of cuckoo_hash_map::insert()
+enum class cuckoo_insert_status : uint8_t
+{
+	INSERTED,
+	EXISTS,
+	// no free slot in either bucket of the key, and no cuckoo path to one
+	FULL,
+};
+
+/// A value of cuckoo_hash_map, held in atomic words so that readers can copy it while a writer changes it
+/// and tell afterwards from the versions whether the copy is torn.
+template<typename T>
+struct cuckoo_hash_cell
+{
+	using word_type = std::conditional_t<sizeof(T) % sizeof(uint64_t) != 0 && sizeof(T) % sizeof(uint32_t) == 0,
+										 uint32_t, uint64_t>;
+
+	static constexpr size_t WORDS = (sizeof(T) + sizeof(word_type) - 1) / sizeof(word_type);
+
+	std::atomic<word_type> words[WORDS]{};
+
+	void store(const T& val)
+	{
+		word_type buf[WORDS]{};
+		memcpy(buf, &val, sizeof(T));
+
+		for (size_t i = 0; i < WORDS; i++)
+		{
+			words[i].store(buf[i], std::memory_order_relaxed);
+		}
+	}
+
+	T load() const
+	{
+		word_type buf[WORDS]{};
+		for (size_t i = 0; i < WORDS; i++)
+		{
+			buf[i] = words[i].load(std::memory_order_relaxed);
+		}
+
+		std::array<unsigned char, sizeof(T)> bytes{};
+		memcpy(bytes.data(), buf, sizeof(T));
+		return std::bit_cast<T>(bytes);
+	}
+};
+
+/// \brief Concurrent bucketized cuckoo hash map (MemC3, libcuckoo) for tables that must run nearly full.
+/// Every key has two buckets of SlotsPerBucket slots, and lives in one of them. The first bucket comes from
+/// the top bits of the hash, and the second from the first and an 8-bit tag of the hash, so that an element
+/// can be moved to its other bucket without hashing its key again. With 4 slots a bucket, random keys fill
+/// about 96% of the capacity before an insert fails; with 8, about 98%.
+///
+/// Each bucket has a version, odd while a writer holds the bucket. Lookups take no lock: they read the
+/// versions of both buckets, copy the slots, and start over if either version has changed meanwhile.
+/// Writers lock both buckets of the key. When both are full, insert() searches breadth-first for the
+/// shortest chain of elements that can each move to their other bucket, ending at a free slot, and
+/// moves them back to front, one locked pair of buckets at a time.
+///
+/// Keys and values are copied in and out, so they must be trivially copyable. The map doesn't grow by
+/// itself: reserve() sizes it, and insert() reports a full map instead.
+template<typename TKey,
+		typename TValue,
+		typename THash = std::hash<TKey>,
+		typename TEq = std::equal_to<TKey>,
+		typename TAllocator = default_allocator,
+		size_t SlotsPerBucket = 4>
+class cuckoo_hash_map
+{
+public:
+	using key_type = TKey;
+	using mapped_type = TValue;
+	using size_type = size_t;
+
+	static_assert(std::is_trivially_copyable_v<TKey> && std::is_trivially_copyable_v<TValue>,
+			"keys and values are copied word by word");
+	static_assert(SlotsPerBucket >= 4 && SlotsPerBucket <= 8, "SlotsPerBucket must be between 4 and 8");
+
+	static constexpr size_type SLOTS_PER_BUCKET = SlotsPerBucket;
+
+	// the load reserve() sizes the map for. it stays below the load at which inserts of random keys start
+	// to fail, and keeps the path searches short, which grow longer as the map fills up.
+	static constexpr double TARGET_LOAD = 0.9;
+
+	// the buckets a path search visits at most, which also bounds the elements an insert moves: 4 with
+	// 4 slots a bucket, and 3 with 8. fewer nodes give up on random keys at about 93% load instead of 96%.
+	static constexpr size_type MAX_SEARCH_NODES = 512;
+
+public:
+	cuckoo_hash_map() = default;
+
+	explicit cuckoo_hash_map(const TAllocator& allocator) : allocator_(allocator)
+	{
+	}
+
+	cuckoo_hash_map(const cuckoo_hash_map&) = delete;
+
+	cuckoo_hash_map& operator=(const cuckoo_hash_map&) = delete;
+
+	~cuckoo_hash_map()
+	{
+		free_buckets(buckets_, bucket_count_);
+	}
+
+	/// Insert a value for the key. Does nothing if the key exists.
+	/// \param key
+	/// \param value
+	/// \return whether it was inserted, or the key exists, or there is no room for it
+	cuckoo_insert_status insert(const TKey& key, const TValue& value)
+	{
+		if (bucket_count_ == 0)
+			return cuckoo_insert_status::FULL;
+
+		auto hash = hash_of(key);
+		auto tag = tag_of(hash);
+		auto first = index_of(hash), second = alternate_of(first, tag);
+
+		// a path may be spoiled by other writers before it is done, so it is searched again a few times
+		for (size_type attempt = 0; attempt < MAX_INSERT_ATTEMPTS; attempt++)
+		{
+			{
+				pair_lock_guard guard{ this, first, second };
+
+				if (slot_of(first, tag, key) != NPOS || slot_of(second, tag, key) != NPOS)
+					return cuckoo_insert_status::EXISTS;
+
+				for (auto index:{ first, second })
+				{
+					if (auto slot = free_slot_of(index); slot != NPOS)
+					{
+						fill(buckets_[index], slot, tag, key, value);
+						size_.fetch_add(1, std::memory_order_relaxed);
+						return cuckoo_insert_status::INSERTED;
+					}
+				}
+			}
+
+			path_node path[MAX_SEARCH_NODES];
+			size_type last = 0, slot = 0;
+			if (!search_path(first, second, path, last, slot))
+				return cuckoo_insert_status::FULL;
+
+			move_along(path, last, slot);
+		}
+
+		return cuckoo_insert_status::FULL;
+	}
+
+	/// Replace the value of the key
+	/// \param key
+	/// \param value
+	/// \return false if the key doesn't exist
+	bool assign(const TKey& key, const TValue& value)
+	{
+		if (bucket_count_ == 0)
+			return false;
+
+		auto hash = hash_of(key);
+		auto tag = tag_of(hash);
+		auto first = index_of(hash), second = alternate_of(first, tag);
+
+		pair_lock_guard guard{ this, first, second };
+		for (auto index:{ first, second })
+		{
+			if (auto slot = slot_of(index, tag, key); slot != NPOS)
+			{
+				buckets_[index].values[slot].store(value);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/// Copy the value of the key without taking a lock
+	/// \param key
+	/// \param value receives the value if the key exists
+	/// \return false if the key doesn't exist
+	bool find(const TKey& key, TValue& value) const
+	{
+		if (bucket_count_ == 0)
+			return false;
+
+		auto hash = hash_of(key);
+		auto tag = tag_of(hash);
+		auto first = index_of(hash), second = alternate_of(first, tag);
+		auto& b1 = buckets_[first];
+		auto& b2 = buckets_[second];
+
+		for (;;)
+		{
+			auto v1 = b1.version.load(std::memory_order_acquire);
+			auto v2 = b2.version.load(std::memory_order_acquire);
+			if ((v1 | v2) & 1)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			bool found = false;
+			for (auto index:{ first, second })
+			{
+				if (auto slot = slot_of(index, tag, key); slot != NPOS)
+				{
+					value = buckets_[index].values[slot].load();
+					found = true;
+					break;
+				}
+			}
+
+			// the copies are good if no writer has held either bucket since the versions were read
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (b1.version.load(std::memory_order_relaxed) == v1 && b2.version.load(std::memory_order_relaxed) == v2)
+				return found;
+		}
+	}
+
+	bool contains(const TKey& key) const
+	{
+		TValue value{};
+		return find(key, value);
+	}
+
+	/// Erase the key and its value
+	/// \param key
+	/// \return false if the key doesn't exist
+	bool erase(const TKey& key)
+	{
+		if (bucket_count_ == 0)
+			return false;
+
+		auto hash = hash_of(key);
+		auto tag = tag_of(hash);
+		auto first = index_of(hash), second = alternate_of(first, tag);
+
+		pair_lock_guard guard{ this, first, second };
+		for (auto index:{ first, second })
+		{
+			if (auto slot = slot_of(index, tag, key); slot != NPOS)
+			{
+				buckets_[index].tags[slot].store(0, std::memory_order_relaxed);
+				size_.fetch_sub(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/// Call func(key, value) for every element, holding one bucket at a time. An element that a concurrent
+	/// insert moves meanwhile may be missed or visited twice.
+	/// \param func
+	template<typename TFunc>
+	void for_each(TFunc&& func) const
+	{
+		for (size_type index = 0; index < bucket_count_; index++)
+		{
+			pair_lock_guard guard{ this, index, index };
+
+			auto& bucket = buckets_[index];
+			for (size_type slot = 0; slot < SLOTS_PER_BUCKET; slot++)
+			{
+				if (bucket.tags[slot].load(std::memory_order_relaxed))
+					func(bucket.keys[slot].load(), bucket.values[slot].load());
+			}
+		}
+	}
+
+	/// Size the map for count elements at a load of TARGET_LOAD at most, moving the elements it has.
+	/// Mustn't run concurrently with anything else on the map.
+	/// \param count
+	/// \return false if it couldn't allocate, or the elements didn't fit the new buckets, or count needs
+	/// more than 2^32 buckets
+	bool reserve(size_type count)
+	{
+		if (count > MAX_BUCKETS * SLOTS_PER_BUCKET)
+			return false;
+
+		auto slots = static_cast<size_type>(static_cast<double>(count) / TARGET_LOAD);
+		auto bucket_count = std::max(MIN_BUCKETS, std::bit_ceil((slots + SLOTS_PER_BUCKET - 1) / SLOTS_PER_BUCKET));
+		if (bucket_count <= bucket_count_)
+			return true;
+
+		if (bucket_count > MAX_BUCKETS)
+			return false;
+
+		auto memory = allocator_.allocate(bucket_count * sizeof(bucket_type), alignof(bucket_type));
+		if (memory == nullptr)
+			return false;
+
+		auto fresh = static_cast<bucket_type*>(memory);
+		std::uninitialized_default_construct_n(fresh, bucket_count);
+
+		auto old_buckets = buckets_;
+		auto old_count = bucket_count_;
+		auto old_size = size_.load(std::memory_order_relaxed);
+
+		set_buckets(fresh, bucket_count);
+		size_.store(0, std::memory_order_relaxed);
+
+		for (size_type index = 0; index < old_count; index++)
+		{
+			auto& bucket = old_buckets[index];
+			for (size_type slot = 0; slot < SLOTS_PER_BUCKET; slot++)
+			{
+				if (bucket.tags[slot].load(std::memory_order_relaxed) == 0)
+					continue;
+
+				if (insert(bucket.keys[slot].load(), bucket.values[slot].load()) != cuckoo_insert_status::INSERTED)
+				{
+					set_buckets(old_buckets, old_count);
+					size_.store(old_size, std::memory_order_relaxed);
+					free_buckets(fresh, bucket_count);
+					return false;
+				}
+			}
+		}
+
+		free_buckets(old_buckets, old_count);
+		return true;
+	}
+
+	[[nodiscard]] size_type size() const
+	{
+		return size_.load(std::memory_order_relaxed);
+	}
+
+	[[nodiscard]] bool empty() const
+	{
+		return size() == 0;
+	}
+
+	[[nodiscard]] size_type capacity() const
+	{
+		return bucket_count_ * SLOTS_PER_BUCKET;
+	}
+
+	[[nodiscard]] size_type bucket_count() const
+	{
+		return bucket_count_;
+	}
+
+	[[nodiscard]] double load_factor() const
+	{
+		return bucket_count_ ? static_cast<double>(size()) / static_cast<double>(capacity()) : 0.0;
+	}
+
+protected:
+	static constexpr size_type NPOS = static_cast<size_type>(-1);
+
+	static constexpr size_type CACHE_LINE_SIZE = 64;
+
+	// two buckets, so that every key has two distinct ones when its tag allows
+	static constexpr size_type MIN_BUCKETS = 2;
+
+	static constexpr size_type MAX_INSERT_ATTEMPTS = 8;
+
+	// the tags and the version share the first cache line of the bucket, which a miss usually doesn't leave
+	struct alignas(CACHE_LINE_SIZE) bucket_type
+	{
+		// odd while a writer holds the bucket, and advanced by two for every write
+		std::atomic<uint64_t> version{ 0 };
+
+		// 8 bits of the hash of the key in the slot, or 0 if the slot is free
+		std::atomic<uint8_t> tags[SLOTS_PER_BUCKET]{};
+
+		cuckoo_hash_cell<TKey> keys[SLOTS_PER_BUCKET]{};
+		cuckoo_hash_cell<TValue> values[SLOTS_PER_BUCKET]{};
+	};
+
+	// a bucket reached by the path search, and the slot of its parent whose element can move into it.
+	// 8 bytes, as the search keeps all of them on the stack.
+	struct path_node
+	{
+		uint32_t index;
+		uint16_t parent;
+		uint8_t slot;
+		uint8_t tag;
+	};
+
+	// the path search stores bucket indexes in 32 bits
+	static constexpr size_type MAX_BUCKETS = size_type{ 1 } << 32;
+
+	static constexpr uint16_t NO_PARENT = UINT16_MAX;
+
+	// holds one bucket, or two in the order of their indexes so that writers can't deadlock
+	class pair_lock_guard
+	{
+	public:
+		pair_lock_guard(const cuckoo_hash_map* map, size_type first, size_type second)
+				: low_(&map->buckets_[std::min(first, second)]), high_(&map->buckets_[std::max(first, second)])
+		{
+			lock(*low_);
+			if (high_ != low_)
+				lock(*high_);
+		}
+
+		pair_lock_guard(const pair_lock_guard&) = delete;
+
+		pair_lock_guard& operator=(const pair_lock_guard&) = delete;
+
+		~pair_lock_guard()
+		{
+			if (high_ != low_)
+				unlock(*high_);
+			unlock(*low_);
+		}
+
+	private:
+		static void lock(bucket_type& bucket)
+		{
+			for (;;)
+			{
+				auto version = bucket.version.load(std::memory_order_relaxed);
+				if (!(version & 1) &&
+					bucket.version.compare_exchange_weak(version, version + 1, std::memory_order_acquire))
+					break;
+
+				std::this_thread::yield();
+			}
+
+			// keeps the writes that follow from becoming visible before the odd version
+			std::atomic_thread_fence(std::memory_order_release);
+		}
+
+		static void unlock(bucket_type& bucket)
+		{
+			bucket.version.fetch_add(1, std::memory_order_release);
+		}
+
+		bucket_type* low_;
+		bucket_type* high_;
+	};
+
+	// fibonacci hashing: the top bits of the product pick the first bucket, and the 8 bits below them the tag
+	size_t hash_of(const TKey& key) const
+	{
+		return static_cast<size_t>(static_cast<uint64_t>(hasher_(key)) * 0x9E3779B97F4A7C15ull);
+	}
+
+	size_type index_of(size_t hash) const
+	{
+		return hash >> shift_;
+	}
+
+	uint8_t tag_of(size_t hash) const
+	{
+		auto tag = static_cast<uint8_t>(hash >> (shift_ - 8));
+		return tag ? tag : 1;
+	}
+
+	// the other bucket of an element in the bucket index. applying it twice gives index back.
+	size_type alternate_of(size_type index, uint8_t tag) const
+	{
+		return (index ^ (tag * 0x5BD1E995ull)) & mask_;
+	}
+
+	size_type slot_of(size_type index, uint8_t tag, const TKey& key) const
+	{
+		auto& bucket = buckets_[index];
+		for (size_type slot = 0; slot < SLOTS_PER_BUCKET; slot++)
+		{
+			if (bucket.tags[slot].load(std::memory_order_relaxed) == tag && eq_(bucket.keys[slot].load(), key))
+				return slot;
+		}
+
+		return NPOS;
+	}
+
+	size_type free_slot_of(size_type index) const
+	{
+		auto& bucket = buckets_[index];
+		for (size_type slot = 0; slot < SLOTS_PER_BUCKET; slot++)
+		{
+			if (bucket.tags[slot].load(std::memory_order_relaxed) == 0)
+				return slot;
+		}
+
+		return NPOS;
+	}
+
+	static void fill(bucket_type& bucket, size_type slot, uint8_t tag, const TKey& key, const TValue& value)
+	{
+		bucket.keys[slot].store(key);
+		bucket.values[slot].store(value);
+		bucket.tags[slot].store(tag, std::memory_order_relaxed);
+	}
+
+	// breadth-first search without locks from both buckets of a key to a bucket with a free slot, so that
+	// the path found is the shortest. it may be stale by the time it is followed, which move_along() checks.
+	// returns the node of the bucket with the free slot, and the slot.
+	bool search_path(size_type first, size_type second, path_node (&path)[MAX_SEARCH_NODES],
+			size_type& last, size_type& free_slot) const
+	{
+		size_type count = 0;
+		path[count++] = path_node{ static_cast<uint32_t>(first), NO_PARENT, 0, 0 };
+		if (second != first)
+		{
+			path[count++] = path_node{ static_cast<uint32_t>(second), NO_PARENT, 0, 0 };
+		}
+
+		for (size_type head = 0; head < count; head++)
+		{
+			auto node = path[head];
+			if (auto slot = free_slot_of(node.index); slot != NPOS)
+			{
+				last = head;
+				free_slot = slot;
+				return true;
+			}
+
+			auto& bucket = buckets_[node.index];
+			for (size_type slot = 0; slot < SLOTS_PER_BUCKET && count < MAX_SEARCH_NODES; slot++)
+			{
+				auto tag = bucket.tags[slot].load(std::memory_order_relaxed);
+				if (tag == 0)
+					continue;
+
+				path[count++] = path_node{ static_cast<uint32_t>(alternate_of(node.index, tag)),
+										   static_cast<uint16_t>(head), static_cast<uint8_t>(slot), tag };
+			}
+		}
+
+		return false;
+	}
+
+	// move the elements of the path one bucket on, from the free slot back, leaving a free slot in the
+	// first bucket of the path. an element is written to its new slot before it leaves the old one, and
+	// lookups check the versions of both buckets, so they find it all along.
+	// returns false if other writers have changed the path.
+	bool move_along(const path_node (&path)[MAX_SEARCH_NODES], size_type last, size_type free_slot)
+	{
+		for (auto node = last; path[node].parent != NO_PARENT; node = path[node].parent)
+		{
+			auto& step = path[node];
+			auto from = path[step.parent].index;
+
+			pair_lock_guard guard{ this, from, step.index };
+
+			auto& source = buckets_[from];
+			auto& target = buckets_[step.index];
+
+			// any element with the same tag has the same other bucket, so it can move as well
+			if (target.tags[free_slot].load(std::memory_order_relaxed) != 0 ||
+				source.tags[step.slot].load(std::memory_order_relaxed) != step.tag)
+				return false;
+
+			fill(target, free_slot, step.tag, source.keys[step.slot].load(), source.values[step.slot].load());
+			source.tags[step.slot].store(0, std::memory_order_relaxed);
+
+			free_slot = step.slot;
+		}
+
+		return true;
+	}
+
+	void set_buckets(bucket_type* buckets, size_type count)
+	{
+		buckets_ = buckets;
+		bucket_count_ = count;
+		mask_ = count ? count - 1 : 0;
+		shift_ = count ? 64 - std::countr_zero(static_cast<uint64_t>(count)) : 64;
+	}
+
+	void free_buckets(bucket_type* buckets, size_type count)
+	{
+		if (buckets)
+		{
+			std::destroy_n(buckets, count);
+			allocator_.deallocate(buckets, count * sizeof(bucket_type), alignof(bucket_type));
+		}
+	}
+
+	bucket_type* buckets_{ nullptr };
+	size_type bucket_count_{ 0 };
+	size_type mask_{ 0 };
+	int shift_{ 64 };
+
+	// alone on its cache line, away from the bucket pointer every operation reads
+	alignas(CACHE_LINE_SIZE) std::atomic<size_type> size_{ 0 };
+
+	THash hasher_{};
+	TEq eq_{};
+	TAllocator allocator_{};
+};
+
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "avl_tree.h"
+
+namespace kbl
+{
+
+/// Augmentation policy that keeps the greatest end point of the intervals in each subtree
+/// \tparam T
+/// \tparam End member holding the (exclusive) end point of the interval
+template<typename T, auto T::*End>
+struct avl_max_end_augment
+{
+	using summary_type = std::remove_cvref_t<decltype(std::declval<T&>().*End)>;
+
+	static summary_type summarize(const T& owner, const summary_type* left, const summary_type* right)
+	{
+		summary_type max_end = owner.*End;
+
+		if (left && max_end < *left)
+			max_end = *left;
+
+		if (right && max_end < *right)
+			max_end = *right;
+
+		return max_end;
+	}
+};
+
+template<typename T, auto T::*Start, auto T::*End>
+using interval_tree_link = avl_tree_link<T, Start, false, avl_max_end_augment<T, End>>;
+
+/// Interval tree of half-open intervals [Start, End), ordered by their start point.
+/// Intervals with the same start point count as duplicates.
+template<typename T, typename TPoint,
+		TPoint T::*Start,
+		TPoint T::*End,
+		auto T::*Link,
+		bool EnableLock = false,
+		bool CallDeleteOnRemoval = false,
+		typename TCmp= avl_default_comparer<TPoint>,
+		typename TDeleter=avl_default_deleter<T>,
+		typename TMutex = lock::shared_mutex>
+class interval_tree
+		: public avl_tree<T, TPoint, Start, Link, EnableLock, CallDeleteOnRemoval, TCmp, TDeleter, TMutex>
+{
+public:
+	using base_type = avl_tree<T, TPoint, Start, Link, EnableLock, CallDeleteOnRemoval, TCmp, TDeleter, TMutex>;
+	using link_type = typename base_type::link_type;
+	using iterator_type = typename base_type::iterator_type;
+	using shared_lock_guard_type = typename base_type::shared_lock_guard_type;
+
+	static_assert(std::is_same_v<typename link_type::augment_type, avl_max_end_augment<T, End>>,
+			"the link of an interval tree must keep the max end point, see interval_tree_link");
+
+public:
+	/// Find any interval overlapping [lo, hi) in O(log n)
+	/// \param lo
+	/// \param hi
+	/// \return iterator to the interval, or end() if none overlaps
+	iterator_type find_overlapping(const TPoint& lo, const TPoint& hi) TA_EXCL(this->lock_)
+	{
+		shared_lock_guard_type g{ this->lock_ };
+
+		auto node = this->root_;
+		while (node)
+		{
+			if (overlaps(node, lo, hi))
+				break;
+
+			// if something in the left subtree ends after lo without overlapping, it starts at or after hi,
+			// and so does everything to its right. so the left subtree is the only place to look.
+			if (node->left && lo < node->left->summary)
+				node = node->left;
+			else
+				node = node->right;
+		}
+
+		return this->iterator_of(node);
+	}
+
+	/// Call func on each interval overlapping [lo, hi) in key order, in O(min(n, (k + 1) log n)).
+	/// With EnableLock, func runs with the tree locked for reading and mustn't modify the tree.
+	/// \tparam TFunc callable with T&
+	/// \param lo
+	/// \param hi
+	/// \param func
+	template<typename TFunc>
+	void for_each_overlapping(const TPoint& lo, const TPoint& hi, TFunc&& func) TA_EXCL(this->lock_)
+	{
+		shared_lock_guard_type g{ this->lock_ };
+
+		for_each_overlapping(this->root_, lo, hi, func);
+	}
+
+private:
+	static inline bool overlaps(link_type* node, const TPoint& lo, const TPoint& hi)
+	{
+		auto owner = base_type::owner_of(node);
+		return owner->*Start < hi && lo < owner->*End;
+	}
+
+	template<typename TFunc>
+	static void for_each_overlapping(link_type* node, const TPoint& lo, const TPoint& hi, TFunc& func)
+	{
+		// nothing in the subtree ends after lo
+		if (node == nullptr || !(lo < node->summary))
+			return;
+
+		for_each_overlapping(node->left, lo, hi, func);
+
+		// this interval and those in the right subtree start too late
+		auto owner = base_type::owner_of(node);
+		if (!(owner->*Start < hi))
+			return;
+
+		if (lo < owner->*End)
+			func(*owner);
+
+		for_each_overlapping(node->right, lo, hi, func);
+	}
+};
+
+}
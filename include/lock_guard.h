@@ -66,6 +66,32 @@ public:
 	lock_guard(lock_guard const &) = delete;
 	lock_guard &operator=(lock_guard const &) = delete;
 
+private:
+	mutex_type *m;
+};
+
+/// \brief  RAII wrapper for holding a reader-writer lock for reading
+/// \tparam TMutex which provides lock_shared() and unlock_shared()
+template<typename TMutex>
+class TA_SCOPED_CAP shared_lock_guard //<TMutex>
+{
+public:
+	typedef TMutex mutex_type;
+
+	[[nodiscard]]explicit shared_lock_guard(mutex_type &_m) noexcept TA_ACQ_SHARED(_m)
+		: m(&_m)
+	{
+		m->lock_shared();
+	}
+
+	~shared_lock_guard() noexcept TA_REL()
+	{
+		m->unlock_shared();
+	}
+
+	shared_lock_guard(shared_lock_guard const &) = delete;
+	shared_lock_guard &operator=(shared_lock_guard const &) = delete;
+
 private:
 	mutex_type *m;
 };
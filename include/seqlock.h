@@ -0,0 +1,76 @@
+#pragma once
+
+#include "thread_annotations.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <shared_mutex>
+#include <thread>
+
+namespace lock
+{
+/// \brief Sequence lock. Writers serialize on a mutex and keep the sequence odd while writing.
+/// Optimistic readers write no shared memory: they read the sequence with read_begin(), read the data,
+/// and start over if read_retry() finds the sequence changed. The data must stay readable memory
+/// throughout, even if a writer frees it from the structure.
+/// Readers that can't retry, like iteration, use lock_shared(), which excludes writers but not other readers.
+class TA_CAP("mutex") seqlock
+{
+public:
+	using sequence_type = uint64_t;
+
+	void lock() noexcept TA_ACQ()
+	{
+		writer_.lock();
+
+		seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		// the odd sequence becomes visible before any write to the data
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void unlock() noexcept TA_REL()
+	{
+		seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+		writer_.unlock();
+	}
+
+	void lock_shared() noexcept TA_ACQ_SHARED()
+	{
+		writer_.lock_shared();
+	}
+
+	void unlock_shared() noexcept TA_REL_SHARED()
+	{
+		writer_.unlock_shared();
+	}
+
+	/// Start an optimistic read
+	/// \return the sequence to pass to read_retry()
+	[[nodiscard]] sequence_type read_begin() const noexcept
+	{
+		for (;;)
+		{
+			auto seq = seq_.load(std::memory_order_acquire);
+			if ((seq & 1) == 0)
+				return seq;
+
+			std::this_thread::yield();
+		}
+	}
+
+	/// Finish an optimistic read
+	/// \param seq returned by read_begin()
+	/// \return true if a writer may have interfered, so the data read must be discarded
+	[[nodiscard]] bool read_retry(sequence_type seq) const noexcept
+	{
+		// the reads of the data complete before the sequence is checked again
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return seq_.load(std::memory_order_relaxed) != seq;
+	}
+
+private:
+	std::shared_mutex writer_;
+	std::atomic<sequence_type> seq_{ 0 };
+};
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "thread_annotations.hpp"
+
+#include <shared_mutex>
+
+namespace lock
+{
+/// \brief std::shared_mutex declared as a capability, so that thread safety analysis checks the fields
+/// guarded by it. libstdc++ doesn't annotate its own.
+class TA_CAP("mutex") shared_mutex
+{
+public:
+	void lock() TA_ACQ()
+	{
+		mutex_.lock();
+	}
+
+	bool try_lock() TA_TRY_ACQ(true)
+	{
+		return mutex_.try_lock();
+	}
+
+	void unlock() TA_REL()
+	{
+		mutex_.unlock();
+	}
+
+	void lock_shared() TA_ACQ_SHARED()
+	{
+		mutex_.lock_shared();
+	}
+
+	void unlock_shared() TA_REL_SHARED()
+	{
+		mutex_.unlock_shared();
+	}
+
+private:
+	std::shared_mutex mutex_;
+};
+}
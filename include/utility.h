@@ -1,10 +1,62 @@
 #pragma once
 
+#include "thread_annotations.hpp"
+
 #include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <new>
 
 namespace kbl
 {
 
+/// Deletes the elements that containers created with CallDeleteOnRemoval remove
+template<typename T>
+struct default_deleter
+{
+	void operator()(T* ptr)
+	{
+		delete ptr;
+	}
+};
+
+/// Allocates the memory of containers that can't be embedded in the elements, like the nodes of btree.
+/// An allocator provides allocate(bytes, alignment), which returns nullptr on failure,
+/// and deallocate(ptr, bytes, alignment).
+struct default_allocator
+{
+	void* allocate(size_t bytes, size_t alignment)
+	{
+		return ::operator new(bytes, std::align_val_t{ alignment }, std::nothrow);
+	}
+
+	void deallocate(void* ptr, size_t, size_t alignment)
+	{
+		::operator delete(ptr, std::align_val_t{ alignment });
+	}
+};
+
+/// \brief Stands in for the lock of a container and its guards when its EnableLock is false.
+/// With EnableLock, operations on the container take an internal reader-writer lock of type TMutex:
+/// lookups and size() share it, modifications hold it exclusively. Iterators don't lock, since the element
+/// they are on may be removed between two steps, so a thread iterating must keep others from modifying
+/// the container, or use its for_each(), which holds the lock shared throughout.
+/// A capability all the same, so that the fields it guards are checked alike in both cases.
+struct TA_CAP("mutex") no_lock
+{
+};
+
+template<typename TMutex>
+struct TA_SCOPED_CAP no_lock_guard
+{
+	explicit no_lock_guard([[maybe_unused]] TMutex& m) TA_ACQ(m)
+	{
+	}
+
+	~no_lock_guard() TA_REL()
+	{
+	}
+};
 
 
 template<typename T>
@@ -13,6 +65,17 @@ using less = std::less<T>;
 template<typename T>
 using greater = std::greater<T>;
 
+/// \brief fork-join executor that runs both branches one after the other on the calling thread
+struct sequential_executor
+{
+	template<typename F1, typename F2>
+	void fork_join(F1&& f1, F2&& f2)
+	{
+		f1();
+		f2();
+	}
+};
+
 template<typename TIter>
 class reversed_iterator
 {
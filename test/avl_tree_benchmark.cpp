@@ -0,0 +1,563 @@
+#include <gtest/gtest.h>
+
+#include <avl_tree.h>
+#include <fork_join_pool.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <numeric>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace kbl;
+using namespace std;
+
+class avl_bench_class
+{
+public:
+	avl_bench_class() = default;
+
+	explicit avl_bench_class(int v) : value(v)
+	{
+	}
+
+	int value{ 0 };
+
+	avl_tree_link<avl_bench_class, &avl_bench_class::value> link{ this };
+
+	using tree_type = avl_tree<avl_bench_class, decltype(value), &avl_bench_class::value, &avl_bench_class::link>;
+};
+
+class avl_compact_bench_class
+{
+public:
+	int value{ 0 };
+
+	avl_tree_compact_link<avl_compact_bench_class, &avl_compact_bench_class::value> link{ this };
+
+	using tree_type = avl_tree<avl_compact_bench_class,
+							   decltype(value),
+							   &avl_compact_bench_class::value,
+							   &avl_compact_bench_class::link>;
+};
+
+class avl_weak_bench_class
+{
+public:
+	int value{ 0 };
+
+	avl_tree_link<avl_weak_bench_class, &avl_weak_bench_class::value, false, avl_no_augment, false, avl_weak_balance>
+			link{ this };
+
+	using tree_type = avl_tree<avl_weak_bench_class,
+							   decltype(value),
+							   &avl_weak_bench_class::value,
+							   &avl_weak_bench_class::link>;
+};
+
+class avl_threaded_bench_class
+{
+public:
+	int value{ 0 };
+
+	avl_tree_link<avl_threaded_bench_class, &avl_threaded_bench_class::value, false, avl_no_augment, true> link{ this };
+
+	using tree_type = avl_tree<avl_threaded_bench_class,
+							   decltype(value),
+							   &avl_threaded_bench_class::value,
+							   &avl_threaded_bench_class::link>;
+};
+
+class avl_locked_bench_class
+{
+public:
+	int value{ 0 };
+
+	avl_tree_link<avl_locked_bench_class, &avl_locked_bench_class::value> link{ this };
+
+	using tree_type = avl_tree<avl_locked_bench_class,
+							   decltype(value),
+							   &avl_locked_bench_class::value,
+							   &avl_locked_bench_class::link,
+							   true>;
+};
+
+class avl_seqlock_bench_class
+{
+public:
+	int value{ 0 };
+
+	avl_tree_link<avl_seqlock_bench_class, &avl_seqlock_bench_class::value> link{ this };
+
+	using tree_type = avl_tree<avl_seqlock_bench_class,
+							   decltype(value),
+							   &avl_seqlock_bench_class::value,
+							   &avl_seqlock_bench_class::link,
+							   true,
+							   false,
+							   avl_default_comparer<int>,
+							   avl_default_deleter<avl_seqlock_bench_class>,
+							   lock::seqlock>;
+};
+
+template<typename TFunc>
+static double measure_ms(TFunc&& func)
+{
+	auto start = chrono::steady_clock::now();
+	func();
+	auto end = chrono::steady_clock::now();
+	return chrono::duration<double, milli>(end - start).count();
+}
+
+static void report(const char* name, size_t ops, double ms)
+{
+	printf("%-40s %10zu ops %10.2f ms %10.2f Mops/s\n", name, ops, ms, ops / ms / 1000.0);
+}
+
+// keep the compiler from dropping lookups whose result isn't used
+template<typename T>
+static void benchmark_sink(T* ptr)
+{
+	asm volatile("" : : "r"(ptr) : "memory");
+}
+
+// threads look up random keys, and change the tree in write_percent of the operations.
+// the even keys stay in the tree, each thread inserts and removes its own share of the odd ones.
+template<typename TItem>
+static void read_mostly_run(const char* name, vector<TItem>& items, size_t threads, unsigned write_percent)
+{
+	constexpr size_t OPS_PER_THREAD = 1 << 18;
+
+	typename TItem::tree_type tree;
+	for (size_t i = 0; i < items.size(); i += 2)
+	{
+		tree.insert(items[i]);
+	}
+
+	auto shares = items.size() / 2 / threads;
+
+	vector<std::thread> workers;
+	auto ms = measure_ms([&]
+	{
+		for (size_t t = 0; t < threads; t++)
+		{
+			workers.emplace_back([&, t]
+			{
+				mt19937 rng(static_cast<unsigned>(t));
+				for (size_t op = 0; op < OPS_PER_THREAD; op++)
+				{
+					if (rng() % 100 < write_percent)
+					{
+						auto index = ((rng() % shares) * threads + t) * 2 + 1;
+						if (tree.find_ptr(static_cast<int>(index)))
+							tree.remove(items[index]);
+						else
+							tree.insert(items[index]);
+					}
+					else
+					{
+						benchmark_sink(tree.find_ptr(static_cast<int>(rng() % items.size())));
+					}
+				}
+			});
+		}
+
+		for (auto& worker:workers)
+		{
+			worker.join();
+		}
+	});
+
+	char title[96]{};
+	snprintf(title, sizeof(title), "%s (%zu threads, %u%% writes)", name, threads, write_percent);
+	report(title, OPS_PER_THREAD * threads, ms);
+
+	tree.clear();
+}
+
+class AVLTreeBenchmark : public testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		items.resize(COUNT);
+		keys.resize(COUNT);
+		iota(keys.begin(), keys.end(), 0);
+		shuffle(keys.begin(), keys.end(), mt19937{ 20011204 });
+
+		for (size_t i = 0; i < COUNT; i++)
+		{
+			items[i].value = keys[i];
+		}
+	}
+
+	static constexpr size_t COUNT = 1 << 20;
+
+	vector<avl_bench_class> items;
+	vector<int> keys;
+};
+
+TEST_F(AVLTreeBenchmark, InsertRemove)
+{
+	{
+		avl_bench_class::tree_type tree;
+
+		report("avl_tree insert (random)", COUNT, measure_ms([&]
+		{
+			for (auto& item:items)
+				tree.insert(item);
+		}));
+		EXPECT_EQ(tree.size(), COUNT);
+
+		report("avl_tree remove (random)", COUNT, measure_ms([&]
+		{
+			for (auto& item:items)
+				tree.remove(item);
+		}));
+		EXPECT_TRUE(tree.empty());
+	}
+
+	{
+		set<int> tree;
+
+		report("std::set insert (random)", COUNT, measure_ms([&]
+		{
+			for (auto key:keys)
+				tree.insert(key);
+		}));
+
+		report("std::set erase (random)", COUNT, measure_ms([&]
+		{
+			for (auto key:keys)
+				tree.erase(key);
+		}));
+	}
+}
+
+TEST_F(AVLTreeBenchmark, SetOperations)
+{
+	vector<avl_bench_class> others(COUNT);
+	for (size_t i = 0; i < COUNT; i++)
+	{
+		others[i].value = static_cast<int>(2 * i); // half of them overlap with items
+	}
+
+	auto run = [&](const char* name, auto&& executor)
+	{
+		avl_bench_class::tree_type a, b;
+		for (auto& item:items)
+			a.insert(item);
+		for (auto& item:others)
+			b.insert(item);
+
+		report(name, COUNT, measure_ms([&]
+		{
+			a.unite(b, executor);
+		}));
+		EXPECT_EQ(a.size(), COUNT + COUNT / 2);
+
+		a.clear();
+		b.clear();
+	};
+
+	run("avl_tree unite (sequential)", sequential_executor{});
+
+	for (size_t workers:{ 1, 3, 7 })
+	{
+		fork_join_pool pool{ workers };
+
+		char name[64]{};
+		snprintf(name, sizeof(name), "avl_tree unite (%zu threads)", workers + 1);
+		run(name, pool);
+	}
+}
+
+TEST_F(AVLTreeBenchmark, BuildFromSorted)
+{
+	// links point back to their owners, so sort pointers rather than the items themselves
+	vector<avl_bench_class*> sorted(COUNT);
+	for (size_t i = 0; i < COUNT; i++)
+	{
+		sorted[keys[i]] = &items[i];
+	}
+
+	{
+		avl_bench_class::tree_type tree;
+		report("avl_tree insert (sorted)", COUNT, measure_ms([&]
+		{
+			for (auto item:sorted)
+				tree.insert(item);
+		}));
+		EXPECT_EQ(tree.size(), COUNT);
+		tree.clear();
+	}
+
+	{
+		avl_bench_class::tree_type tree;
+		report("avl_tree build_from_sorted", COUNT, measure_ms([&]
+		{
+			tree.build_from_sorted(sorted.begin(), sorted.end());
+		}));
+		EXPECT_EQ(tree.size(), COUNT);
+		tree.clear();
+	}
+}
+
+TEST_F(AVLTreeBenchmark, CompactLink)
+{
+	auto run = [&](const char* name, auto& nodes)
+	{
+		using tree_type = typename std::remove_reference_t<decltype(nodes[0])>::tree_type;
+
+		printf("%s: %zu bytes per node\n", name, sizeof(nodes[0]));
+
+		tree_type tree;
+		for (auto& node:nodes)
+			tree.insert(node);
+
+		vector<int> lookups(keys);
+		shuffle(lookups.begin(), lookups.end(), mt19937{ 1919810 });
+
+		size_t found = 0;
+		report(name, COUNT, measure_ms([&]
+		{
+			for (auto key:lookups)
+				found += tree.find_ptr(key) != nullptr;
+		}));
+		EXPECT_EQ(found, COUNT);
+
+		tree.clear();
+	};
+
+	run("avl_tree_link find (random)", items);
+
+	vector<avl_compact_bench_class> compact_items(COUNT);
+	for (size_t i = 0; i < COUNT; i++)
+	{
+		compact_items[i].value = keys[i];
+	}
+
+	run("avl_tree_compact_link find (random)", compact_items);
+}
+
+TEST_F(AVLTreeBenchmark, HintedInsert)
+{
+	vector<avl_bench_class*> sorted(COUNT);
+	for (size_t i = 0; i < COUNT; i++)
+	{
+		sorted[keys[i]] = &items[i];
+	}
+
+	{
+		avl_bench_class::tree_type tree;
+		report("avl_tree insert (sorted)", COUNT, measure_ms([&]
+		{
+			for (auto item:sorted)
+				tree.insert(item);
+		}));
+		EXPECT_EQ(tree.size(), COUNT);
+		tree.clear();
+	}
+
+	{
+		avl_bench_class::tree_type tree;
+		report("avl_tree push_back_max (sorted)", COUNT, measure_ms([&]
+		{
+			for (auto item:sorted)
+				tree.push_back_max(item);
+		}));
+		EXPECT_EQ(tree.size(), COUNT);
+		tree.clear();
+	}
+
+	{
+		// descending keys, each hinted before the previous one
+		avl_bench_class::tree_type tree;
+		report("avl_tree insert with hint (descending)", COUNT, measure_ms([&]
+		{
+			auto hint = tree.end();
+			for (auto iter = sorted.rbegin(); iter != sorted.rend(); ++iter)
+				hint = tree.insert(hint, *iter);
+		}));
+		EXPECT_EQ(tree.size(), COUNT);
+		tree.clear();
+	}
+}
+
+TEST_F(AVLTreeBenchmark, ThreadedScan)
+{
+	constexpr size_t ROUNDS = 4;
+
+	auto run = [&](const char* name, auto& nodes)
+	{
+		using tree_type = typename std::remove_reference_t<decltype(nodes[0])>::tree_type;
+
+		tree_type tree;
+		for (auto& node:nodes)
+			tree.insert(node);
+
+		long long sum = 0;
+		report(name, COUNT * ROUNDS, measure_ms([&]
+		{
+			for (size_t round = 0; round < ROUNDS; round++)
+			{
+				for (auto& node:tree)
+					sum += node.value;
+			}
+		}));
+		EXPECT_EQ(sum, static_cast<long long>(COUNT) * (COUNT - 1) / 2 * ROUNDS);
+
+		tree.clear();
+	};
+
+	run("avl_tree full scan", items);
+
+	vector<avl_threaded_bench_class> threaded_items(COUNT);
+	for (size_t i = 0; i < COUNT; i++)
+	{
+		threaded_items[i].value = keys[i];
+	}
+
+	run("avl_tree full scan (threaded)", threaded_items);
+}
+
+TEST_F(AVLTreeBenchmark, ReadMostlyLocked)
+{
+	vector<avl_locked_bench_class> locked_items(COUNT);
+	for (size_t i = 0; i < COUNT; i++)
+	{
+		locked_items[i].value = static_cast<int>(i);
+	}
+
+	for (size_t threads:{ 1, 2, 4, 8 })
+	{
+		read_mostly_run("avl_tree rwlock", locked_items, threads, 5);
+	}
+}
+
+TEST_F(AVLTreeBenchmark, ReadMostlySeqlock)
+{
+	vector<avl_locked_bench_class> locked_items(COUNT);
+	vector<avl_seqlock_bench_class> seqlock_items(COUNT);
+	for (size_t i = 0; i < COUNT; i++)
+	{
+		locked_items[i].value = static_cast<int>(i);
+		seqlock_items[i].value = static_cast<int>(i);
+	}
+
+	for (unsigned write_percent:{ 1, 5, 20 })
+	{
+		for (size_t threads:{ 1, 4 })
+		{
+			read_mostly_run("avl_tree rwlock", locked_items, threads, write_percent);
+			read_mostly_run("avl_tree seqlock", seqlock_items, threads, write_percent);
+		}
+	}
+}
+
+TEST_F(AVLTreeBenchmark, BalancingPolicies)
+{
+	constexpr size_t OPS = COUNT * 2;
+
+	// half of the keys stay in the tree, then operations are drawn from the given mix
+	auto run = [&](const char* name, auto& nodes, unsigned insert_percent, unsigned remove_percent)
+	{
+		using tree_type = typename std::remove_reference_t<decltype(nodes[0])>::tree_type;
+
+		tree_type tree;
+		for (size_t i = 0; i < COUNT; i += 2)
+			tree.insert(nodes[i]);
+
+		mt19937 rng{ 8 };
+		size_t found = 0;
+		auto ms = measure_ms([&]
+		{
+			for (size_t op = 0; op < OPS; op++)
+			{
+				auto dice = rng() % 100;
+				auto& node = nodes[rng() % COUNT];
+				if (dice < insert_percent)
+					tree.insert(node);
+				else if (dice < insert_percent + remove_percent)
+					tree.remove(node);
+				else
+					found += tree.find_ptr(node.value) != nullptr;
+			}
+		});
+		benchmark_sink(&found);
+
+		char title[96]{};
+		snprintf(title, sizeof(title), "%s (%u%% insert, %u%% remove)", name, insert_percent, remove_percent);
+		report(title, OPS, ms);
+
+		tree.clear();
+	};
+
+	vector<avl_weak_bench_class> weak_items(COUNT);
+	for (size_t i = 0; i < COUNT; i++)
+	{
+		weak_items[i].value = keys[i];
+	}
+
+	for (auto[insert_percent, remove_percent]:{ pair{ 10u, 10u }, pair{ 25u, 50u }, pair{ 50u, 50u } })
+	{
+		run("avl_tree AVL", items, insert_percent, remove_percent);
+		run("avl_tree WAVL", weak_items, insert_percent, remove_percent);
+	}
+}
+
+TEST_F(AVLTreeBenchmark, FingerSearch)
+{
+	constexpr size_t STEPS = 1 << 21;
+
+	avl_bench_class::tree_type tree;
+	for (auto& item:items)
+		tree.insert(item);
+
+	// a random walk over the keys, with steps of up to max_step in either direction
+	auto run = [&](size_t max_step)
+	{
+		vector<int> trace(STEPS);
+		mt19937 rng{ 4 };
+		long long key = COUNT / 2;
+		for (auto& k:trace)
+		{
+			key += static_cast<long long>(rng() % (2 * max_step + 1)) - static_cast<long long>(max_step);
+			key = std::clamp<long long>(key, 0, COUNT - 1);
+			k = static_cast<int>(key);
+		}
+
+		long long sum_root = 0, sum_finger = 0;
+
+		char title[96]{};
+		snprintf(title, sizeof(title), "avl_tree lower_bound (step %zu)", max_step);
+		report(title, STEPS, measure_ms([&]
+		{
+			for (auto k:trace)
+				sum_root += tree.lower_bound(k)->value;
+		}));
+
+		snprintf(title, sizeof(title), "avl_tree lower_bound_from (step %zu)", max_step);
+		report(title, STEPS, measure_ms([&]
+		{
+			auto finger = tree.begin();
+			for (auto k:trace)
+			{
+				finger = tree.lower_bound_from(finger, k);
+				sum_finger += finger->value;
+			}
+		}));
+
+		EXPECT_EQ(sum_root, sum_finger);
+	};
+
+	for (size_t max_step:{ 4, 64, 4096 })
+	{
+		run(max_step);
+	}
+
+	tree.clear();
+}
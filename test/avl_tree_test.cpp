@@ -1,8 +1,17 @@
 #include <gtest/gtest.h>
 
 #include <avl_tree.h>
+#include <fork_join_pool.h>
 
 #include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 using namespace kbl;
 using namespace std;
@@ -100,6 +109,33 @@ TEST_F(AVLTreeSingleTestFixture, Clear)
 	EXPECT_EQ(tree.empty(), true);
 }
 
+TEST_F(AVLTreeSingleTestFixture, ClearAndDispose)
+{
+	// disposed elements can go straight into another tree
+	avl_test_class::tree_type another;
+
+	size_t disposed = 0;
+	tree.clear_and_dispose([&](avl_test_class* item)
+	{
+		another.insert(item);
+		disposed++;
+	});
+
+	EXPECT_EQ(disposed, SRC_SIZE);
+	EXPECT_TRUE(tree.empty());
+	EXPECT_EQ(tree.begin(), tree.end());
+
+	EXPECT_EQ(another.size(), SRC_SIZE);
+
+	size_t i = 0;
+	for (auto& item:another)
+	{
+		EXPECT_EQ(item.value, sorted_src[i++]);
+	}
+
+	another.clear();
+}
+
 TEST_F(AVLTreeSingleTestFixture, SequentialTraversal)
 {
 	{
@@ -147,4 +183,1273 @@ TEST_F(AVLTreeSingleTestFixture, SequentialTraversalWithIterators)
 			EXPECT_EQ(iter->value, sorted_src[counter--]);
 		}
 	}
-}
\ No newline at end of file
+}
+
+TEST_F(AVLTreeSingleTestFixture, Find)
+{
+	for (auto v:src)
+	{
+		auto ptr = tree.find_ptr(v);
+		ASSERT_NE(ptr, nullptr);
+		EXPECT_EQ(ptr->value, v);
+
+		auto iter = tree.find(v);
+		ASSERT_NE(iter, tree.end());
+		EXPECT_EQ(iter->value, v);
+	}
+
+	EXPECT_EQ(tree.find_ptr(114514), nullptr);
+	EXPECT_EQ(tree.find(114514), tree.end());
+	EXPECT_EQ(tree.find(-1), tree.end());
+
+	EXPECT_EQ(empty_tree.find_ptr(2), nullptr);
+	EXPECT_EQ(empty_tree.find(2), empty_tree.end());
+	EXPECT_EQ(empty_tree.begin(), empty_tree.end());
+}
+
+TEST_F(AVLTreeSingleTestFixture, Bounds)
+{
+	EXPECT_EQ(tree.lower_bound(-1)->value, 0);
+	EXPECT_EQ(tree.lower_bound(5)->value, 9);
+	EXPECT_EQ(tree.lower_bound(9)->value, 9);
+	EXPECT_EQ(tree.lower_bound(2001)->value, 2001);
+	EXPECT_EQ(tree.lower_bound(2002), tree.end());
+
+	EXPECT_EQ(tree.upper_bound(-1)->value, 0);
+	EXPECT_EQ(tree.upper_bound(5)->value, 9);
+	EXPECT_EQ(tree.upper_bound(9)->value, 20);
+	EXPECT_EQ(tree.upper_bound(2001), tree.end());
+
+	EXPECT_EQ(empty_tree.lower_bound(0), empty_tree.end());
+	EXPECT_EQ(empty_tree.upper_bound(0), empty_tree.end());
+
+	// range query [3, 120]
+	{
+		vector<int> expected{ 3, 4, 9, 20, 42, 120 };
+		size_t counter = 0;
+		for (auto iter = tree.lower_bound(3); iter != tree.upper_bound(120); ++iter)
+		{
+			ASSERT_LT(counter, expected.size());
+			EXPECT_EQ(iter->value, expected[counter++]);
+		}
+		EXPECT_EQ(counter, expected.size());
+	}
+}
+
+TEST_F(AVLTreeSingleTestFixture, RemoveByKey)
+{
+	EXPECT_TRUE(tree.remove_by_key(42));
+	EXPECT_EQ(tree.size(), 10);
+	EXPECT_EQ(tree.find(42), tree.end());
+
+	EXPECT_FALSE(tree.remove_by_key(42));
+	EXPECT_FALSE(tree.remove_by_key(114514));
+	EXPECT_EQ(tree.size(), 10);
+}
+
+TEST_F(AVLTreeSingleTestFixture, EraseRange)
+{
+	// 3, 4, 9 and 20
+	EXPECT_EQ(tree.erase_range(3, 42), 4);
+	EXPECT_EQ(tree.size(), 7);
+	EXPECT_EQ(tree.find(9), tree.end());
+	EXPECT_EQ(tree.lower_bound(3)->value, 42);
+
+	EXPECT_EQ(tree.erase_range(5, 40), 0);
+	EXPECT_EQ(tree.erase_range(42, 42), 0);
+	EXPECT_EQ(tree.size(), 7);
+
+	// everything from 120 on
+	auto last = tree.erase(tree.find(120), tree.end());
+	EXPECT_EQ(last, tree.end());
+	EXPECT_EQ(tree.size(), 4);
+	EXPECT_EQ(tree.back().value, 42);
+
+	int expected[] = { 0, 1, 2, 42 };
+	last = tree.erase(tree.begin(), tree.find(1));
+	EXPECT_EQ(last->value, 1);
+	EXPECT_EQ(tree.front().value, 1);
+
+	size_t i = 1;
+	for (auto& item:tree)
+	{
+		EXPECT_EQ(item.value, expected[i++]);
+	}
+	EXPECT_EQ(i, 4);
+}
+
+TEST_F(AVLTreeSingleTestFixture, EraseRangeAndDispose)
+{
+	// removed elements come out in key order, ready to be batched
+	avl_test_class::tree_type another;
+
+	vector<int> disposed;
+	auto count = tree.erase_range_and_dispose(1, 200, [&](avl_test_class* item)
+	{
+		disposed.push_back(item->value);
+		another.push_back_max(item);
+	});
+
+	EXPECT_EQ(count, 8);
+	EXPECT_EQ(disposed, vector<int>(sorted_src + 1, sorted_src + 9));
+	EXPECT_EQ(another.size(), 8);
+
+	EXPECT_EQ(tree.size(), 3);
+	EXPECT_EQ(tree.front().value, 0);
+	EXPECT_EQ((++tree.begin())->value, 200);
+
+	another.clear();
+}
+
+TEST_F(AVLTreeSingleTestFixture, FingerSearch)
+{
+	// sorted: 0, 1, 2, 3, 4, 9, 20, 42, 120, 200, 2001
+	auto finger = tree.find(9);
+
+	EXPECT_EQ(tree.lower_bound_from(finger, 10)->value, 20);
+	EXPECT_EQ(tree.lower_bound_from(finger, 9)->value, 9);
+	EXPECT_EQ(tree.lower_bound_from(finger, 3)->value, 3);
+	EXPECT_EQ(tree.lower_bound_from(finger, -1)->value, 0);
+	EXPECT_EQ(tree.lower_bound_from(finger, 2002), tree.end());
+
+	EXPECT_EQ(tree.find_from(finger, 200)->value, 200);
+	EXPECT_EQ(tree.find_from(finger, 199), tree.end());
+
+	// end() starts from the last element
+	EXPECT_EQ(tree.lower_bound_from(tree.end(), 121)->value, 200);
+	EXPECT_EQ(tree.find_from(tree.end(), 0)->value, 0);
+
+	for (int key = -1; key <= 2002; key++)
+	{
+		EXPECT_EQ(tree.lower_bound_from(tree.begin(), key), tree.lower_bound(key));
+	}
+}
+
+TEST_F(AVLTreeSingleTestFixture, EqualRange)
+{
+	{
+		auto[first, last] = tree.equal_range(42);
+		ASSERT_NE(first, tree.end());
+		EXPECT_EQ(first->value, 42);
+		EXPECT_EQ(++first, last);
+	}
+
+	{
+		auto[first, last] = tree.equal_range(43);
+		EXPECT_EQ(first, last);
+		EXPECT_EQ(first->value, 120);
+	}
+
+	{
+		auto[first, last] = tree.equal_range(2001);
+		EXPECT_EQ(first->value, 2001);
+		EXPECT_EQ(last, tree.end());
+	}
+}
+
+TEST(AVLTreeRandomTest, InsertRemove)
+{
+	constexpr int COUNT = 2000;
+
+	std::mt19937 rng{ 20011204 };
+	vector<avl_test_class> items(COUNT);
+	for (int i = 0; i < COUNT; i++)
+	{
+		items[i].value = i;
+	}
+
+	avl_tree<avl_test_class, int, &avl_test_class::value, &avl_test_class::link> tree;
+	std::set<int> reference;
+
+	for (int step = 0; step < 20000; step++)
+	{
+		auto key = static_cast<int>(rng() % COUNT);
+		if (rng() % 2)
+		{
+			tree.insert(items[key]);
+			reference.insert(key);
+		}
+		else
+		{
+			tree.remove(items[key]);
+			reference.erase(key);
+		}
+	}
+
+	ASSERT_EQ(tree.size(), reference.size());
+
+	auto iter = reference.begin();
+	for (auto& item:tree)
+	{
+		ASSERT_NE(iter, reference.end());
+		EXPECT_EQ(item.value, *iter++);
+	}
+	EXPECT_EQ(iter, reference.end());
+
+	auto riter = reference.rbegin();
+	for (auto& item:tree | kbl::reversed)
+	{
+		ASSERT_NE(riter, reference.rend());
+		EXPECT_EQ(item.value, *riter++);
+	}
+	EXPECT_EQ(riter, reference.rend());
+
+	tree.clear();
+	EXPECT_TRUE(tree.empty());
+}
+
+TEST_F(AVLTreeSingleTestFixture, SplitAndJoin)
+{
+	avl_test_class::tree_type greater;
+
+	tree.split(20, greater);
+	EXPECT_EQ(tree.size(), 6);
+	EXPECT_EQ(greater.size(), 5);
+	EXPECT_EQ(tree.back().value, 9);
+	EXPECT_EQ(greater.front().value, 20);
+
+	tree.join(greater);
+	EXPECT_EQ(tree.size(), SRC_SIZE);
+	EXPECT_TRUE(greater.empty());
+
+	{
+		size_t counter = 0;
+		for (auto& item:tree)
+		{
+			EXPECT_EQ(item.value, sorted_src[counter++]);
+		}
+	}
+
+	// split by iterator, then join in the other order
+	tree.split(tree.find(4), greater);
+	EXPECT_EQ(tree.size(), 4);
+	EXPECT_EQ(greater.size(), 7);
+
+	greater.join(tree);
+	EXPECT_EQ(greater.size(), SRC_SIZE);
+	EXPECT_TRUE(tree.empty());
+
+	{
+		size_t counter = 0;
+		for (auto& item:greater)
+		{
+			EXPECT_EQ(item.value, sorted_src[counter++]);
+		}
+	}
+
+	greater.split(greater.end(), tree);
+	EXPECT_TRUE(tree.empty());
+
+	greater.split(-1, tree);
+	EXPECT_TRUE(greater.empty());
+	EXPECT_EQ(tree.size(), SRC_SIZE);
+}
+
+TEST_F(AVLTreeSingleTestFixture, Unite)
+{
+	avl_test_class::tree_type another;
+	another.insert(new avl_test_class{ 5 });
+	another.insert(new avl_test_class{ 42 }); // duplicated
+	another.insert(new avl_test_class{ 3000 });
+
+	tree.unite(another);
+	EXPECT_EQ(tree.size(), SRC_SIZE + 2);
+	EXPECT_TRUE(another.empty());
+
+	vector<int> expected(begin(sorted_src), end(sorted_src));
+	expected.push_back(5);
+	expected.push_back(3000);
+	sort(expected.begin(), expected.end());
+
+	size_t counter = 0;
+	for (auto& item:tree)
+	{
+		EXPECT_EQ(item.value, expected[counter++]);
+	}
+	EXPECT_EQ(counter, expected.size());
+}
+
+TEST_F(AVLTreeSingleTestFixture, IntersectAndSubtract)
+{
+	avl_test_class::tree_type keys;
+	for (auto v:{ 0, 3, 5, 42, 2001, 3000 })
+	{
+		keys.insert(new avl_test_class{ v });
+	}
+
+	{
+		tree.intersect(keys);
+		EXPECT_EQ(tree.size(), 4);
+		EXPECT_EQ(keys.size(), 6);
+
+		vector<int> expected{ 0, 3, 42, 2001 };
+		size_t counter = 0;
+		for (auto& item:tree)
+		{
+			EXPECT_EQ(item.value, expected[counter++]);
+		}
+		EXPECT_EQ(counter, expected.size());
+	}
+
+	{
+		keys.subtract(tree);
+		EXPECT_EQ(keys.size(), 2);
+		EXPECT_EQ(keys.front().value, 5);
+		EXPECT_EQ(keys.back().value, 3000);
+	}
+
+	tree.subtract(tree);
+	EXPECT_TRUE(tree.empty());
+	EXPECT_EQ(tree.size(), 0);
+
+	keys.clear();
+}
+
+class AVLTreeSetOperationTest : public testing::Test
+{
+protected:
+	using tree_type = avl_tree<avl_test_class, int, &avl_test_class::value, &avl_test_class::link>;
+
+	void SetUp() override
+	{
+		std::mt19937 rng{ 42 };
+
+		a_items.resize(COUNT);
+		b_items.resize(COUNT);
+		for (int i = 0; i < COUNT; i++)
+		{
+			a_items[i].value = b_items[i].value = i;
+
+			if (rng() % 3 == 0)
+			{
+				a.insert(a_items[i]);
+				a_keys.insert(i);
+			}
+
+			if (rng() % 2 == 0)
+			{
+				b.insert(b_items[i]);
+				b_keys.insert(i);
+			}
+		}
+	}
+
+	void expect_equal(tree_type& tree, const std::set<int>& keys)
+	{
+		ASSERT_EQ(tree.size(), keys.size());
+
+		auto iter = keys.begin();
+		for (auto& item:tree)
+		{
+			EXPECT_EQ(item.value, *iter++);
+		}
+	}
+
+	static constexpr int COUNT = 100000;
+
+	vector<avl_test_class> a_items, b_items;
+	tree_type a, b;
+	std::set<int> a_keys, b_keys;
+
+	kbl::fork_join_pool pool{ 4 };
+};
+
+TEST_F(AVLTreeSetOperationTest, ParallelUnite)
+{
+	std::set<int> expected{ a_keys };
+	expected.insert(b_keys.begin(), b_keys.end());
+
+	a.unite(b, pool);
+	expect_equal(a, expected);
+	EXPECT_TRUE(b.empty());
+}
+
+TEST_F(AVLTreeSetOperationTest, ParallelIntersect)
+{
+	std::set<int> expected{};
+	std::set_intersection(a_keys.begin(), a_keys.end(), b_keys.begin(), b_keys.end(),
+			std::inserter(expected, expected.end()));
+
+	a.intersect(b, pool);
+	expect_equal(a, expected);
+	expect_equal(b, b_keys);
+}
+
+TEST_F(AVLTreeSetOperationTest, ParallelSubtract)
+{
+	std::set<int> expected{};
+	std::set_difference(a_keys.begin(), a_keys.end(), b_keys.begin(), b_keys.end(),
+			std::inserter(expected, expected.end()));
+
+	a.subtract(b, pool);
+	expect_equal(a, expected);
+	expect_equal(b, b_keys);
+}
+
+TEST_F(AVLTreeSetOperationTest, RemoveElementsOfAnotherTree)
+{
+	std::set<int> expected{};
+	std::set_difference(b_keys.begin(), b_keys.end(), a_keys.begin(), a_keys.end(),
+			std::inserter(expected, expected.end()));
+
+	// the elements of a are linked, but not into b, whose elements with the same keys go instead
+	for (auto key:a_keys)
+	{
+		b.remove(a_items[key]);
+	}
+
+	expect_equal(a, a_keys);
+	expect_equal(b, expected);
+}
+
+TEST_F(AVLTreeSetOperationTest, RemoveElement)
+{
+	// b holds other elements with the keys of a, which remove_element() leaves there
+	for (auto key:a_keys)
+	{
+		EXPECT_FALSE(b.remove_element(a_items[key]));
+	}
+	expect_equal(b, b_keys);
+
+	for (auto key:a_keys)
+	{
+		EXPECT_TRUE(a.remove_element(a_items[key]));
+	}
+	EXPECT_TRUE(a.empty());
+}
+
+TEST(AVLTreeBuildTest, BuildFromSorted)
+{
+	using tree_type = avl_tree<avl_test_class, int, &avl_test_class::value, &avl_test_class::link>;
+
+	vector<avl_test_class> items(1000);
+	for (int i = 0; i < 1000; i++)
+	{
+		items[i].value = i * 2;
+	}
+
+	tree_type tree;
+	tree.build_from_sorted(items.begin(), items.end());
+	EXPECT_EQ(tree.size(), 1000);
+
+	// build into a non-empty tree
+	vector<avl_test_class> odds(1000);
+	vector<avl_test_class*> odd_ptrs;
+	for (int i = 0; i < 1000; i++)
+	{
+		odds[i].value = i * 2 + 1;
+		odd_ptrs.push_back(&odds[i]);
+	}
+
+	tree.build_from_sorted(odd_ptrs.begin(), odd_ptrs.end());
+	EXPECT_EQ(tree.size(), 2000);
+
+	int counter = 0;
+	for (auto& item:tree)
+	{
+		EXPECT_EQ(item.value, counter++);
+	}
+	EXPECT_EQ(counter, 2000);
+
+	EXPECT_EQ(tree.find(1234)->value, 1234);
+
+	tree.clear();
+}
+
+TEST(AVLTreeBuildTest, BuildFromSortedChecked)
+{
+	using tree_type = avl_tree<avl_test_class, int, &avl_test_class::value, &avl_test_class::link>;
+
+	vector<avl_test_class> items(10);
+	for (int i = 0; i < 10; i++)
+	{
+		items[i].value = i;
+	}
+	items[5].value = 3;
+
+	tree_type tree;
+	EXPECT_FALSE(tree.build_from_sorted_checked(items.begin(), items.end()));
+	EXPECT_TRUE(tree.empty());
+
+	items[5].value = 5;
+	EXPECT_TRUE(tree.build_from_sorted_checked(items.begin(), items.end()));
+	EXPECT_EQ(tree.size(), 10);
+	EXPECT_EQ(tree.front().value, 0);
+	EXPECT_EQ(tree.back().value, 9);
+
+	tree.clear();
+}
+
+class avl_counted_test_class
+{
+public:
+	avl_counted_test_class() = default;
+
+	explicit avl_counted_test_class(int v) : value(v)
+	{
+	}
+
+	int value{ 0 };
+
+	avl_tree_link<avl_counted_test_class, &avl_counted_test_class::value, true> link{ this };
+
+	using tree_type = avl_tree<avl_counted_test_class,
+							   decltype(value),
+							   &avl_counted_test_class::value,
+							   &avl_counted_test_class::link>;
+};
+
+TEST(AVLTreeOrderStatisticTest, SelectAndRank)
+{
+	constexpr int COUNT = 1000;
+
+	std::mt19937 rng{ 114514 };
+	vector<avl_counted_test_class> items(COUNT);
+	for (int i = 0; i < COUNT; i++)
+	{
+		items[i].value = i * 2;
+	}
+
+	avl_counted_test_class::tree_type tree;
+	std::set<int> reference;
+	for (int step = 0; step < 5000; step++)
+	{
+		auto index = rng() % COUNT;
+		if (rng() % 3)
+		{
+			tree.insert(items[index]);
+			reference.insert(items[index].value);
+		}
+		else
+		{
+			tree.remove(items[index]);
+			reference.erase(items[index].value);
+		}
+	}
+
+	ASSERT_EQ(tree.size(), reference.size());
+
+	size_t k = 0;
+	for (auto v:reference)
+	{
+		EXPECT_EQ(tree.select(k)->value, v);
+		EXPECT_EQ(tree.rank(v), k);
+		EXPECT_EQ(tree.rank(v + 1), k + 1);
+		k++;
+	}
+	EXPECT_EQ(tree.select(k), tree.end());
+
+	EXPECT_EQ(tree.count_range(100, 1000),
+			static_cast<size_t>(std::distance(reference.lower_bound(100), reference.lower_bound(1000))));
+	EXPECT_EQ(tree.count_range(1000, 100), 0);
+
+	// sizes are known right after a split
+	avl_counted_test_class::tree_type greater;
+	tree.split(1000, greater);
+	EXPECT_EQ(tree.size(), static_cast<size_t>(std::distance(reference.begin(), reference.lower_bound(1000))));
+	EXPECT_EQ(greater.size(), static_cast<size_t>(std::distance(reference.lower_bound(1000), reference.end())));
+	EXPECT_EQ(greater.rank(1000), 0);
+
+	greater.clear();
+	tree.clear();
+}
+
+class avl_compact_test_class
+{
+public:
+	avl_compact_test_class() = default;
+
+	explicit avl_compact_test_class(int v) : value(v)
+	{
+	}
+
+	// the link isn't at the start of the object, so finding the owner takes its offset
+	int value{ 0 };
+
+	avl_tree_compact_link<avl_compact_test_class, &avl_compact_test_class::value> link{ this };
+
+	using tree_type = avl_tree<avl_compact_test_class,
+							   decltype(value),
+							   &avl_compact_test_class::value,
+							   &avl_compact_test_class::link>;
+};
+
+TEST(AVLTreeCompactLinkTest, MemoryPerNode)
+{
+	using full_link = avl_tree_link<avl_test_class, &avl_test_class::value>;
+	using compact_link = avl_tree_compact_link<avl_compact_test_class, &avl_compact_test_class::value>;
+
+	printf("avl_tree_link: %zu bytes per node, avl_tree_compact_link: %zu bytes per node\n",
+			sizeof(full_link), sizeof(compact_link));
+
+	EXPECT_EQ(sizeof(compact_link), 3 * sizeof(void*));
+	EXPECT_LT(sizeof(compact_link), sizeof(full_link));
+}
+
+TEST(AVLTreeCompactLinkTest, InsertRemoveSplitJoin)
+{
+	constexpr int COUNT = 2000;
+
+	std::mt19937 rng{ 1919810 };
+	vector<avl_compact_test_class> items(COUNT);
+	for (int i = 0; i < COUNT; i++)
+	{
+		items[i].value = i;
+	}
+
+	avl_compact_test_class::tree_type tree;
+	EXPECT_EQ(tree.front_ptr(), nullptr);
+	EXPECT_EQ(tree.back_ptr(), nullptr);
+
+	std::set<int> reference;
+	for (int step = 0; step < 10000; step++)
+	{
+		auto index = rng() % COUNT;
+		if (rng() % 3)
+		{
+			tree.insert(items[index]);
+			reference.insert(items[index].value);
+		}
+		else
+		{
+			tree.remove(items[index]);
+			reference.erase(items[index].value);
+		}
+	}
+
+	ASSERT_EQ(tree.size(), reference.size());
+
+	auto expected = reference.begin();
+	for (auto& item:tree)
+	{
+		ASSERT_NE(expected, reference.end());
+		EXPECT_EQ(item.value, *expected++);
+	}
+	EXPECT_EQ(expected, reference.end());
+
+	for (int v = 0; v < COUNT; v++)
+	{
+		auto ptr = tree.find_ptr(v);
+		if (reference.contains(v))
+			EXPECT_EQ(ptr, &items[v]);
+		else
+			EXPECT_EQ(ptr, nullptr);
+	}
+
+	avl_compact_test_class::tree_type greater;
+	tree.split(COUNT / 2, greater);
+	ASSERT_FALSE(tree.empty());
+	EXPECT_LT(tree.back().value, COUNT / 2);
+	EXPECT_GE(greater.front().value, COUNT / 2);
+
+	tree.join(greater);
+	EXPECT_TRUE(greater.empty());
+	EXPECT_EQ(tree.size(), reference.size());
+
+	size_t count = 0;
+	for ([[maybe_unused]] auto& item:tree)
+	{
+		count++;
+	}
+	EXPECT_EQ(count, reference.size());
+
+	tree.clear();
+}
+
+TEST(AVLTreeHintTest, PushBackMax)
+{
+	using tree_type = avl_tree<avl_test_class, int, &avl_test_class::value, &avl_test_class::link>;
+
+	vector<avl_test_class> items(1000);
+	tree_type tree;
+	EXPECT_EQ(tree.front_ptr(), nullptr);
+	EXPECT_EQ(tree.back_ptr(), nullptr);
+
+	for (int i = 0; i < 1000; i++)
+	{
+		items[i].value = i * 2;
+		EXPECT_EQ(&*tree.push_back_max(items[i]), &items[i]);
+		EXPECT_EQ(&tree.back(), &items[i]);
+	}
+	EXPECT_EQ(tree.size(), 1000);
+
+	// removing the greatest keeps back() right
+	tree.remove(items[999]);
+	tree.remove(items[998]);
+	EXPECT_EQ(&tree.back(), &items[997]);
+
+	// keys that aren't the greatest fall back to insert()
+	avl_test_class middle{ 101 }, duplicate{ 100 };
+	EXPECT_EQ(&*tree.push_back_max(middle), &middle);
+	EXPECT_EQ(&*tree.push_back_max(duplicate), &items[50]);
+	EXPECT_EQ(tree.size(), 999);
+
+	std::set<int> reference{ 101 };
+	for (int i = 0; i < 998; i++)
+	{
+		reference.insert(i * 2);
+	}
+
+	auto expected = reference.begin();
+	for (auto& item:tree)
+	{
+		EXPECT_EQ(item.value, *expected++);
+	}
+
+	tree.clear();
+}
+
+TEST(AVLTreeHintTest, InsertWithHint)
+{
+	using tree_type = avl_tree<avl_test_class, int, &avl_test_class::value, &avl_test_class::link>;
+
+	constexpr int COUNT = 2000;
+
+	std::mt19937 rng{ 1919810 };
+	vector<avl_test_class> items(COUNT);
+	for (int i = 0; i < COUNT; i++)
+	{
+		items[i].value = static_cast<int>(rng() % (COUNT * 2));
+	}
+
+	tree_type tree;
+	std::set<int> reference;
+	for (int i = 0; i < COUNT; i++)
+	{
+		// a correct hint, the begin() or a random one, which is usually wrong
+		tree_type::iterator_type hint = tree.end();
+		switch (rng() % 3)
+		{
+		case 0:
+			hint = tree.upper_bound(items[i].value);
+			break;
+		case 1:
+			hint = tree.begin();
+			break;
+		default:
+			hint = tree.lower_bound(static_cast<int>(rng() % (COUNT * 2)));
+			break;
+		}
+
+		auto inserted = reference.insert(items[i].value).second;
+		auto iter = tree.insert(hint, items[i]);
+
+		EXPECT_EQ(iter->value, items[i].value);
+		EXPECT_EQ(&*iter == &items[i], inserted);
+	}
+
+	ASSERT_EQ(tree.size(), reference.size());
+
+	auto expected = reference.begin();
+	for (auto& item:tree)
+	{
+		EXPECT_EQ(item.value, *expected++);
+	}
+	EXPECT_EQ(tree.back().value, *reference.rbegin());
+
+	tree.clear();
+}
+
+class avl_string_test_class
+{
+public:
+	avl_string_test_class() = default;
+
+	explicit avl_string_test_class(std::string n) : name(std::move(n))
+	{
+	}
+
+	std::string name{};
+
+	avl_tree_link<avl_string_test_class, &avl_string_test_class::name> link{ this };
+
+	using tree_type = avl_tree<avl_string_test_class,
+							   decltype(name),
+							   &avl_string_test_class::name,
+							   &avl_string_test_class::link,
+							   false,
+							   false,
+							   avl_transparent_comparer>;
+};
+
+TEST(AVLTreeTransparentTest, LookupWithoutKey)
+{
+	// links point back to their owners, so don't let the vector move them
+	vector<avl_string_test_class> items;
+	items.reserve(6);
+	for (auto name:{ "kernel", "memory", "process", "scheduler", "timer", "vfs" })
+	{
+		items.emplace_back(name);
+	}
+
+	avl_string_test_class::tree_type tree;
+	for (auto& item:items)
+	{
+		tree.insert(item);
+	}
+
+	// string_view and const char* go straight to the comparer, no std::string is built
+	std::string_view probe{ "schedulers" };
+	EXPECT_EQ(tree.find_ptr(probe.substr(0, 9)), &items[3]);
+	EXPECT_EQ(tree.find(probe), tree.end());
+	EXPECT_EQ(tree.find("timer")->name, "timer");
+
+	EXPECT_EQ(tree.lower_bound(std::string_view{ "p" })->name, "process");
+	EXPECT_EQ(tree.upper_bound("process")->name, "scheduler");
+
+	auto[first, last] = tree.equal_range(std::string_view{ "memory" });
+	EXPECT_EQ(&*first, &items[1]);
+	EXPECT_EQ(&*last, &items[2]);
+
+	EXPECT_TRUE(tree.remove_by_key(std::string_view{ "vfs" }));
+	EXPECT_FALSE(tree.remove_by_key("vfs"));
+	EXPECT_EQ(tree.size(), items.size() - 1);
+
+	// keys still work as usual
+	EXPECT_EQ(tree.find_ptr(std::string{ "kernel" }), &items[0]);
+
+	tree.clear();
+}
+
+class avl_weak_test_class
+{
+public:
+	int value{ 0 };
+
+	avl_tree_link<avl_weak_test_class, &avl_weak_test_class::value, true, avl_no_augment, false, avl_weak_balance>
+			link{ this };
+
+	using tree_type = avl_tree<avl_weak_test_class,
+							   decltype(value),
+							   &avl_weak_test_class::value,
+							   &avl_weak_test_class::link>;
+};
+
+// check the rank rule of WAVL trees in the subtree of link: a rank exceeds those of the children by one or two,
+// leaves have rank 1 and missing children count as rank 0. return the height of the subtree
+static size_t check_weak_ranks(decltype(avl_weak_test_class::link)* link)
+{
+	if (link == nullptr)
+		return 0;
+
+	size_t rank = link->height;
+	for (auto child:{ link->left, link->right })
+	{
+		size_t child_rank = child ? child->height : 0;
+		EXPECT_TRUE(rank == child_rank + 1 || rank == child_rank + 2);
+	}
+
+	if (link->left == nullptr && link->right == nullptr)
+	{
+		EXPECT_EQ(rank, 1);
+	}
+
+	return std::max(check_weak_ranks(link->left), check_weak_ranks(link->right)) + 1;
+}
+
+TEST(AVLTreeWeakBalanceTest, InsertRemove)
+{
+	constexpr int COUNT = 2000;
+
+	std::mt19937 rng{ 1024 };
+	vector<avl_weak_test_class> items(COUNT);
+	for (int i = 0; i < COUNT; i++)
+	{
+		items[i].value = i;
+	}
+
+	avl_weak_test_class::tree_type tree;
+	std::set<int> reference;
+
+	auto check = [&]
+	{
+		ASSERT_EQ(tree.size(), reference.size());
+
+		size_t k = 0;
+		for (auto& item:tree)
+		{
+			ASSERT_EQ(tree.select(k++), tree.find(item.value));
+		}
+
+		auto expected = reference.begin();
+		for (auto& item:tree)
+		{
+			ASSERT_EQ(item.value, *expected++);
+		}
+		EXPECT_EQ(expected, reference.end());
+
+		if (tree.empty())
+			return;
+
+		auto root = &tree.begin()->link;
+		while (root->parent)
+		{
+			root = root->parent;
+		}
+
+		// no higher than the rank of the root, which is at most 2 log n
+		EXPECT_LE(check_weak_ranks(root), root->height);
+		EXPECT_LE(root->height, 2 * static_cast<size_t>(std::bit_width(tree.size())));
+	};
+
+	for (int step = 0; step < 20000; step++)
+	{
+		auto index = rng() % COUNT;
+		if (rng() % 2)
+		{
+			tree.insert(items[index]);
+			reference.insert(items[index].value);
+		}
+		else
+		{
+			tree.remove(items[index]);
+			reference.erase(items[index].value);
+		}
+	}
+	check();
+
+	// the bulk operations work on ranks as they do on heights
+	avl_weak_test_class::tree_type greater;
+	tree.split(COUNT / 2, greater);
+	tree.join(greater);
+	check();
+
+	tree.erase_range(COUNT / 4, COUNT / 2);
+	reference.erase(reference.lower_bound(COUNT / 4), reference.lower_bound(COUNT / 2));
+	check();
+
+	for (int i = 0; i < COUNT; i++)
+	{
+		tree.remove(items[i]);
+	}
+	EXPECT_TRUE(tree.empty());
+}
+
+class avl_threaded_test_class
+{
+public:
+	avl_threaded_test_class() = default;
+
+	explicit avl_threaded_test_class(int v) : value(v)
+	{
+	}
+
+	int value{ 0 };
+
+	avl_tree_link<avl_threaded_test_class, &avl_threaded_test_class::value, false, avl_no_augment, true> link{ this };
+
+	using tree_type = avl_tree<avl_threaded_test_class,
+							   decltype(value),
+							   &avl_threaded_test_class::value,
+							   &avl_threaded_test_class::link>;
+};
+
+TEST(AVLTreeThreadedTest, IterateAfterModification)
+{
+	constexpr int COUNT = 2000;
+
+	std::mt19937 rng{ 19260817 };
+	vector<avl_threaded_test_class> items(COUNT), others(COUNT);
+	for (int i = 0; i < COUNT; i++)
+	{
+		items[i].value = i;
+		others[i].value = i;
+	}
+
+	avl_threaded_test_class::tree_type tree;
+	std::set<int> reference;
+
+	auto check = [&]
+	{
+		ASSERT_EQ(tree.size(), reference.size());
+
+		auto expected = reference.begin();
+		for (auto& item:tree)
+		{
+			ASSERT_EQ(item.value, *expected++);
+		}
+		EXPECT_EQ(expected, reference.end());
+
+		auto rexpected = reference.rbegin();
+		for (auto& item:tree | kbl::reversed)
+		{
+			ASSERT_EQ(item.value, *rexpected++);
+		}
+		EXPECT_EQ(rexpected, reference.rend());
+	};
+
+	for (int step = 0; step < 10000; step++)
+	{
+		auto index = rng() % COUNT;
+		if (rng() % 3)
+		{
+			tree.insert(items[index]);
+			reference.insert(items[index].value);
+		}
+		else
+		{
+			tree.remove(items[index]);
+			reference.erase(items[index].value);
+		}
+	}
+	check();
+
+	// the threads survive splitting, joining and the set operations
+	avl_threaded_test_class::tree_type greater;
+	tree.split(COUNT / 2, greater);
+	tree.join(greater);
+	check();
+
+	avl_threaded_test_class::tree_type another;
+	for (int i = 0; i < COUNT; i += 3)
+	{
+		if (!reference.contains(i))
+		{
+			another.insert(others[i]);
+			reference.insert(i);
+		}
+	}
+	tree.unite(another);
+	check();
+
+	vector<avl_threaded_test_class> keys(COUNT);
+	for (int i = 0; i < COUNT; i += 5)
+	{
+		keys[i].value = i;
+		another.insert(keys[i]);
+	}
+	tree.subtract(another);
+	for (int i = 0; i < COUNT; i += 5)
+	{
+		reference.erase(i);
+	}
+	check();
+
+	tree.erase_range(COUNT / 4, COUNT / 2);
+	reference.erase(reference.lower_bound(COUNT / 4), reference.lower_bound(COUNT / 2));
+	check();
+
+	another.clear();
+	tree.clear();
+}
+
+class avl_locked_test_class
+{
+public:
+	avl_locked_test_class() = default;
+
+	explicit avl_locked_test_class(int v) : value(v)
+	{
+	}
+
+	int value{ 0 };
+
+	avl_tree_link<avl_locked_test_class, &avl_locked_test_class::value> link{ this };
+
+	using tree_type = avl_tree<avl_locked_test_class,
+							   decltype(value),
+							   &avl_locked_test_class::value,
+							   &avl_locked_test_class::link,
+							   true>;
+};
+
+TEST(AVLTreeLockTest, ConcurrentReadWrite)
+{
+	constexpr int THREADS = 4, PER_THREAD = 2000;
+
+	vector<avl_locked_test_class> items(THREADS * PER_THREAD);
+	for (int i = 0; i < THREADS * PER_THREAD; i++)
+	{
+		items[i].value = i;
+	}
+
+	avl_locked_test_class::tree_type tree;
+
+	// each writer owns the keys congruent to its index, readers look up everything
+	vector<std::thread> threads;
+	for (int t = 0; t < THREADS; t++)
+	{
+		threads.emplace_back([&, t]
+		{
+			for (int round = 0; round < 3; round++)
+			{
+				for (int i = t; i < THREADS * PER_THREAD; i += THREADS)
+				{
+					tree.insert(items[i]);
+					EXPECT_EQ(tree.find_ptr(i), &items[i]);
+				}
+
+				for (int i = t; i < THREADS * PER_THREAD; i += THREADS * 2)
+				{
+					tree.remove(items[i]);
+					EXPECT_EQ(tree.find_ptr(i), nullptr);
+				}
+			}
+		});
+
+		threads.emplace_back([&]
+		{
+			for (int i = 0; i < THREADS * PER_THREAD; i++)
+			{
+				if (auto ptr = tree.find_ptr(i))
+				{
+					EXPECT_EQ(ptr->value, i);
+				}
+
+				EXPECT_LE(tree.size(), THREADS * PER_THREAD);
+			}
+		});
+
+		threads.emplace_back([&]
+		{
+			for (int round = 0; round < 20; round++)
+			{
+				int prev = -1;
+				tree.for_each([&prev](avl_locked_test_class& item)
+				{
+					EXPECT_GT(item.value, prev);
+					prev = item.value;
+				});
+			}
+		});
+	}
+
+	for (auto& thread:threads)
+	{
+		thread.join();
+	}
+
+	EXPECT_EQ(tree.size(), THREADS * PER_THREAD / 2);
+
+	int prev = -1;
+	for (auto& item:tree)
+	{
+		EXPECT_GE(item.value % (THREADS * 2), THREADS);
+		EXPECT_GT(item.value, prev);
+		prev = item.value;
+	}
+
+	tree.clear();
+}
+
+TEST(AVLTreeLockTest, OppositeSetOperations)
+{
+	constexpr int COUNT = 1000;
+
+	vector<avl_locked_test_class> a_items(COUNT), b_items(COUNT);
+	for (int i = 0; i < COUNT; i++)
+	{
+		a_items[i].value = i * 2;
+		b_items[i].value = i * 2 + 1;
+	}
+
+	avl_locked_test_class::tree_type a, b;
+	for (int i = 0; i < COUNT; i++)
+	{
+		a.insert(a_items[i]);
+		b.insert(b_items[i]);
+	}
+
+	// two threads taking the locks of the same trees from opposite sides mustn't deadlock
+	std::thread splitter([&]
+	{
+		for (int i = 0; i < 200; i++)
+		{
+			a.split(COUNT, b);
+		}
+	});
+
+	std::thread joiner([&]
+	{
+		for (int i = 0; i < 200; i++)
+		{
+			b.split(COUNT, a);
+		}
+	});
+
+	splitter.join();
+	joiner.join();
+
+	EXPECT_EQ(a.size() + b.size(), COUNT * 2);
+
+	a.clear();
+	b.clear();
+}
+
+class avl_seqlock_test_class
+{
+public:
+	int value{ 0 };
+
+	avl_tree_link<avl_seqlock_test_class, &avl_seqlock_test_class::value> link{ this };
+
+	using tree_type = avl_tree<avl_seqlock_test_class,
+							   decltype(value),
+							   &avl_seqlock_test_class::value,
+							   &avl_seqlock_test_class::link,
+							   true,
+							   false,
+							   avl_default_comparer<int>,
+							   avl_default_deleter<avl_seqlock_test_class>,
+							   lock::seqlock>;
+};
+
+TEST(AVLTreeLockTest, OptimisticLookups)
+{
+	constexpr int COUNT = 4000, ROUNDS = 20;
+
+	static_assert(avl_seqlock_test_class::tree_type::optimistic_reads);
+
+	vector<avl_seqlock_test_class> items(COUNT);
+	for (int i = 0; i < COUNT; i++)
+	{
+		items[i].value = i;
+	}
+
+	avl_seqlock_test_class::tree_type tree;
+	for (int i = 0; i < COUNT; i += 2)
+	{
+		tree.insert(items[i]);
+	}
+
+	// the writer keeps rebalancing the tree with the odd keys, while the even ones must always be found
+	std::thread writer([&]
+	{
+		for (int round = 0; round < ROUNDS; round++)
+		{
+			for (int i = 1; i < COUNT; i += 2)
+				tree.insert(items[i]);
+
+			for (int i = 1; i < COUNT; i += 2)
+				tree.remove(items[i]);
+		}
+	});
+
+	std::thread reader([&]
+	{
+		for (int round = 0; round < ROUNDS; round++)
+		{
+			for (int i = 0; i < COUNT; i += 2)
+			{
+				EXPECT_EQ(tree.find_ptr(i), &items[i]);
+
+				auto iter = tree.lower_bound(i + 1);
+				EXPECT_TRUE(iter == tree.end() || iter->value == i + 1 || iter->value == i + 2);
+
+				// climbs from an element the writer keeps moving around
+				if (i + 2 < COUNT)
+				{
+					auto next = tree.find_from(tree.find(i), i + 2);
+					EXPECT_TRUE(next != tree.end() && next->value == i + 2);
+				}
+			}
+		}
+	});
+
+	writer.join();
+	reader.join();
+
+	EXPECT_EQ(tree.size(), COUNT / 2);
+
+	tree.clear();
+}
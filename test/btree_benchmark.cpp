@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+
+#include <avl_tree.h>
+#include <btree.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <numeric>
+#include <random>
+#include <vector>
+
+using namespace kbl;
+using namespace std;
+
+class btree_bench_class
+{
+public:
+	int value{ 0 };
+
+	avl_tree_link<btree_bench_class, &btree_bench_class::value> link{ this };
+
+	using avl_tree_type = avl_tree<btree_bench_class, decltype(value), &btree_bench_class::value, &btree_bench_class::link>;
+	using btree_type = btree<btree_bench_class, decltype(value), &btree_bench_class::value>;
+};
+
+template<typename TFunc>
+static double measure_ms(TFunc&& func)
+{
+	auto start = chrono::steady_clock::now();
+	func();
+	auto end = chrono::steady_clock::now();
+	return chrono::duration<double, milli>(end - start).count();
+}
+
+static void report(const char* name, size_t ops, double ms)
+{
+	printf("%-40s %10zu ops %10.2f ms %10.2f Mops/s\n", name, ops, ms, ops / ms / 1000.0);
+}
+
+class BTreeBenchmark : public testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		items.resize(COUNT);
+		keys.resize(COUNT);
+		iota(keys.begin(), keys.end(), 0);
+		shuffle(keys.begin(), keys.end(), mt19937{ 20011204 });
+
+		for (size_t i = 0; i < COUNT; i++)
+		{
+			items[i].value = keys[i];
+		}
+
+		lookups = keys;
+		shuffle(lookups.begin(), lookups.end(), mt19937{ 1919810 });
+	}
+
+	template<typename TTree>
+	void run(const char* name)
+	{
+		TTree tree;
+
+		char title[96]{};
+		snprintf(title, sizeof(title), "%s insert (random)", name);
+		report(title, COUNT, measure_ms([&]
+		{
+			for (auto& item:items)
+				tree.insert(item);
+		}));
+
+		size_t found = 0;
+		snprintf(title, sizeof(title), "%s find (random)", name);
+		report(title, COUNT, measure_ms([&]
+		{
+			for (auto key:lookups)
+				found += tree.find_ptr(key) != nullptr;
+		}));
+		EXPECT_EQ(found, COUNT);
+
+		long long sum = 0;
+		snprintf(title, sizeof(title), "%s full scan", name);
+		report(title, COUNT, measure_ms([&]
+		{
+			for (auto& item:tree)
+				sum += item.value;
+		}));
+		EXPECT_EQ(sum, static_cast<long long>(COUNT) * (COUNT - 1) / 2);
+
+		snprintf(title, sizeof(title), "%s remove (random)", name);
+		report(title, COUNT, measure_ms([&]
+		{
+			for (auto& item:items)
+				tree.remove(item);
+		}));
+
+		tree.clear();
+	}
+
+	static constexpr size_t COUNT = 1 << 21;
+
+	vector<btree_bench_class> items;
+	vector<int> keys, lookups;
+};
+
+TEST_F(BTreeBenchmark, AgainstAVLTree)
+{
+	run<btree_bench_class::avl_tree_type>("avl_tree");
+	run<btree_bench_class::btree_type>("btree");
+}
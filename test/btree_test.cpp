@@ -0,0 +1,310 @@
+#include <gtest/gtest.h>
+
+#include <btree.h>
+
+#include <algorithm>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace kbl;
+using namespace std;
+
+class btree_test_class
+{
+public:
+	btree_test_class() = default;
+
+	explicit btree_test_class(int v) : value(v)
+	{
+	}
+
+	int value{ 0 };
+
+	using tree_type = btree<btree_test_class, decltype(value), &btree_test_class::value>;
+
+	// small nodes, so that a few elements already make a tree several levels high
+	using narrow_tree_type = btree<btree_test_class,
+								   decltype(value),
+								   &btree_test_class::value,
+								   false,
+								   false,
+								   btree_default_comparer<int>,
+								   default_deleter<btree_test_class>,
+								   default_allocator,
+								   lock::shared_mutex,
+								   4>;
+};
+
+template<typename TTree>
+static void check_against(TTree& tree, const std::set<int>& reference)
+{
+	ASSERT_EQ(tree.size(), reference.size());
+
+	auto expected = reference.begin();
+	for (auto& item:tree)
+	{
+		ASSERT_EQ(item.value, *expected++);
+	}
+	EXPECT_EQ(expected, reference.end());
+
+	auto rexpected = reference.rbegin();
+	for (auto& item:tree | kbl::reversed)
+	{
+		ASSERT_EQ(item.value, *rexpected++);
+	}
+	EXPECT_EQ(rexpected, reference.rend());
+}
+
+template<typename TTree>
+static void random_insert_remove(size_t count, size_t steps)
+{
+	std::mt19937 rng{ 20011204 };
+
+	vector<btree_test_class> items(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		items[i].value = static_cast<int>(i * 2);
+	}
+
+	TTree tree;
+	std::set<int> reference;
+	for (size_t step = 0; step < steps; step++)
+	{
+		auto index = rng() % count;
+		if (rng() % 2)
+		{
+			EXPECT_EQ(tree.insert(items[index]), reference.insert(items[index].value).second);
+		}
+		else
+		{
+			EXPECT_EQ(tree.remove_by_key(items[index].value), reference.erase(items[index].value) == 1);
+		}
+
+		if (step % 1000 == 0)
+			check_against(tree, reference);
+	}
+	check_against(tree, reference);
+
+	for (int key = -1; key <= static_cast<int>(count * 2); key++)
+	{
+		auto lower = reference.lower_bound(key), upper = reference.upper_bound(key);
+
+		auto iter = tree.lower_bound(key);
+		if (lower == reference.end())
+			EXPECT_EQ(iter, tree.end());
+		else
+			EXPECT_EQ(iter->value, *lower);
+
+		iter = tree.upper_bound(key);
+		if (upper == reference.end())
+			EXPECT_EQ(iter, tree.end());
+		else
+			EXPECT_EQ(iter->value, *upper);
+
+		EXPECT_EQ(tree.find_ptr(key) != nullptr, reference.contains(key));
+	}
+
+	tree.clear();
+	EXPECT_TRUE(tree.empty());
+	EXPECT_EQ(tree.begin(), tree.end());
+}
+
+TEST(BTreeTest, InsertRemove)
+{
+	random_insert_remove<btree_test_class::tree_type>(20000, 100000);
+}
+
+TEST(BTreeTest, InsertRemoveNarrowNodes)
+{
+	random_insert_remove<btree_test_class::narrow_tree_type>(2000, 50000);
+}
+
+TEST(BTreeTest, Height)
+{
+	constexpr int COUNT = 100000;
+
+	vector<btree_test_class> items(COUNT);
+	btree_test_class::tree_type tree;
+	for (int i = 0; i < COUNT; i++)
+	{
+		items[i].value = i;
+		tree.insert(items[i]);
+	}
+
+	// 32 keys a node, so each level holds at least 16 times more elements
+	EXPECT_LE(tree.height(), 5);
+	EXPECT_EQ(tree.front().value, 0);
+	EXPECT_EQ(tree.back().value, COUNT - 1);
+
+	for (int i = 0; i < COUNT; i++)
+	{
+		tree.remove(items[i]);
+	}
+	EXPECT_EQ(tree.height(), 0);
+	EXPECT_TRUE(tree.empty());
+}
+
+TEST(BTreeTest, EraseAndIterate)
+{
+	vector<btree_test_class> items(100);
+	btree_test_class::narrow_tree_type tree;
+	for (int i = 0; i < 100; i++)
+	{
+		items[i].value = i;
+		tree.insert(items[i]);
+	}
+
+	// remove the odd ones while walking
+	for (auto iter = tree.begin(); iter != tree.end();)
+	{
+		if (iter->value % 2)
+			iter = tree.erase(iter);
+		else
+			++iter;
+	}
+	EXPECT_EQ(tree.size(), 50);
+
+	int expected = 98;
+	for (auto iter = tree.rbegin(); iter != tree.rend(); ++iter)
+	{
+		EXPECT_EQ(iter->value, expected);
+		expected -= 2;
+	}
+
+	auto iter = tree.end();
+	--iter;
+	EXPECT_EQ(iter->value, 98);
+
+	auto[first, last] = tree.equal_range(42);
+	EXPECT_EQ(first->value, 42);
+	EXPECT_EQ(last->value, 44);
+
+	tree.clear();
+}
+
+TEST(BTreeTest, RemoveElement)
+{
+	using tree_type = btree<btree_test_class, int, &btree_test_class::value, true>;
+
+	vector<btree_test_class> items(10);
+	tree_type tree;
+	for (int i = 0; i < 10; i++)
+	{
+		items[i].value = i;
+		tree.insert(items[i]);
+	}
+
+	// another object with the key of an element in the tree leaves the element there
+	btree_test_class other{ 5 };
+	EXPECT_FALSE(tree.remove_element(other));
+	EXPECT_EQ(tree.size(), 10);
+	EXPECT_EQ(tree.find_ptr(5), &items[5]);
+
+	EXPECT_TRUE(tree.remove_element(items[5]));
+	EXPECT_EQ(tree.size(), 9);
+	EXPECT_EQ(tree.find_ptr(5), nullptr);
+
+	// while remove() takes the element with its key
+	btree_test_class another{ 6 };
+	tree.remove(another);
+	EXPECT_EQ(tree.size(), 8);
+	EXPECT_EQ(tree.find_ptr(6), nullptr);
+
+	vector<int> values;
+	tree.for_each([&values](btree_test_class& item)
+	{
+		values.push_back(item.value);
+	});
+	EXPECT_EQ(values, (vector<int>{ 0, 1, 2, 3, 4, 7, 8, 9 }));
+
+	tree.clear();
+}
+
+class btree_string_class
+{
+public:
+	string name;
+
+	using tree_type = btree<btree_string_class, decltype(name), &btree_string_class::name>;
+};
+
+TEST(BTreeTest, NonIntegralKeys)
+{
+	vector<btree_string_class> items(500);
+	btree_string_class::tree_type tree;
+	std::set<string> reference;
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		items[i].name = "item" + to_string(i * 7919 % 1000);
+		tree.insert(items[i]);
+		reference.insert(items[i].name);
+	}
+
+	EXPECT_EQ(tree.size(), reference.size());
+
+	auto expected = reference.begin();
+	for (auto& item:tree)
+	{
+		EXPECT_EQ(item.name, *expected++);
+	}
+
+	EXPECT_EQ(tree.find("item0")->name, "item0");
+	EXPECT_EQ(tree.find("item"), tree.end());
+
+	tree.clear();
+}
+
+struct failing_allocator
+{
+	size_t budget{ 0 };
+
+	void* allocate(size_t bytes, size_t alignment)
+	{
+		if (budget == 0)
+			return nullptr;
+
+		budget--;
+		return default_allocator{}.allocate(bytes, alignment);
+	}
+
+	void deallocate(void* ptr, size_t bytes, size_t alignment)
+	{
+		default_allocator{}.deallocate(ptr, bytes, alignment);
+	}
+};
+
+TEST(BTreeTest, AllocationFailure)
+{
+	using tree_type = btree<btree_test_class,
+							int,
+							&btree_test_class::value,
+							false,
+							false,
+							btree_default_comparer<int>,
+							default_deleter<btree_test_class>,
+							failing_allocator,
+							lock::shared_mutex,
+							4>;
+
+	vector<btree_test_class> items(5);
+	for (int i = 0; i < 5; i++)
+	{
+		items[i].value = i;
+	}
+
+	// room for one leaf only, so the fifth element can't split it and the tree stays as it was
+	tree_type tree{ failing_allocator{ 1 }};
+	for (int i = 0; i < 4; i++)
+	{
+		EXPECT_TRUE(tree.insert(items[i]));
+	}
+
+	EXPECT_FALSE(tree.insert(items[4]));
+	EXPECT_EQ(tree.size(), 4);
+	EXPECT_EQ(tree.find_ptr(4), nullptr);
+	EXPECT_EQ(tree.back().value, 3);
+
+	tree.clear();
+}
@@ -0,0 +1,501 @@
+#include <gtest/gtest.h>
+
+#include <hash_table.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace kbl;
+using namespace std;
+
+class hash_table_bench_class
+{
+public:
+	int value{ 0 };
+
+	hash_table_link<hash_table_bench_class> link{ this };
+
+	using table_type = intrusive_hash_table<hash_table_bench_class,
+											decltype(value),
+											&hash_table_bench_class::value,
+											&hash_table_bench_class::link>;
+};
+
+template<typename TFunc>
+static double measure_ms(TFunc&& func)
+{
+	auto start = chrono::steady_clock::now();
+	func();
+	auto end = chrono::steady_clock::now();
+	return chrono::duration<double, milli>(end - start).count();
+}
+
+static void report(const char* name, size_t ops, double ms)
+{
+	printf("%-40s %10zu ops %10.2f ms %10.2f Mops/s\n", name, ops, ms, ops / ms / 1000.0);
+}
+
+class HashTableBenchmark : public testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		items.resize(COUNT);
+		keys.resize(COUNT);
+		iota(keys.begin(), keys.end(), 0);
+		shuffle(keys.begin(), keys.end(), mt19937{ 20011204 });
+
+		for (size_t i = 0; i < COUNT; i++)
+		{
+			items[i].value = keys[i];
+		}
+
+		lookups = keys;
+		shuffle(lookups.begin(), lookups.end(), mt19937{ 1919810 });
+	}
+
+	static constexpr size_t COUNT = 1 << 20;
+
+	vector<hash_table_bench_class> items;
+	vector<int> keys, lookups;
+};
+
+TEST_F(HashTableBenchmark, AgainstUnorderedMap)
+{
+	size_t found = 0;
+
+	{
+		// the same number of buckets unordered_map ends with, so both run at a load factor of about one
+		vector<hash_table_bench_class::table_type::bucket_type> buckets(COUNT);
+		hash_table_bench_class::table_type table{ buckets.data(), buckets.size() };
+
+		report("intrusive_hash_table insert", COUNT, measure_ms([&]
+		{
+			for (auto& item:items)
+				table.insert(item);
+		}));
+
+		report("intrusive_hash_table find", COUNT, measure_ms([&]
+		{
+			for (auto key:lookups)
+				found += table.find_ptr(key) != nullptr;
+		}));
+
+		report("intrusive_hash_table remove", COUNT, measure_ms([&]
+		{
+			for (auto& item:items)
+				table.remove(item);
+		}));
+	}
+
+	{
+		// unordered_map allocates a node per element, and grows its buckets as it goes
+		unordered_map<int, hash_table_bench_class*> map;
+
+		report("unordered_map insert", COUNT, measure_ms([&]
+		{
+			for (auto& item:items)
+				map.emplace(item.value, &item);
+		}));
+
+		report("unordered_map find", COUNT, measure_ms([&]
+		{
+			for (auto key:lookups)
+				found += map.find(key) != map.end();
+		}));
+
+		report("unordered_map remove", COUNT, measure_ms([&]
+		{
+			for (auto& item:items)
+				map.erase(item.value);
+		}));
+	}
+
+	EXPECT_EQ(found, COUNT * 2);
+}
+
+// the latency of single inserts while the table doubles whenever its load factor reaches one,
+// with the new bucket arrays allocated outside the measured calls
+TEST_F(HashTableBenchmark, GrowthLatency)
+{
+	using bucket_type = hash_table_bench_class::table_type::bucket_type;
+
+	vector<double> latencies(COUNT);
+
+	// budget 0 rehashes at once
+	for (size_t budget:{ 0, 1, 4, 16 })
+	{
+		vector<unique_ptr<bucket_type[]>> arrays;
+		arrays.emplace_back(new bucket_type[16]{});
+		hash_table_bench_class::table_type table{ arrays.back().get(), 16 };
+
+		for (size_t i = 0; i < COUNT; i++)
+		{
+			bucket_type* next = nullptr;
+			size_t next_count = table.bucket_count() * 2;
+			if (!table.rehashing() && table.size() + 1 > table.bucket_count())
+			{
+				arrays.emplace_back(new bucket_type[next_count]{});
+				next = arrays.back().get();
+			}
+
+			auto start = chrono::steady_clock::now();
+			if (next)
+			{
+				if (budget)
+					table.begin_rehash(next, next_count, budget);
+				else
+					table.rehash(next, next_count);
+			}
+			table.insert(items[i]);
+			auto end = chrono::steady_clock::now();
+
+			latencies[i] = chrono::duration<double, nano>(end - start).count();
+			table.take_retired_buckets();
+		}
+
+		EXPECT_EQ(table.size(), COUNT);
+		table.clear();
+
+		sort(latencies.begin(), latencies.end());
+		auto percentile = [&latencies](double p)
+		{
+			return latencies[static_cast<size_t>(p * static_cast<double>(latencies.size() - 1))];
+		};
+
+		// the table doubles only about twenty times, so the rehashes themselves show beyond p99.99
+		printf("budget %-4zu p50 %6.0f ns  p99.9 %6.0f ns  p99.99 %8.0f ns  max %10.0f ns\n",
+				budget, percentile(0.5), percentile(0.999), percentile(0.9999), latencies.back());
+	}
+}
+
+// lookups that hit, and lookups of keys just past the inserted ones that all miss
+TEST_F(HashTableBenchmark, FlatMapHitsAndMisses)
+{
+	vector<int> misses(lookups);
+	for (auto& key:misses)
+	{
+		key += static_cast<int>(COUNT);
+	}
+
+	auto run_lookups = [this, &misses](const char* name, auto&& find)
+	{
+		char title[96]{};
+		size_t found = 0;
+
+		snprintf(title, sizeof(title), "%s hits", name);
+		report(title, COUNT, measure_ms([&]
+		{
+			for (auto key:lookups)
+				found += find(key);
+		}));
+
+		snprintf(title, sizeof(title), "%s misses", name);
+		report(title, COUNT, measure_ms([&]
+		{
+			for (auto key:misses)
+				found += find(key);
+		}));
+
+		EXPECT_EQ(found, COUNT);
+	};
+
+	{
+		flat_hash_map<int, hash_table_bench_class*> map;
+		report("flat_hash_map insert", COUNT, measure_ms([&]
+		{
+			for (auto& item:items)
+				map.insert(item.value, &item);
+		}));
+
+		run_lookups("flat_hash_map", [&map](int key)
+		{
+			return map.find_ptr(key) != nullptr;
+		});
+	}
+
+	{
+		vector<hash_table_bench_class::table_type::bucket_type> buckets(COUNT);
+		hash_table_bench_class::table_type table{ buckets.data(), buckets.size() };
+		report("intrusive_hash_table insert", COUNT, measure_ms([&]
+		{
+			for (auto& item:items)
+				table.insert(item);
+		}));
+
+		run_lookups("intrusive_hash_table", [&table](int key)
+		{
+			return table.find_ptr(key) != nullptr;
+		});
+
+		table.clear();
+	}
+
+	{
+		unordered_map<int, hash_table_bench_class*> map;
+		report("unordered_map insert", COUNT, measure_ms([&]
+		{
+			for (auto& item:items)
+				map.emplace(item.value, &item);
+		}));
+
+		run_lookups("unordered_map", [&map](int key)
+		{
+			return map.find(key) != map.end();
+		});
+	}
+}
+
+// both probing policies filled to just under their 7/8 growth point, where misses probe the longest
+TEST_F(HashTableBenchmark, FlatMapProbingPolicies)
+{
+	size_t count = COUNT / 8 * 7 - 1;
+
+	vector<int> misses(lookups);
+	for (auto& key:misses)
+	{
+		key += static_cast<int>(COUNT);
+	}
+
+	auto run = [&](const char* name, auto& map)
+	{
+		char title[96]{};
+		size_t found = 0;
+
+		map.reserve(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			map.insert(items[i].value, &items[i]);
+		}
+
+		snprintf(title, sizeof(title), "%s hits", name);
+		report(title, COUNT, measure_ms([&]
+		{
+			for (auto key:lookups)
+				found += map.find_ptr(key) != nullptr;
+		}));
+
+		snprintf(title, sizeof(title), "%s misses", name);
+		report(title, COUNT, measure_ms([&]
+		{
+			for (auto key:misses)
+				found += map.find_ptr(key) != nullptr;
+		}));
+
+		auto stats = map.probe_stats();
+		printf("%s load %.3f, probe length max %zu average %.3f\n", name, map.load_factor(), stats.max, stats.average);
+		EXPECT_EQ(found, count);
+	};
+
+	{
+		flat_hash_map<int, hash_table_bench_class*> map;
+		run("swiss", map);
+	}
+
+	{
+		flat_hash_map<int,
+					  hash_table_bench_class*,
+					  std::hash<int>,
+					  std::equal_to<int>,
+					  default_allocator,
+					  flat_hash_robin_hood_probing> map;
+		run("robin hood", map);
+	}
+}
+
+class hash_table_concurrent_bench_class
+{
+public:
+	int value{ 0 };
+
+	hash_table_link<hash_table_concurrent_bench_class> link{ this };
+
+	using locked_table_type = intrusive_hash_table<hash_table_concurrent_bench_class,
+												   decltype(value),
+												   &hash_table_concurrent_bench_class::value,
+												   &hash_table_concurrent_bench_class::link,
+												   std::hash<int>,
+												   std::equal_to<int>,
+												   true>;
+
+	using striped_table_type = striped_hash_table<hash_table_concurrent_bench_class,
+												  decltype(value),
+												  &hash_table_concurrent_bench_class::value,
+												  &hash_table_concurrent_bench_class::link>;
+
+	split_ordered_link<hash_table_concurrent_bench_class> split_link{ this };
+
+	using split_ordered_table_type = split_ordered_hash_table<hash_table_concurrent_bench_class,
+															  decltype(value),
+															  &hash_table_concurrent_bench_class::value,
+															  &hash_table_concurrent_bench_class::split_link>;
+};
+
+// every thread looks up random keys, and inserts or removes one of its own elements every update_period operations
+template<typename TTable>
+static void run_scaling(const char* name, size_t thread_count, size_t update_period)
+{
+	constexpr size_t COUNT = 1 << 18, OPS_PER_THREAD = 1 << 20;
+
+	vector<hash_table_concurrent_bench_class> items(COUNT);
+	for (size_t i = 0; i < COUNT; i++)
+	{
+		items[i].value = static_cast<int>(i);
+	}
+
+	// the split-ordered table grows by itself, the others get as many buckets as elements
+	vector<hash_table_link<hash_table_concurrent_bench_class>*> buckets(COUNT);
+	unique_ptr<TTable> table_holder;
+	if constexpr (is_default_constructible_v<TTable>)
+		table_holder = make_unique<TTable>();
+	else
+		table_holder = make_unique<TTable>(buckets.data(), buckets.size());
+
+	auto& table = *table_holder;
+	for (size_t i = 0; i < COUNT; i += 2)
+	{
+		table.insert(items[i]);
+	}
+
+	auto ms = measure_ms([&]
+	{
+		vector<thread> threads;
+		for (size_t t = 0; t < thread_count; t++)
+		{
+			threads.emplace_back([&table, &items, t, thread_count, update_period]
+			{
+				mt19937 rng{ static_cast<unsigned>(t + 1) };
+				size_t own_first = COUNT / thread_count * t, own_count = COUNT / thread_count;
+
+				size_t found = 0;
+				for (size_t i = 0; i < OPS_PER_THREAD; i++)
+				{
+					if (i % update_period == 0)
+					{
+						auto& item = items[own_first + rng() % own_count];
+						if (!table.insert(item))
+							table.remove(item);
+					}
+					else
+					{
+						found += table.find_ptr(static_cast<int>(rng() % COUNT)) != nullptr;
+					}
+				}
+				EXPECT_GT(found, 0);
+			});
+		}
+
+		for (auto& th:threads)
+		{
+			th.join();
+		}
+	});
+
+	char title[96]{};
+	snprintf(title, sizeof(title), "%s, 1/%zu updates, %zu threads", name, update_period, thread_count);
+	report(title, OPS_PER_THREAD * thread_count, ms);
+
+}
+
+TEST(HashTableConcurrentBenchmark, Scaling)
+{
+	size_t max_threads = std::max(thread::hardware_concurrency(), 4u);
+
+	for (size_t threads = 1; threads <= max_threads; threads *= 2)
+	{
+		run_scaling<hash_table_concurrent_bench_class::locked_table_type>("single lock", threads, 10);
+		run_scaling<hash_table_concurrent_bench_class::striped_table_type>("striped", threads, 10);
+	}
+}
+
+TEST(HashTableConcurrentBenchmark, ReadMostlyLockFree)
+{
+	size_t max_threads = std::max(thread::hardware_concurrency(), 4u);
+
+	for (size_t threads = 1; threads <= max_threads; threads *= 2)
+	{
+		run_scaling<hash_table_concurrent_bench_class::striped_table_type>("striped", threads, 100);
+		run_scaling<hash_table_concurrent_bench_class::split_ordered_table_type>("split-ordered", threads, 100);
+	}
+}
+
+// filling a cuckoo map up to each load factor, then threads looking up keys, half of which miss, while
+// erasing and inserting one of their own keys again every update_period operations
+TEST(HashTableConcurrentBenchmark, CuckooLoadFactors)
+{
+	constexpr size_t CAPACITY = 1 << 20, OPS_PER_THREAD = 1 << 20, UPDATE_PERIOD = 10;
+
+	size_t max_threads = std::max(thread::hardware_concurrency(), 4u);
+
+	// the keys past the inserted ones are the misses
+	vector<uint64_t> keys(CAPACITY * 2);
+	mt19937_64 rng{ 20011204 };
+	for (auto& key:keys)
+	{
+		key = rng();
+	}
+
+	for (double load:{ 0.5, 0.75, 0.9, 0.95 })
+	{
+		auto count = static_cast<size_t>(load * CAPACITY);
+
+		cuckoo_hash_map<uint64_t, uint64_t> map;
+		ASSERT_TRUE(map.reserve(static_cast<size_t>(CAPACITY * map.TARGET_LOAD)));
+
+		char title[96]{};
+		snprintf(title, sizeof(title), "cuckoo insert up to load %.2f", load);
+		report(title, count, measure_ms([&]
+		{
+			for (size_t i = 0; i < count; i++)
+				EXPECT_NE(map.insert(keys[i], i), cuckoo_insert_status::FULL);
+		}));
+
+		for (size_t threads = 1; threads <= max_threads; threads *= 2)
+		{
+			auto ms = measure_ms([&]
+			{
+				vector<thread> workers;
+				for (size_t t = 0; t < threads; t++)
+				{
+					workers.emplace_back([&map, &keys, t, threads, count]
+					{
+						mt19937 rng{ static_cast<unsigned>(t + 1) };
+						size_t own_first = count / threads * t, own_count = count / threads;
+
+						size_t found = 0;
+						uint64_t value = 0;
+						for (size_t i = 0; i < OPS_PER_THREAD; i++)
+						{
+							if (i % UPDATE_PERIOD == 0)
+							{
+								auto key = keys[own_first + rng() % own_count];
+								map.erase(key);
+								EXPECT_NE(map.insert(key, i), cuckoo_insert_status::FULL);
+							}
+							else
+							{
+								found += map.find(keys[(rng() % count) * (i % 2 ? 1 : 2)], value);
+							}
+						}
+						EXPECT_GT(found, 0);
+					});
+				}
+
+				for (auto& th:workers)
+				{
+					th.join();
+				}
+			});
+
+			snprintf(title, sizeof(title), "cuckoo load %.2f, 1/%zu updates, %zu threads", load, UPDATE_PERIOD, threads);
+			report(title, OPS_PER_THREAD * threads, ms);
+		}
+	}
+}
@@ -0,0 +1,872 @@
+#include <gtest/gtest.h>
+
+#include <hash_table.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace kbl;
+using namespace std;
+
+class hash_table_test_class
+{
+public:
+	hash_table_test_class() = default;
+
+	explicit hash_table_test_class(int v) : value(v)
+	{
+	}
+
+	int value{ 0 };
+
+	hash_table_link<hash_table_test_class> link{ this };
+
+	using table_type = intrusive_hash_table<hash_table_test_class,
+											decltype(value),
+											&hash_table_test_class::value,
+											&hash_table_test_class::link>;
+};
+
+static void check_against(hash_table_test_class::table_type& table, const unordered_set<int>& reference)
+{
+	ASSERT_EQ(table.size(), reference.size());
+
+	size_t visited = 0;
+	for (auto& item:table)
+	{
+		ASSERT_TRUE(reference.contains(item.value));
+		visited++;
+	}
+	EXPECT_EQ(visited, reference.size());
+}
+
+TEST(HashTableTest, InsertRemove)
+{
+	constexpr size_t COUNT = 5000;
+
+	std::mt19937 rng{ 20011204 };
+
+	vector<hash_table_test_class> items(COUNT);
+	for (size_t i = 0; i < COUNT; i++)
+	{
+		items[i].value = static_cast<int>(i * 3);
+	}
+
+	// 1000 buckets round down to 512, so chains grow to several elements
+	vector<hash_table_test_class::table_type::bucket_type> buckets(1000);
+	hash_table_test_class::table_type table{ buckets.data(), buckets.size() };
+	EXPECT_EQ(table.bucket_count(), 512);
+
+	unordered_set<int> reference;
+	for (size_t step = 0; step < 100000; step++)
+	{
+		auto& item = items[rng() % COUNT];
+		switch (rng() % 3)
+		{
+		case 0:
+			EXPECT_EQ(table.insert(item), reference.insert(item.value).second);
+			break;
+		case 1:
+			EXPECT_EQ(table.remove(item), reference.erase(item.value) == 1);
+			break;
+		default:
+			EXPECT_EQ(table.remove_by_key(item.value), reference.erase(item.value) == 1);
+			break;
+		}
+
+		if (step % 5000 == 0)
+			check_against(table, reference);
+	}
+	check_against(table, reference);
+
+	for (int key = -1; key <= static_cast<int>(COUNT * 3); key++)
+	{
+		auto ptr = table.find_ptr(key);
+		EXPECT_EQ(ptr != nullptr, reference.contains(key));
+		if (ptr)
+		{
+			EXPECT_EQ(ptr->value, key);
+			EXPECT_EQ(table.find(key)->value, key);
+		}
+		else
+		{
+			EXPECT_EQ(table.find(key), table.end());
+		}
+	}
+
+	table.clear();
+	EXPECT_TRUE(table.empty());
+	EXPECT_EQ(table.begin(), table.end());
+}
+
+TEST(HashTableTest, Rehash)
+{
+	hash_table_test_class::table_type::bucket_type small[4]{}, large[64]{};
+	hash_table_test_class::table_type table{ small };
+
+	vector<hash_table_test_class> items(200);
+	for (int i = 0; i < 200; i++)
+	{
+		items[i].value = i;
+		EXPECT_TRUE(table.insert(items[i]));
+	}
+	EXPECT_DOUBLE_EQ(table.load_factor(), 50.0);
+
+	// no buckets to move to leaves the table as it was
+	EXPECT_EQ(table.rehash(large, 0), nullptr);
+	EXPECT_FALSE(table.begin_rehash(large, 0, 1));
+	EXPECT_EQ(table.bucket_count(), 4);
+	EXPECT_EQ(table.find_ptr(199), &items[199]);
+
+	EXPECT_EQ(table.rehash(large, 64), small);
+	EXPECT_EQ(table.bucket_count(), 64);
+	EXPECT_EQ(table.size(), 200);
+	for (auto bucket:small)
+	{
+		EXPECT_EQ(bucket, nullptr);
+	}
+
+	for (int i = 0; i < 200; i++)
+	{
+		EXPECT_EQ(table.find_ptr(i), &items[i]);
+	}
+
+	// an element with a duplicate key is refused
+	hash_table_test_class duplicate{ 7 };
+	EXPECT_FALSE(table.insert(duplicate));
+	EXPECT_FALSE(table.remove(duplicate));
+	EXPECT_EQ(table.find_ptr(7), &items[7]);
+
+	size_t count = 0;
+	for ([[maybe_unused]] auto& item:table)
+	{
+		count++;
+	}
+	EXPECT_EQ(count, 200);
+
+	table.clear();
+}
+
+class hash_table_string_class
+{
+public:
+	string name;
+
+	hash_table_link<hash_table_string_class> link{ this };
+
+	using table_type = intrusive_hash_table<hash_table_string_class,
+											decltype(name),
+											&hash_table_string_class::name,
+											&hash_table_string_class::link,
+											std::hash<string>,
+											std::equal_to<string>,
+											true,
+											true>;
+};
+
+TEST(HashTableTest, DeleteOnRemoval)
+{
+	hash_table_string_class::table_type::bucket_type buckets[32]{};
+	hash_table_string_class::table_type table{ buckets };
+
+	for (int i = 0; i < 100; i++)
+	{
+		auto item = new hash_table_string_class;
+		item->name = "item" + to_string(i);
+		EXPECT_TRUE(table.insert(item));
+	}
+
+	EXPECT_TRUE(table.contains("item42"));
+	EXPECT_TRUE(table.remove_by_key("item42"));
+	EXPECT_FALSE(table.contains("item42"));
+	EXPECT_EQ(table.size(), 99);
+
+	size_t visited = 0;
+	table.for_each([&visited](hash_table_string_class& item)
+	{
+		EXPECT_NE(item.name, "item42");
+		visited++;
+	});
+	EXPECT_EQ(visited, 99);
+
+	// the remaining ones are deleted by clear(), which the address sanitizer checks
+	table.clear();
+	EXPECT_TRUE(table.empty());
+}
+
+TEST(HashTableTest, IncrementalRehash)
+{
+	constexpr size_t COUNT = 3000;
+
+	std::mt19937 rng{ 20011204 };
+
+	vector<hash_table_test_class> items(COUNT);
+	for (size_t i = 0; i < COUNT; i++)
+	{
+		items[i].value = static_cast<int>(i);
+	}
+
+	// keep doubling at a load factor of two, so a rehash is in progress most of the time
+	vector<vector<hash_table_test_class::table_type::bucket_type>> arrays;
+	arrays.emplace_back(4);
+	hash_table_test_class::table_type table{ arrays.back().data(), arrays.back().size() };
+
+	unordered_set<int> reference;
+	size_t retired = 0;
+	for (size_t step = 0; step < 40000; step++)
+	{
+		auto& item = items[rng() % COUNT];
+		if (rng() % 3)
+			EXPECT_EQ(table.insert(item), reference.insert(item.value).second);
+		else
+			EXPECT_EQ(table.remove_by_key(item.value), reference.erase(item.value) == 1);
+
+		if (auto buckets = table.take_retired_buckets())
+		{
+			EXPECT_TRUE(std::all_of(buckets, buckets + table.bucket_count() / 2, [](auto b)
+			{ return b == nullptr; }));
+			retired++;
+		}
+
+		if (!table.rehashing() && table.load_factor() > 2.0)
+		{
+			arrays.emplace_back(table.bucket_count() * 2);
+			EXPECT_TRUE(table.begin_rehash(arrays.back().data(), arrays.back().size(), 2));
+			EXPECT_FALSE(table.begin_rehash(arrays.back().data(), arrays.back().size(), 2));
+		}
+
+		if (step % 1000 == 0)
+		{
+			check_against(table, reference);
+			for (auto key:reference)
+			{
+				ASSERT_EQ(table.find(key)->value, key);
+			}
+		}
+	}
+	check_against(table, reference);
+	EXPECT_GE(retired, 5);
+
+	// the synchronous rehash waits for the incremental one to complete
+	if (!table.rehashing())
+	{
+		table.take_retired_buckets();
+		arrays.emplace_back(table.bucket_count() * 2);
+		EXPECT_TRUE(table.begin_rehash(arrays.back().data(), arrays.back().size(), 2));
+	}
+	auto current = arrays.back().data();
+
+	arrays.emplace_back(table.bucket_count() * 2);
+	EXPECT_EQ(table.rehash(arrays.back().data(), arrays.back().size()), nullptr);
+	EXPECT_TRUE(table.rehashing());
+
+	while (!table.rehash_step(16))
+	{
+	}
+	EXPECT_NE(table.take_retired_buckets(), nullptr);
+	EXPECT_EQ(table.rehash(arrays.back().data(), arrays.back().size()), current);
+	EXPECT_FALSE(table.rehashing());
+	check_against(table, reference);
+
+	table.clear();
+	EXPECT_TRUE(table.empty());
+}
+
+class hash_table_striped_class
+{
+public:
+	int value{ 0 };
+
+	hash_table_link<hash_table_striped_class> link{ this };
+
+	using table_type = striped_hash_table<hash_table_striped_class,
+										  decltype(value),
+										  &hash_table_striped_class::value,
+										  &hash_table_striped_class::link,
+										  std::hash<int>,
+										  std::equal_to<int>,
+										  false,
+										  default_deleter<hash_table_striped_class>,
+										  lock::shared_mutex,
+										  8>;
+};
+
+TEST(HashTableTest, StripedConcurrent)
+{
+	constexpr int THREADS = 4, PER_THREAD = 5000;
+
+	vector<hash_table_striped_class> items(THREADS * PER_THREAD);
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		items[i].value = static_cast<int>(i);
+	}
+
+	vector<hash_table_striped_class::table_type::bucket_type> buckets(1024), larger(4096);
+	hash_table_striped_class::table_type table{ buckets.data(), buckets.size() };
+	EXPECT_EQ(table.bucket_count(), 1024);
+
+	// each thread inserts its own range, then removes the odd keys of it, while looking up the others'
+	vector<thread> threads;
+	for (int t = 0; t < THREADS; t++)
+	{
+		threads.emplace_back([&table, &items, t]
+		{
+			for (int i = t * PER_THREAD; i < (t + 1) * PER_THREAD; i++)
+			{
+				EXPECT_TRUE(table.insert(items[i]));
+				EXPECT_FALSE(table.insert(items[i]));
+				table.find_ptr((i + PER_THREAD) % (THREADS * PER_THREAD));
+			}
+
+			for (int i = t * PER_THREAD + 1; i < (t + 1) * PER_THREAD; i += 2)
+			{
+				if (i % 4 == 1)
+					EXPECT_TRUE(table.remove(items[i]));
+				else
+					EXPECT_TRUE(table.remove_by_key(i));
+			}
+		});
+	}
+
+	// fewer buckets than stripes are refused, concurrently with the threads as well
+	EXPECT_EQ(table.rehash(larger.data(), hash_table_striped_class::table_type::stripe_count() - 1), nullptr);
+	EXPECT_EQ(table.bucket_count(), 1024);
+
+	// rehashing takes one stripe at a time, concurrently with the threads
+	EXPECT_EQ(table.rehash(larger.data(), larger.size()), buckets.data());
+
+	for (auto& th:threads)
+	{
+		th.join();
+	}
+
+	EXPECT_EQ(table.size(), THREADS * PER_THREAD / 2);
+	EXPECT_EQ(table.bucket_count(), 4096);
+
+	for (int i = 0; i < THREADS * PER_THREAD; i++)
+	{
+		EXPECT_EQ(table.contains(i), i % 2 == 0);
+	}
+
+	size_t visited = 0;
+	table.for_each([&visited](hash_table_striped_class& item)
+	{
+		EXPECT_EQ(item.value % 2, 0);
+		visited++;
+	});
+	EXPECT_EQ(visited, THREADS * PER_THREAD / 2);
+
+	table.clear();
+	EXPECT_TRUE(table.empty());
+}
+
+class hash_table_split_class
+{
+public:
+	hash_table_split_class() = default;
+
+	explicit hash_table_split_class(int v) : value(v)
+	{
+	}
+
+	int value{ 0 };
+
+	split_ordered_link<hash_table_split_class> link{ this };
+
+	using table_type = split_ordered_hash_table<hash_table_split_class,
+												decltype(value),
+												&hash_table_split_class::value,
+												&hash_table_split_class::link,
+												std::hash<int>,
+												std::equal_to<int>,
+												false,
+												default_deleter<hash_table_split_class>,
+												default_allocator,
+												4>;
+
+	using deleting_table_type = split_ordered_hash_table<hash_table_split_class,
+														 decltype(value),
+														 &hash_table_split_class::value,
+														 &hash_table_split_class::link,
+														 std::hash<int>,
+														 std::equal_to<int>,
+														 true>;
+};
+
+TEST(HashTableTest, SplitOrderedInsertRemove)
+{
+	constexpr size_t COUNT = 5000;
+
+	std::mt19937 rng{ 20011204 };
+
+	vector<hash_table_split_class> items(COUNT);
+	for (size_t i = 0; i < COUNT; i++)
+	{
+		items[i].value = static_cast<int>(i * 3);
+	}
+
+	// four buckets to start with, so the table doubles many times
+	hash_table_split_class::table_type table;
+	unordered_set<int> reference;
+	for (size_t step = 0; step < 100000; step++)
+	{
+		auto& item = items[rng() % COUNT];
+		switch (rng() % 3)
+		{
+		case 0:
+			EXPECT_EQ(table.insert(item), reference.insert(item.value).second);
+			break;
+		case 1:
+			EXPECT_EQ(table.remove(item), reference.erase(item.value) == 1);
+			table.synchronize();
+			break;
+		default:
+			EXPECT_EQ(table.remove_by_key(item.value), reference.erase(item.value) == 1);
+			table.synchronize();
+			break;
+		}
+	}
+	EXPECT_EQ(table.size(), reference.size());
+	EXPECT_GE(table.bucket_count(), reference.size() / hash_table_split_class::table_type::MAX_LOAD);
+
+	for (int key = -1; key <= static_cast<int>(COUNT * 3); key++)
+	{
+		auto ptr = table.find_ptr(key);
+		EXPECT_EQ(ptr != nullptr, reference.contains(key));
+		if (ptr)
+		{
+			EXPECT_EQ(ptr->value, key);
+		}
+	}
+
+	size_t visited = 0;
+	table.for_each([&visited, &reference](hash_table_split_class& item)
+	{
+		EXPECT_TRUE(reference.contains(item.value));
+		visited++;
+	});
+	EXPECT_EQ(visited, reference.size());
+
+	// an element of the same key is refused, and removing it by pointer does nothing
+	hash_table_split_class duplicate{ *reference.begin() };
+	EXPECT_FALSE(table.insert(duplicate));
+	EXPECT_FALSE(table.remove(duplicate));
+	EXPECT_TRUE(table.contains(duplicate.value));
+}
+
+TEST(HashTableTest, SplitOrderedConcurrent)
+{
+	constexpr int THREADS = 4, KEYS = 2000, STEPS = 20000;
+
+	// elements are deleted by the table once no reader can reach them, which the sanitizers check
+	hash_table_split_class::deleting_table_type table;
+
+	vector<thread> threads;
+	for (int t = 0; t < THREADS; t++)
+	{
+		threads.emplace_back([&table, t]
+		{
+			std::mt19937 rng{ static_cast<unsigned>(t) };
+
+			// each thread owns the keys equal to t modulo THREADS, and reads everyone's
+			for (int step = 0; step < STEPS; step++)
+			{
+				int key = static_cast<int>(rng() % KEYS) * THREADS + t;
+				if (rng() % 2)
+				{
+					auto item = new hash_table_split_class{ key };
+					if (!table.insert(item))
+					{
+						delete item;
+						EXPECT_TRUE(table.remove_by_key(key));
+					}
+				}
+				else
+				{
+					auto other = static_cast<int>(rng() % (KEYS * THREADS));
+					table.visit(other, [other](hash_table_split_class& found)
+					{
+						EXPECT_EQ(found.value, other);
+					});
+				}
+			}
+		});
+	}
+
+	for (auto& th:threads)
+	{
+		th.join();
+	}
+
+	size_t visited = 0;
+	table.for_each([&visited](hash_table_split_class&)
+	{
+		visited++;
+	});
+	EXPECT_EQ(visited, table.size());
+
+	// delete what is left, after which the destructor deletes the removed ones still waiting
+	vector<hash_table_split_class*> left;
+	table.for_each([&left](hash_table_split_class& item)
+	{
+		left.push_back(&item);
+	});
+	for (auto item:left)
+	{
+		EXPECT_TRUE(table.remove(item));
+	}
+	EXPECT_TRUE(table.empty());
+}
+
+using robin_hood_map_type = flat_hash_map<int,
+										   int,
+										   std::hash<int>,
+										   std::equal_to<int>,
+										   default_allocator,
+										   flat_hash_robin_hood_probing>;
+
+template<typename TMap>
+static void flat_map_insert_erase()
+{
+	std::mt19937 rng{ 20011204 };
+
+	TMap map;
+	unordered_map<int, int> reference;
+	for (int step = 0; step < 200000; step++)
+	{
+		int key = static_cast<int>(rng() % 20000);
+		if (rng() % 3)
+		{
+			auto[value, inserted] = map.insert(key, key * 2);
+			EXPECT_EQ(inserted, reference.emplace(key, key * 2).second);
+			ASSERT_NE(value, nullptr);
+			EXPECT_EQ(*value, key * 2);
+		}
+		else
+		{
+			EXPECT_EQ(map.erase(key), reference.erase(key) == 1);
+		}
+	}
+
+	EXPECT_EQ(map.size(), reference.size());
+	EXPECT_LE(map.load_factor(), 0.875);
+
+	for (int key = -1; key <= 20000; key++)
+	{
+		auto value = map.find_ptr(key);
+		EXPECT_EQ(value != nullptr, reference.contains(key));
+		if (value)
+		{
+			EXPECT_EQ(*value, key * 2);
+		}
+	}
+
+	size_t visited = 0;
+	for (auto& [key, value]:map)
+	{
+		EXPECT_EQ(reference.at(key), value);
+		visited++;
+	}
+	EXPECT_EQ(visited, reference.size());
+
+	// erasing while iterating
+	for (auto iter = map.begin(); iter != map.end();)
+	{
+		if (iter->first % 2)
+			iter = map.erase(iter);
+		else
+			++iter;
+	}
+	for (auto& [key, value]:map)
+	{
+		EXPECT_EQ(key % 2, 0);
+	}
+
+	map.clear();
+	EXPECT_TRUE(map.empty());
+	EXPECT_EQ(map.begin(), map.end());
+	EXPECT_FALSE(map.contains(0));
+}
+
+TEST(HashTableTest, FlatMapInsertErase)
+{
+	flat_map_insert_erase<flat_hash_map<int, int>>();
+}
+
+TEST(HashTableTest, RobinHoodInsertErase)
+{
+	flat_map_insert_erase<robin_hood_map_type>();
+}
+
+TEST(HashTableTest, RobinHoodProbeLengths)
+{
+	robin_hood_map_type map;
+	ASSERT_TRUE(map.reserve(100000));
+
+	auto capacity = map.capacity();
+	for (int key = 0; key < 100000; key++)
+	{
+		map.insert(key, key);
+	}
+	EXPECT_EQ(map.capacity(), capacity);
+
+	// at a load factor over 0.7, probes stay short
+	auto stats = map.probe_stats();
+	EXPECT_GT(map.load_factor(), 0.7);
+	EXPECT_LT(stats.average, 2.0);
+	EXPECT_LT(stats.max, 40);
+
+	// backward shifting keeps every remaining element reachable, and leaves nothing behind
+	for (int key = 0; key < 100000; key += 3)
+	{
+		EXPECT_TRUE(map.erase(key));
+	}
+	for (int key = 0; key < 100000; key++)
+	{
+		EXPECT_EQ(map.contains(key), key % 3 != 0);
+	}
+	EXPECT_LE(map.probe_stats().average, stats.average);
+}
+
+struct degenerate_hash
+{
+	size_t operator()(int) const
+	{
+		return 0;
+	}
+};
+
+TEST(HashTableTest, RobinHoodDegenerateHash)
+{
+	flat_hash_map<int,
+				  int,
+				  degenerate_hash,
+				  std::equal_to<int>,
+				  default_allocator,
+				  flat_hash_robin_hood_probing> map;
+
+	// every key has the same home, so the 256th would be further from it than a control byte records
+	for (int key = 0; key < 255; key++)
+	{
+		EXPECT_TRUE(map.insert(key, key).second);
+	}
+
+	auto[value, inserted] = map.insert(255, 255);
+	EXPECT_EQ(value, nullptr);
+	EXPECT_FALSE(inserted);
+	EXPECT_EQ(map.size(), 255);
+	EXPECT_EQ(map.probe_stats().max, 254);
+
+	for (int key = 0; key < 255; key++)
+	{
+		EXPECT_EQ(*map.find_ptr(key), key);
+	}
+}
+
+TEST(HashTableTest, FlatMapChurnKeepsCapacity)
+{
+	flat_hash_map<int, int> map;
+	ASSERT_TRUE(map.reserve(1000));
+	auto capacity = map.capacity();
+
+	// a sliding window of keys leaves tombstones behind, which rebuilding at the same size drops
+	for (int key = 0; key < 100000; key++)
+	{
+		EXPECT_TRUE(map.insert(key, key).second);
+		if (key >= 1000)
+		{
+			EXPECT_TRUE(map.erase(key - 1000));
+		}
+	}
+
+	EXPECT_EQ(map.size(), 1000);
+	EXPECT_EQ(map.capacity(), capacity);
+	for (int key = 99000; key < 100000; key++)
+	{
+		EXPECT_EQ(*map.find_ptr(key), key);
+	}
+}
+
+TEST(HashTableTest, FlatMapOwnsValues)
+{
+	flat_hash_map<int, string> map;
+	for (int i = 0; i < 1000; i++)
+	{
+		map.insert(i, "a value too long for the small string buffer " + to_string(i));
+	}
+
+	EXPECT_EQ(*map.find_ptr(500), "a value too long for the small string buffer 500");
+	EXPECT_FALSE(map.insert(500, string{ "another" }).second);
+
+	for (int i = 0; i < 1000; i += 2)
+	{
+		EXPECT_TRUE(map.erase(i));
+	}
+	EXPECT_EQ(map.size(), 500);
+
+	// the rest are destroyed by the destructor, which the address sanitizer checks
+}
+
+TEST(HashTableTest, FlatMapAllocationFailure)
+{
+	struct failing_allocator
+	{
+		size_t budget{ 0 };
+
+		void* allocate(size_t bytes, size_t alignment)
+		{
+			if (budget == 0)
+				return nullptr;
+
+			budget--;
+			return default_allocator{}.allocate(bytes, alignment);
+		}
+
+		void deallocate(void* ptr, size_t bytes, size_t alignment)
+		{
+			default_allocator{}.deallocate(ptr, bytes, alignment);
+		}
+	};
+
+	// room for the smallest capacity only: 14 elements fit, the 15th needs to grow
+	flat_hash_map<int, int, std::hash<int>, std::equal_to<int>, failing_allocator> map{ failing_allocator{ 1 }};
+	for (int i = 0; i < 14; i++)
+	{
+		EXPECT_TRUE(map.insert(i, i).second);
+	}
+
+	auto[value, inserted] = map.insert(14, 14);
+	EXPECT_EQ(value, nullptr);
+	EXPECT_FALSE(inserted);
+	EXPECT_EQ(map.size(), 14);
+	EXPECT_EQ(*map.find_ptr(13), 13);
+}
+
+template<size_t SlotsPerBucket>
+static void cuckoo_fill(double min_load)
+{
+	cuckoo_hash_map<int, int, std::hash<int>, std::equal_to<int>, default_allocator, SlotsPerBucket> map;
+	ASSERT_TRUE(map.reserve(static_cast<size_t>((1 << 14) * map.TARGET_LOAD)));
+	EXPECT_EQ(map.capacity(), 1 << 14);
+
+	// insert until a key finds no room, which the path search puts off until the map is nearly full
+	int count = 0;
+	for (; map.insert(count, count * 2) == cuckoo_insert_status::INSERTED; count++)
+	{
+	}
+
+	EXPECT_GT(map.load_factor(), min_load);
+	EXPECT_EQ(map.size(), count);
+	EXPECT_EQ(map.insert(0, 0), cuckoo_insert_status::EXISTS);
+
+	for (int key = 0; key < count; key++)
+	{
+		int value = 0;
+		EXPECT_TRUE(map.find(key, value));
+		EXPECT_EQ(value, key * 2);
+	}
+	EXPECT_FALSE(map.contains(count + 1));
+
+	for (int key = 0; key < count; key += 2)
+	{
+		EXPECT_TRUE(map.erase(key));
+	}
+	EXPECT_FALSE(map.erase(0));
+	EXPECT_EQ(map.insert(count, count * 2), cuckoo_insert_status::INSERTED);
+
+	// growing moves the elements that are left
+	ASSERT_TRUE(map.reserve(1 << 16));
+	EXPECT_EQ(map.size(), count - (count + 1) / 2 + 1);
+
+	size_t visited = 0;
+	map.for_each([&visited, count](int key, int value)
+	{
+		EXPECT_EQ(value, key * 2);
+		EXPECT_TRUE(key % 2 || key == count);
+		visited++;
+	});
+	EXPECT_EQ(visited, map.size());
+}
+
+TEST(HashTableTest, CuckooFillsUp)
+{
+	cuckoo_fill<4>(0.95);
+	cuckoo_fill<8>(0.98);
+}
+
+TEST(HashTableTest, CuckooConcurrent)
+{
+	struct flow_key
+	{
+		uint32_t source, destination;
+		uint16_t source_port, destination_port;
+		uint32_t protocol;
+
+		bool operator==(const flow_key&) const = default;
+	};
+
+	struct flow_key_hash
+	{
+		size_t operator()(const flow_key& key) const
+		{
+			return (static_cast<size_t>(key.source) << 32 | key.destination) ^ key.source_port ^ key.protocol;
+		}
+	};
+
+	// the halves of a value always match, so a torn copy would show
+	struct flow_stats
+	{
+		uint64_t packets, bytes;
+	};
+
+	constexpr int THREADS = 4, PER_THREAD = 10000;
+
+	cuckoo_hash_map<flow_key, flow_stats, flow_key_hash> map;
+	ASSERT_TRUE(map.reserve(THREADS * PER_THREAD));
+
+	// each thread inserts its own flows and updates them, while reading everyone's
+	vector<thread> threads;
+	for (int t = 0; t < THREADS; t++)
+	{
+		threads.emplace_back([&map, t]
+		{
+			mt19937 rng{ static_cast<unsigned>(t) };
+			for (uint32_t i = t * PER_THREAD; i < static_cast<uint32_t>((t + 1) * PER_THREAD); i++)
+			{
+				EXPECT_EQ(map.insert(flow_key{ i, ~i, 80, 443, 6 }, flow_stats{ 1, 1000 }),
+						cuckoo_insert_status::INSERTED);
+
+				auto own = static_cast<uint32_t>(t * PER_THREAD + rng() % (i - t * PER_THREAD + 1));
+				EXPECT_TRUE(map.assign(flow_key{ own, ~own, 80, 443, 6 }, flow_stats{ i, i * 1000ull }));
+
+				flow_stats stats{};
+				auto other = static_cast<uint32_t>(rng() % (THREADS * PER_THREAD));
+				if (map.find(flow_key{ other, ~other, 80, 443, 6 }, stats))
+				{
+					EXPECT_EQ(stats.packets * 1000, stats.bytes);
+				}
+			}
+
+			for (uint32_t i = t * PER_THREAD; i < static_cast<uint32_t>((t + 1) * PER_THREAD); i += 2)
+			{
+				EXPECT_TRUE(map.erase(flow_key{ i, ~i, 80, 443, 6 }));
+			}
+		});
+	}
+
+	for (auto& th:threads)
+	{
+		th.join();
+	}
+
+	EXPECT_EQ(map.size(), THREADS * PER_THREAD / 2);
+	for (uint32_t i = 0; i < THREADS * PER_THREAD; i++)
+	{
+		EXPECT_EQ(map.contains(flow_key{ i, ~i, 80, 443, 6 }), i % 2 == 1);
+	}
+}
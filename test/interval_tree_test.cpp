@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+
+#include <interval_tree.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace kbl;
+using namespace std;
+
+class interval_test_class
+{
+public:
+	interval_test_class() = default;
+
+	interval_test_class(uint64_t s, uint64_t e) : start(s), end(e)
+	{
+	}
+
+	uint64_t start{ 0 }, end{ 0 };
+
+	interval_tree_link<interval_test_class, &interval_test_class::start, &interval_test_class::end> link{ this };
+
+	using tree_type = interval_tree<interval_test_class,
+									uint64_t,
+									&interval_test_class::start,
+									&interval_test_class::end,
+									&interval_test_class::link>;
+};
+
+class IntervalTreeTestFixture : public testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		std::mt19937 rng{ 20011204 };
+
+		items.reserve(COUNT);
+		for (size_t i = 0; i < COUNT; i++)
+		{
+			// distinct start points, various lengths
+			uint64_t start = i * 16 + rng() % 16;
+			items.emplace_back(start, start + 1 + rng() % 256);
+		}
+
+		for (auto& item:items)
+		{
+			tree.insert(item);
+		}
+	}
+
+	void TearDown() override
+	{
+		tree.clear();
+	}
+
+	vector<interval_test_class*> brute_force(uint64_t lo, uint64_t hi)
+	{
+		vector<interval_test_class*> result;
+		for (auto& item:items)
+		{
+			if (item.start < hi && lo < item.end)
+				result.push_back(&item);
+		}
+		return result;
+	}
+
+	static constexpr size_t COUNT = 2000;
+
+	vector<interval_test_class> items;
+	interval_test_class::tree_type tree;
+};
+
+TEST_F(IntervalTreeTestFixture, FindOverlapping)
+{
+	for (uint64_t lo = 0; lo < COUNT * 16 + 300; lo += 37)
+	{
+		auto hi = lo + 5;
+		auto iter = tree.find_overlapping(lo, hi);
+		auto expected = brute_force(lo, hi);
+
+		if (expected.empty())
+		{
+			EXPECT_EQ(iter, tree.end());
+		}
+		else
+		{
+			ASSERT_NE(iter, tree.end());
+			EXPECT_TRUE(iter->start < hi && lo < iter->end);
+		}
+	}
+
+	EXPECT_EQ(tree.find_overlapping(COUNT * 16 + 300, COUNT * 16 + 400), tree.end());
+}
+
+TEST_F(IntervalTreeTestFixture, ForEachOverlapping)
+{
+	for (uint64_t lo = 0; lo < COUNT * 16 + 300; lo += 101)
+	{
+		auto hi = lo + 200;
+
+		vector<interval_test_class*> found;
+		tree.for_each_overlapping(lo, hi, [&found](interval_test_class& item)
+		{
+			found.push_back(&item);
+		});
+
+		EXPECT_EQ(found, brute_force(lo, hi));
+	}
+}
+
+TEST_F(IntervalTreeTestFixture, MaintainedOnRemoval)
+{
+	// remove every other interval, then the queries must not see them anymore
+	for (size_t i = 0; i < COUNT; i += 2)
+	{
+		tree.remove(items[i]);
+	}
+
+	for (uint64_t lo = 0; lo < COUNT * 16 + 300; lo += 53)
+	{
+		auto hi = lo + 64;
+
+		vector<interval_test_class*> found;
+		tree.for_each_overlapping(lo, hi, [&found](interval_test_class& item)
+		{
+			found.push_back(&item);
+		});
+
+		auto expected = brute_force(lo, hi);
+		expected.erase(std::remove_if(expected.begin(), expected.end(), [this](interval_test_class* item)
+		{
+			return (item - items.data()) % 2 == 0;
+		}), expected.end());
+
+		EXPECT_EQ(found, expected);
+
+		auto iter = tree.find_overlapping(lo, hi);
+		EXPECT_EQ(iter == tree.end(), expected.empty());
+	}
+}